@@ -0,0 +1,17 @@
+@echo off
+
+WHERE cl 
+IF %ERRORLEVEL% NEQ 0 call %VCVARSALL% x64
+
+set WIGNORE=-wd4201 -wd4505 -wd4996 -wd4100 -wd4238 -wd4200
+
+IF NOT EXIST build mkdir build
+pushd build
+
+cl /MD -nologo /O2 -Oi -W4 -GR- -EHa -FC -Z7 /Fehash_bench %WIGNORE% ..\bench\hash_bench.cpp /link -incremental:no -opt:ref
+hash_bench.exe
+
+cl /MD -nologo /O2 -Oi -W4 -GR- -EHa -FC -Z7 /Fenumeric_bench %WIGNORE% ..\bench\numeric_bench.cpp /link -incremental:no -opt:ref
+numeric_bench.exe
+
+popd
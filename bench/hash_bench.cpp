@@ -0,0 +1,177 @@
+// Quality and throughput micro-benchmark for hash_string.
+// Build with bench.bat, or any compiler: c++ -O2 bench/hash_bench.cpp
+#define CLOX_IMPLEMENTATION
+#include "../src/clox.h"
+
+// The hash used before, kept for comparison
+static u32 legacy_hash(const char* key, i32 length)
+{
+    u32 hash = 2166136261u;
+
+    for (i32 i = 0; i < length; i++)
+    {
+        hash ^= key[i];
+        hash += 16777619;
+    }
+
+    return hash;
+}
+
+using HashFn = u32(*)(const char*, i32);
+
+static u64 random_state = 0x853c49e6748fea9bull;
+
+static u64 random_u64()
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+static void random_bytes(char* buffer, i32 length)
+{
+    for (i32 i = 0; i < length; i++)
+    {
+        buffer[i] = (char)(random_u64() & 0xff);
+    }
+}
+
+// Flip every input bit of random keys and record how often each output bit
+// changes. A good hash changes each output bit half of the time.
+static void avalanche(const char* name, HashFn hash, i32 length)
+{
+    const i32 trials = 2000;
+    i32 flips[32] = {};
+    char key[256];
+
+    for (i32 t = 0; t < trials; t++)
+    {
+        random_bytes(key, length);
+        u32 base = hash(key, length);
+        for (i32 bit = 0; bit < length * 8; bit++)
+        {
+            key[bit / 8] ^= (char)(1 << (bit % 8));
+            u32 diff = base ^ hash(key, length);
+            key[bit / 8] ^= (char)(1 << (bit % 8));
+            for (i32 o = 0; o < 32; o++)
+            {
+                flips[o] += (diff >> o) & 1;
+            }
+        }
+    }
+
+    f64 samples = (f64)trials * length * 8;
+    f64 mean = 0;
+    f64 worst = 0;
+    for (i32 o = 0; o < 32; o++)
+    {
+        f64 p = flips[o] / samples;
+        mean += p / 32;
+        f64 bias = fabs(p - 0.5);
+        if (bias > worst) worst = bias;
+    }
+    printf("  %-8s avalanche %3d bytes: mean %.4f, worst bit bias %.4f\n", name, length, mean, worst);
+}
+
+// Sequential identifiers into a power-of-two table, as Table indexes with hash & (capacity - 1)
+static void distribution(const char* name, HashFn hash)
+{
+    const i32 capacity = 1 << 16;
+    const i32 count = capacity * 3 / 4;
+    u32* buckets = (u32*)calloc(capacity, sizeof(u32));
+    u8* used = (u8*)calloc(capacity, 1);
+
+    char key[32];
+    i64 probes = 0;
+    i32 longest = 0;
+    for (i32 i = 0; i < count; i++)
+    {
+        i32 length = snprintf(key, sizeof(key), "key%d", i);
+        u32 index = hash(key, length) & (capacity - 1);
+        buckets[index]++;
+
+        i32 probe = 1;
+        while (used[index])
+        {
+            index = (index + 1) & (capacity - 1);
+            probe++;
+        }
+        used[index] = 1;
+        probes += probe;
+        if (probe > longest) longest = probe;
+    }
+
+    f64 expected = (f64)count / capacity;
+    f64 chi = 0;
+    u32 max_bucket = 0;
+    for (i32 i = 0; i < capacity; i++)
+    {
+        f64 d = buckets[i] - expected;
+        chi += d * d / expected;
+        if (buckets[i] > max_bucket) max_bucket = buckets[i];
+    }
+
+    printf("  %-8s %d keys: chi^2/df %.3f, fullest bucket %u, mean probe %.2f, longest probe %d\n",
+           name, count, chi / (capacity - 1), max_bucket, (f64)probes / count, longest);
+
+    free(buckets);
+    free(used);
+}
+
+static void throughput(const char* name, HashFn hash, i32 length)
+{
+    char* data = (char*)malloc(length);
+    random_bytes(data, length);
+
+    i64 total = 256ll * 1024 * 1024;
+    i64 iterations = total / length;
+    u32 sink = 0;
+
+    clock_t start = clock();
+    for (i64 i = 0; i < iterations; i++)
+    {
+        data[0] = (char)i;
+        sink += hash(data, length);
+    }
+    f64 seconds = (f64)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("  %-8s %8d bytes: %8.2f GB/s %10.1f Mhash/s (%08x)\n", name, length,
+           (f64)iterations * length / seconds / 1e9, iterations / seconds / 1e6, sink);
+    free(data);
+}
+
+int main(int argc, const char* argv[])
+{
+    if (argc > 1) seed_hash(strtoull(argv[1], NULL, 0));
+
+    printf("Quality\n");
+    i32 avalanche_lengths[] = {3, 8, 24, 100, 200};
+    for (i32 length : avalanche_lengths)
+    {
+        avalanche("hash", hash_string, length);
+        avalanche("legacy", legacy_hash, length);
+    }
+    distribution("hash", hash_string);
+    distribution("legacy", legacy_hash);
+
+    printf("Throughput\n");
+    i32 sizes[] = {4, 8, 16, 32, 64, 127, 256, 1024, 64 * 1024, 1024 * 1024};
+    for (i32 size : sizes)
+    {
+        throughput("hash", hash_string, size);
+        throughput("legacy", legacy_hash, size);
+    }
+
+    // Stable across SIMD and scalar builds, so the two paths can be compared
+    char data[4096];
+    random_state = 1;
+    random_bytes(data, sizeof(data));
+    u32 check = 0;
+    for (i32 length = 0; length <= (i32)sizeof(data); length++)
+    {
+        check = check * 31 + hash_string(data, length);
+    }
+    printf("Checksum %08x\n", check);
+    return 0;
+}
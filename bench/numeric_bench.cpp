@@ -0,0 +1,75 @@
+// Throughput of the Float64Array kernels at every SIMD level the machine supports.
+// Build with bench.bat, or any compiler: c++ -O2 bench/numeric_bench.cpp
+#define CLOX_IMPLEMENTATION
+#include "../src/clox.h"
+
+static const char* level_names[] = {"scalar", "sse2", "avx"};
+
+static f64 seconds_since(clock_t start)
+{
+    return (f64)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void bench_level(SimdLevel level, f64* a, f64* b, f64* out, i32 n, i32 repeats)
+{
+    select_numeric_kernels(level);
+    if (numeric.level != level) return;
+
+    f64 bytes = (f64)n * sizeof(f64) * repeats;
+    f64 sink = 0;
+
+    clock_t start = clock();
+    for (i32 r = 0; r < repeats; r++) sink += numeric.sum(a, n);
+    f64 sum_seconds = seconds_since(start);
+
+    start = clock();
+    for (i32 r = 0; r < repeats; r++) sink += numeric.dot(a, b, n);
+    f64 dot_seconds = seconds_since(start);
+
+    start = clock();
+    for (i32 r = 0; r < repeats; r++) sink += numeric.max(a, n);
+    f64 max_seconds = seconds_since(start);
+
+    start = clock();
+    for (i32 r = 0; r < repeats; r++) numeric.axpy(1e-9, a, out, n);
+    f64 axpy_seconds = seconds_since(start);
+
+    start = clock();
+    for (i32 r = 0; r < repeats; r++) numeric.mul(a, b, out, n);
+    f64 mul_seconds = seconds_since(start);
+
+    printf("  %-6s %8d: sum %6.2f GB/s, dot %6.2f GB/s, max %6.2f GB/s, axpy %6.2f GB/s, mul %6.2f GB/s (%g)\n",
+           level_names[level], n,
+           bytes / sum_seconds / 1e9, 2 * bytes / dot_seconds / 1e9, bytes / max_seconds / 1e9,
+           2 * bytes / axpy_seconds / 1e9, 2 * bytes / mul_seconds / 1e9, sink + out[n / 2]);
+}
+
+int main(int argc, const char* argv[])
+{
+    SimdLevel detected = detect_simd_level();
+    printf("Detected %s\n", level_names[detected]);
+
+    i32 sizes[] = {1000, 64 * 1024, 4 * 1024 * 1024};
+    for (i32 n : sizes)
+    {
+        f64* a   = (f64*)malloc(sizeof(f64) * n);
+        f64* b   = (f64*)malloc(sizeof(f64) * n);
+        f64* out = (f64*)calloc(n, sizeof(f64));
+        for (i32 i = 0; i < n; i++)
+        {
+            a[i] = (f64)(i % 1000) * 0.5;
+            b[i] = (f64)(n - i) * 0.25;
+        }
+
+        i32 repeats = (i32)(256ll * 1024 * 1024 / ((i64)n * sizeof(f64)));
+        for (i32 level = SIMD_LEVEL_SCALAR; level <= detected; level++)
+        {
+            bench_level((SimdLevel)level, a, b, out, n, repeats);
+        }
+
+        free(a);
+        free(b);
+        free(out);
+    }
+    return 0;
+}
@@ -0,0 +1,528 @@
+#if defined(__unix__) || defined(__APPLE__)
+#define CACHE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Caches are keyed by a fixed seed, so they stay valid under RANDOM_HASH_SEED
+u64 hash_source(const char* source, size_t length)
+{
+    return hash_bytes(source, length, 0);
+}
+
+static u32 cache_flags()
+{
+#ifdef NAN_BOXING
+    return CACHE_FLAG_NAN_BOXING;
+#else
+    return 0;
+#endif
+}
+
+// "script.lox" caches to "script.loxc", any other name gets ".loxc" appended
+void cache_path_for(const char* script_path, char* buffer, size_t buffer_size)
+{
+    size_t length = strlen(script_path);
+    if (length >= 4 && strcmp(script_path + length - 4, ".lox") == 0)
+    {
+        snprintf(buffer, buffer_size, "%sc", script_path);
+    }
+    else
+    {
+        snprintf(buffer, buffer_size, "%s.loxc", script_path);
+    }
+}
+
+static u64 image_align(u64 offset)
+{
+    return (offset + IMAGE_ALIGNMENT - 1) & ~(u64)(IMAGE_ALIGNMENT - 1);
+}
+
+static void collect_string(GarbageCollector* gc, CacheWriter* writer, ObjString* string)
+{
+    Value index;
+    if (table_get(&writer->string_indices, string, &index)) return;
+
+    if (writer->string_count == writer->string_capacity)
+    {
+        writer->string_capacity = GROW_CAPACITY(writer->string_capacity);
+        writer->strings = (ObjString**)realloc(writer->strings, sizeof(ObjString*) * writer->string_capacity);
+        if (writer->strings == NULL) exit(1);
+    }
+
+    table_set(gc, &writer->string_indices, string, int_val(writer->string_count));
+    writer->strings[writer->string_count++] = string;
+    writer->char_count += string->length;
+}
+
+// Numbers the functions and strings of the tree and sizes its tables
+static void collect_function(GarbageCollector* gc, CacheWriter* writer, ObjFunction* function)
+{
+    if (writer->function_count == writer->function_capacity)
+    {
+        writer->function_capacity = GROW_CAPACITY(writer->function_capacity);
+        writer->functions = (ObjFunction**)realloc(writer->functions, sizeof(ObjFunction*) * writer->function_capacity);
+        if (writer->functions == NULL) exit(1);
+    }
+
+    // Uncompiled bodies only exist as source
+    if (function->lazy_source) writer->failed = true;
+
+    map_set(gc, &writer->function_indices, OBJ_VAL(function), int_val(writer->function_count));
+    writer->functions[writer->function_count++] = function;
+
+    if (function->name) collect_string(gc, writer, function->name);
+    writer->code_count += function->chunk.count;
+    writer->line_count += function->chunk.line_count;
+    writer->constant_count += function->chunk.constants.count;
+
+    ValueArray* constants = &function->chunk.constants;
+    for (i32 i = 0; i < constants->count; i++)
+    {
+        Value constant = constants->values[i];
+        if (is_obj_type(constant, OBJ_STRING))
+        {
+            collect_string(gc, writer, AS_STRING(constant));
+        }
+        else if (IS_FUNCTION(constant))
+        {
+            collect_function(gc, writer, AS_FUNCTION(constant));
+        }
+    }
+}
+
+static u32 writer_function_index(CacheWriter* writer, ObjFunction* function)
+{
+    Value index = nil_val();
+    map_get(&writer->function_indices, OBJ_VAL(function), &index);
+    return (u32)AS_NUMBER(index);
+}
+
+static u32 writer_string_index(CacheWriter* writer, ObjString* string)
+{
+    Value index = nil_val();
+    table_get(&writer->string_indices, string, &index);
+    return (u32)AS_NUMBER(index);
+}
+
+static b32 write_constant(CacheWriter* writer, Value value, ImageConstant* constant)
+{
+    if (IS_INT(value))
+    {
+        constant->kind = CACHE_CONSTANT_INT;
+        constant->payload = (u32)AS_INT(value);
+    }
+    else if (IS_NUMBER(value))
+    {
+        f64 number = AS_NUMBER(value);
+        constant->kind = CACHE_CONSTANT_NUMBER;
+        memcpy(&constant->payload, &number, sizeof(number));
+    }
+    else if (IS_SMALL_STRING(value))
+    {
+        char buffer[SMALL_STRING_MAX + 1];
+        i32 length;
+        string_chars(value, buffer, &length);
+        constant->kind = CACHE_CONSTANT_SMALL_STRING;
+        constant->length = (u32)length;
+        memcpy(&constant->payload, buffer, length);
+    }
+    else if (is_obj_type(value, OBJ_STRING))
+    {
+        constant->kind = CACHE_CONSTANT_STRING;
+        constant->payload = writer_string_index(writer, AS_STRING(value));
+    }
+    else if (IS_FUNCTION(value))
+    {
+        constant->kind = CACHE_CONSTANT_FUNCTION;
+        constant->payload = writer_function_index(writer, AS_FUNCTION(value));
+    }
+    else if (IS_NIL(value))
+    {
+        constant->kind = CACHE_CONSTANT_NIL;
+    }
+    else if (IS_BOOL(value))
+    {
+        constant->kind = CACHE_CONSTANT_BOOL;
+        constant->payload = AS_BOOL(value) ? 1 : 0;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// Lays the image out as header, function table, string table, constants, line
+// tables, string chars and code, then writes it under a temporary name and
+// renames it over path. Processes that still have the old image mapped keep it.
+// The function must be reachable from the VM while this runs.
+b32 save_bytecode_cache(GarbageCollector* gc, ObjFunction* function, const char* path, const char* source)
+{
+    CacheWriter writer = {};
+    init_map(&writer.function_indices);
+    init_table(&writer.string_indices);
+    collect_function(gc, &writer, function);
+
+    u64 functions_offset = image_align(sizeof(ImageHeader));
+    u64 strings_offset   = image_align(functions_offset + sizeof(ImageFunction) * writer.function_count);
+    u64 constants_offset = image_align(strings_offset + sizeof(ImageString) * writer.string_count);
+    u64 lines_offset     = image_align(constants_offset + sizeof(ImageConstant) * writer.constant_count);
+    u64 chars_offset     = image_align(lines_offset + sizeof(LineRun) * writer.line_count);
+    u64 code_offset      = image_align(chars_offset + writer.char_count);
+    u64 image_length     = code_offset + writer.code_count;
+
+    u8* image = (u8*)calloc(1, image_length);
+    if (image == NULL) exit(1);
+
+    ImageString* strings = (ImageString*)(image + strings_offset);
+    for (i32 i = 0; i < writer.string_count; i++)
+    {
+        ObjString* string = writer.strings[i];
+        strings[i].offset = chars_offset;
+        strings[i].length = (u32)string->length;
+        memcpy(image + chars_offset, string->chars, string->length);
+        chars_offset += string->length;
+    }
+
+    ImageFunction* functions = (ImageFunction*)(image + functions_offset);
+    for (i32 i = 0; i < writer.function_count && !writer.failed; i++)
+    {
+        ObjFunction* source_function = writer.functions[i];
+        Chunk* chunk = &source_function->chunk;
+
+        ImageFunction* record = &functions[i];
+        record->arity            = source_function->arity;
+        record->upvalue_count    = source_function->upvalue_count;
+        record->slot_count       = source_function->slot_count;
+        record->name             = source_function->name ? writer_string_index(&writer, source_function->name) : UINT32_MAX;
+        record->code_count       = (u32)chunk->count;
+        record->constant_count   = (u32)chunk->constants.count;
+        record->line_count       = (u32)chunk->line_count;
+        record->code_offset      = code_offset;
+        record->lines_offset     = lines_offset;
+        record->constants_offset = constants_offset;
+
+        memcpy(image + code_offset, chunk->code, chunk->count);
+        memcpy(image + lines_offset, chunk->lines, sizeof(LineRun) * chunk->line_count);
+        code_offset  += chunk->count;
+        lines_offset += sizeof(LineRun) * chunk->line_count;
+
+        ImageConstant* constants = (ImageConstant*)(image + constants_offset);
+        for (i32 c = 0; c < chunk->constants.count; c++)
+        {
+            if (!write_constant(&writer, chunk->constants.values[c], &constants[c]))
+            {
+                writer.failed = true;
+                break;
+            }
+        }
+        constants_offset += sizeof(ImageConstant) * chunk->constants.count;
+    }
+
+    ImageHeader* header = (ImageHeader*)image;
+    header->magic            = CACHE_MAGIC;
+    header->version          = CACHE_VERSION;
+    header->flags            = cache_flags();
+    header->function_count   = (u32)writer.function_count;
+    header->string_count     = (u32)writer.string_count;
+    header->source_length    = strlen(source);
+    header->source_hash      = hash_source(source, header->source_length);
+    header->body_hash        = hash_bytes(image + sizeof(ImageHeader), image_length - sizeof(ImageHeader), 0);
+    header->image_length     = image_length;
+    header->functions_offset = functions_offset;
+    header->strings_offset   = strings_offset;
+
+    b32 saved = false;
+    if (!writer.failed)
+    {
+        char temp_path[1024];
+#ifdef CACHE_MMAP
+        snprintf(temp_path, sizeof(temp_path), "%s.%d", path, (i32)getpid());
+#else
+        snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+#endif
+        FILE* file = fopen(temp_path, "wb");
+        if (file)
+        {
+            saved = fwrite(image, 1, image_length, file) == image_length;
+            saved = fclose(file) == 0 && saved;
+#ifndef CACHE_MMAP
+            if (saved) remove(path);
+#endif
+            saved = saved && rename(temp_path, path) == 0;
+            if (!saved) remove(temp_path);
+        }
+    }
+
+    free(image);
+    free(writer.functions);
+    free(writer.strings);
+    free_map(gc, &writer.function_indices);
+    free_table(gc, &writer.string_indices);
+    return saved;
+}
+
+static b32 map_image(const char* path, BytecodeImage* image)
+{
+#ifdef CACHE_MMAP
+    i32 fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(ImageHeader))
+    {
+        close(fd);
+        return false;
+    }
+
+    void* base = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return false;
+
+    image->base   = (const u8*)base;
+    image->size   = (size_t)info.st_size;
+    image->mapped = true;
+    return true;
+#else
+    FILE* file = fopen(path, "rb");
+    if (!file) return false;
+
+    fseek(file, 0L, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    if (size < (long)sizeof(ImageHeader))
+    {
+        fclose(file);
+        return false;
+    }
+
+    u8* base = (u8*)malloc((size_t)size);
+    if (base == NULL) exit(1);
+
+    b32 read = fread(base, 1, (size_t)size, file) == (size_t)size;
+    fclose(file);
+    if (!read)
+    {
+        free(base);
+        return false;
+    }
+
+    image->base   = base;
+    image->size   = (size_t)size;
+    image->mapped = false;
+    return true;
+#endif
+}
+
+static void unmap_image(BytecodeImage* image)
+{
+#ifdef CACHE_MMAP
+    if (image->mapped)
+    {
+        munmap((void*)image->base, image->size);
+        return;
+    }
+#endif
+    free((void*)image->base);
+}
+
+static b32 image_range(const BytecodeImage* image, u64 offset, u64 size, u64 alignment)
+{
+    return offset <= image->size && size <= image->size - offset && offset % alignment == 0;
+}
+
+// Checks the header, the body hash and that every table lies inside the image.
+// Hashing reads the whole image once, which is what lets the VM trust the code
+// and constants it later runs in place.
+static b32 validate_image(const BytecodeImage* image, const char* source)
+{
+    const ImageHeader* header = (const ImageHeader*)image->base;
+    size_t source_length = strlen(source);
+    if (header->magic != CACHE_MAGIC ||
+        header->version != CACHE_VERSION ||
+        header->flags != cache_flags() ||
+        header->image_length != image->size ||
+        header->function_count == 0 ||
+        header->source_length != source_length ||
+        header->source_hash != hash_source(source, source_length) ||
+        header->body_hash != hash_bytes(image->base + sizeof(ImageHeader), image->size - sizeof(ImageHeader), 0))
+    {
+        return false;
+    }
+
+    if (!image_range(image, header->functions_offset, sizeof(ImageFunction) * (u64)header->function_count, IMAGE_ALIGNMENT) ||
+        !image_range(image, header->strings_offset, sizeof(ImageString) * (u64)header->string_count, IMAGE_ALIGNMENT))
+    {
+        return false;
+    }
+
+    const ImageFunction* functions = (const ImageFunction*)(image->base + header->functions_offset);
+    for (u32 i = 0; i < header->function_count; i++)
+    {
+        const ImageFunction* function = &functions[i];
+        if (!image_range(image, function->code_offset, function->code_count, 1) ||
+            !image_range(image, function->lines_offset, sizeof(LineRun) * (u64)function->line_count, sizeof(i32)) ||
+            !image_range(image, function->constants_offset, sizeof(ImageConstant) * (u64)function->constant_count, IMAGE_ALIGNMENT) ||
+            (function->name != UINT32_MAX && function->name >= header->string_count))
+        {
+            return false;
+        }
+    }
+
+    const ImageString* strings = (const ImageString*)(image->base + header->strings_offset);
+    for (u32 i = 0; i < header->string_count; i++)
+    {
+        if (!image_range(image, strings[i].offset, strings[i].length, 1)) return false;
+    }
+    return true;
+}
+
+static ObjString* image_string(GarbageCollector* gc, BytecodeImage* image, u64 index, ObjectStore* store, Table* strings)
+{
+    const ImageHeader* header = (const ImageHeader*)image->base;
+    if (index >= header->string_count) return NULL;
+
+    const ImageString* string = &((const ImageString*)(image->base + header->strings_offset))[index];
+    return copy_string(gc, store, strings, (const char*)image->base + string->offset, (i32)string->length);
+}
+
+// Makes a function whose code and lines point into the image. Its constants
+// are only built by load_image_constants, on the first call.
+static ObjFunction* image_function(GarbageCollector* gc, BytecodeImage* image, u32 index, ObjectStore* store, Table* strings)
+{
+    const ImageHeader* header = (const ImageHeader*)image->base;
+    const ImageFunction* record = &((const ImageFunction*)(image->base + header->functions_offset))[index];
+
+    ObjFunction* function = new_function(gc, store);
+    push(gc->vm, OBJ_VAL(function));
+
+    function->arity         = record->arity;
+    function->upvalue_count = record->upvalue_count;
+    function->slot_count    = record->slot_count;
+    if (record->name != UINT32_MAX)
+    {
+        function->name = image_string(gc, image, record->name, store, strings);
+    }
+
+    function->chunk.code       = (u8*)(image->base + record->code_offset);
+    function->chunk.lines      = (LineRun*)(image->base + record->lines_offset);
+    function->chunk.line_count = (i32)record->line_count;
+    function->chunk.count      = (i32)record->code_count;
+    function->chunk.mapped     = true;
+    function->image            = image;
+    function->image_index      = index;
+
+    pop(gc->vm);
+    return function;
+}
+
+// Interns the strings and creates the nested functions the function refers
+// to. Constants the image does not describe properly become nil.
+void load_image_constants(GarbageCollector* gc, ObjFunction* function, ObjectStore* store, Table* strings)
+{
+    BytecodeImage* image = function->image;
+    function->image = NULL;
+
+    const ImageHeader* header = (const ImageHeader*)image->base;
+    const ImageFunction* record = &((const ImageFunction*)(image->base + header->functions_offset))[function->image_index];
+    const ImageConstant* constants = (const ImageConstant*)(image->base + record->constants_offset);
+
+    ValueArray* array = &function->chunk.constants;
+    array->values   = ALLOCATE(gc, Value, record->constant_count);
+    array->capacity = (i32)record->constant_count;
+
+    for (u32 i = 0; i < record->constant_count; i++)
+    {
+        const ImageConstant* constant = &constants[i];
+        Value value = nil_val();
+        switch (constant->kind)
+        {
+            case CACHE_CONSTANT_NUMBER:
+            {
+                f64 number;
+                memcpy(&number, &constant->payload, sizeof(number));
+                value = number_val(number);
+            }
+            break;
+            case CACHE_CONSTANT_INT:
+            {
+                value = int_val((i32)(u32)constant->payload);
+            }
+            break;
+            case CACHE_CONSTANT_STRING:
+            {
+                ObjString* string = image_string(gc, image, constant->payload, store, strings);
+                if (string) value = OBJ_VAL(string);
+            }
+            break;
+            case CACHE_CONSTANT_SMALL_STRING:
+            {
+                if (constant->length <= SMALL_STRING_MAX)
+                {
+                    value = string_val(gc, store, strings, (const char*)&constant->payload, (i32)constant->length);
+                }
+            }
+            break;
+            case CACHE_CONSTANT_FUNCTION:
+            {
+                if (constant->payload < header->function_count)
+                {
+                    value = OBJ_VAL(image_function(gc, image, (u32)constant->payload, store, strings));
+                }
+            }
+            break;
+            case CACHE_CONSTANT_NIL:
+            break;
+            case CACHE_CONSTANT_BOOL:
+            {
+                value = bool_val(constant->payload != 0);
+            }
+            break;
+        }
+
+        // Nothing allocates between making the value and storing it
+        array->values[array->count++] = value;
+    }
+}
+
+// Returns NULL unless path holds an image of exactly this source, written by a
+// build with the same bytecode version and value representation.
+ObjFunction* load_bytecode_cache(GarbageCollector* gc, const char* path, const char* source, ObjectStore* output_store, Table* output_strings)
+{
+    BytecodeImage* image = (BytecodeImage*)malloc(sizeof(BytecodeImage));
+    if (image == NULL) exit(1);
+
+    if (!map_image(path, image))
+    {
+        free(image);
+        return NULL;
+    }
+
+    if (!validate_image(image, source))
+    {
+        unmap_image(image);
+        free(image);
+        return NULL;
+    }
+
+    image->next = gc->vm->images;
+    gc->vm->images = image;
+    return image_function(gc, image, 0, output_store, output_strings);
+}
+
+// Only call once no function from the images is left
+void free_bytecode_images(BytecodeImage** images)
+{
+    BytecodeImage* image = *images;
+    while (image != NULL)
+    {
+        BytecodeImage* next = image->next;
+        unmap_image(image);
+        free(image);
+        image = next;
+    }
+    *images = NULL;
+}
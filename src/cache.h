@@ -0,0 +1,137 @@
+#ifndef CLOX_CACHE_H
+#define CLOX_CACHE_H
+
+// =================================================================
+// API
+// =================================================================
+
+// "LOXC" read as a little endian u32, so a cache from a machine with the other byte order is rejected
+#define CACHE_MAGIC 0x43584f4c
+
+// Bump whenever the bytecode or the file layout changes
+#define CACHE_VERSION 12
+
+#define CACHE_FLAG_NAN_BOXING 1
+
+// Every table in an image starts on this boundary
+#define IMAGE_ALIGNMENT 8
+
+// =================================================================
+// Types
+// =================================================================
+
+enum CacheConstant
+{
+    CACHE_CONSTANT_NUMBER,       // payload is the f64 bits
+    CACHE_CONSTANT_INT,          // payload is the i32
+    CACHE_CONSTANT_STRING,       // payload is an index into the string table
+    CACHE_CONSTANT_SMALL_STRING, // payload is up to SMALL_STRING_MAX chars, only with NAN_BOXING
+    CACHE_CONSTANT_FUNCTION,     // payload is an index into the function table
+    CACHE_CONSTANT_NIL,          // no payload, for nil switch labels
+    CACHE_CONSTANT_BOOL          // payload is 0 or 1
+};
+
+// A .loxc file is a bytecode image that is mapped read-only and used in place.
+// Chunk code and line tables point straight into it, so processes running the
+// same script share those pages. It holds no pointers, only offsets from the
+// start of the image and indices into its tables. Function 0 is the script.
+struct ImageHeader
+{
+    u32 magic;
+    u32 version;
+    u32 flags;
+    u32 function_count;
+    u32 string_count;
+    u32 reserved;
+    u64 source_length;
+    u64 source_hash;
+    u64 body_hash; // of everything after the header, so a damaged or truncated image is rejected
+    u64 image_length;
+    u64 functions_offset; // ImageFunction[function_count]
+    u64 strings_offset;   // ImageString[string_count]
+};
+
+struct ImageFunction
+{
+    i32 arity;
+    i32 upvalue_count;
+    u32 name; // UINT32_MAX for the script
+    u32 code_count;
+    u32 constant_count;
+    i32 slot_count;
+    u32 line_count;
+    u32 reserved;
+    u64 code_offset;
+    u64 lines_offset;     // LineRun[line_count]
+    u64 constants_offset; // ImageConstant[constant_count]
+};
+
+struct ImageString
+{
+    u64 offset;
+    u32 length;
+    u32 reserved;
+};
+
+struct ImageConstant
+{
+    u32 kind;
+    u32 length; // chars in the payload of a small string
+    u64 payload;
+};
+
+// An image in use by the VM. It stays mapped until free_vm, since the functions
+// loaded from it keep pointing into it.
+struct BytecodeImage
+{
+    const u8* base;
+    size_t size;
+    b32 mapped; // false when the platform has no mmap and the file was read into memory
+    BytecodeImage* next;
+};
+
+struct CacheWriter
+{
+    // Every function in the tree in depth first order, the script first
+    ObjFunction** functions;
+    i32 function_count;
+    i32 function_capacity;
+    Map function_indices;
+
+    ObjString** strings;
+    i32 string_count;
+    i32 string_capacity;
+    Table string_indices;
+
+    i64 constant_count;
+    i64 code_count;
+    i64 line_count;
+    i64 char_count;
+    b32 failed;
+};
+// =================================================================
+
+// =================================================================
+// API Functions
+// =================================================================
+u64          hash_source(const char* source, size_t length);
+b32          save_bytecode_cache(GarbageCollector* gc, ObjFunction* function, const char* path, const char* source);
+ObjFunction* load_bytecode_cache(GarbageCollector* gc, const char* path, const char* source, ObjectStore* output_store, Table* output_strings);
+void         load_image_constants(GarbageCollector* gc, ObjFunction* function, ObjectStore* store, Table* strings);
+void         free_bytecode_images(BytecodeImage** images);
+void         cache_path_for(const char* script_path, char* buffer, size_t buffer_size);
+// =================================================================
+
+// =================================================================
+// Internal Functions
+// =================================================================
+static void collect_function(GarbageCollector* gc, CacheWriter* writer, ObjFunction* function);
+static u64  image_align(u64 offset);
+static b32  map_image(const char* path, BytecodeImage* image);
+static void unmap_image(BytecodeImage* image);
+static b32  validate_image(const BytecodeImage* image, const char* source);
+static ObjFunction* image_function(GarbageCollector* gc, BytecodeImage* image, u32 index, ObjectStore* store, Table* strings);
+static ObjString*   image_string(GarbageCollector* gc, BytecodeImage* image, u64 index, ObjectStore* store, Table* strings);
+// =================================================================
+
+#endif
@@ -4,13 +4,19 @@ void init_chunk(Chunk* chunk)
     chunk->capacity = 0;
     chunk->code = NULL;
     chunk->lines = NULL;
+    chunk->line_count = 0;
+    chunk->line_capacity = 0;
+    chunk->mapped = false;
     init_value_array(&chunk->constants);
 }
 
 void free_chunk(GarbageCollector* gc, Chunk* chunk)
 {
-    FREE_ARRAY(gc, u8, chunk->code, chunk->capacity);
-    FREE_ARRAY(gc, i32, chunk->lines, chunk->capacity);
+    if (!chunk->mapped)
+    {
+        FREE_ARRAY(gc, u8, chunk->code, chunk->capacity);
+        FREE_ARRAY(gc, LineRun, chunk->lines, chunk->line_capacity);
+    }
     free_value_array(gc, &chunk->constants);
     init_chunk(chunk);
 }
@@ -22,34 +28,171 @@ void write_chunk(GarbageCollector* gc, Chunk* chunk, u8 byte, i32 line)
         i32 old_capacity = chunk->capacity;
         chunk->capacity = GROW_CAPACITY(old_capacity);
         chunk->code = GROW_ARRAY(gc, u8, chunk->code, old_capacity, chunk->capacity);
-        chunk->lines = GROW_ARRAY(gc, i32, chunk->lines, old_capacity, chunk->capacity);
     }
     chunk->code[chunk->count] = byte;
-    chunk->lines[chunk->count] = line;
+
+    // Consecutive bytes on the same line share a run
+    if (chunk->line_count == 0 || chunk->lines[chunk->line_count - 1].line != line)
+    {
+        if (chunk->line_capacity < chunk->line_count + 1)
+        {
+            i32 old_capacity = chunk->line_capacity;
+            chunk->line_capacity = GROW_CAPACITY(old_capacity);
+            chunk->lines = GROW_ARRAY(gc, LineRun, chunk->lines, old_capacity, chunk->line_capacity);
+        }
+        chunk->lines[chunk->line_count++] = {chunk->count, line};
+    }
     chunk->count++;
 }
 
+// Drops the code from count on, with the runs of lines that only covered it
+void truncate_chunk(Chunk* chunk, i32 count)
+{
+    chunk->count = count;
+    while (chunk->line_count > 0 && chunk->lines[chunk->line_count - 1].start >= count)
+    {
+        chunk->line_count--;
+    }
+}
+
+// Gives back the room write_chunk and add_constant left for growth, once nothing more is written
+void shrink_chunk(GarbageCollector* gc, Chunk* chunk)
+{
+    if (chunk->mapped) return;
+
+    chunk->code = GROW_ARRAY(gc, u8, chunk->code, chunk->capacity, chunk->count);
+    chunk->capacity = chunk->count;
+    chunk->lines = GROW_ARRAY(gc, LineRun, chunk->lines, chunk->line_capacity, chunk->line_count);
+    chunk->line_capacity = chunk->line_count;
+
+    ValueArray* constants = &chunk->constants;
+    constants->values = GROW_ARRAY(gc, Value, constants->values, constants->capacity, constants->count);
+    constants->capacity = constants->count;
+}
+
+// The line of the byte at offset, from the last run starting at or before it
+i32 get_line(Chunk* chunk, i32 offset)
+{
+    i32 low = 0;
+    i32 high = chunk->line_count - 1;
+    if (high < 0) return 0;
+
+    while (low < high)
+    {
+        i32 middle = low + (high - low + 1) / 2;
+        if (chunk->lines[middle].start <= offset) low = middle;
+        else                                      high = middle - 1;
+    }
+    return chunk->lines[low].line;
+}
+
 i32 add_constant(GarbageCollector* gc, Chunk* chunk, Value value)
 {
-    push(gc->vm, value);
+    if (gc->vm != NULL) push(gc->vm, value);
     write_value_array(gc, &chunk->constants, value);
-    pop(gc->vm);
+    if (gc->vm != NULL) pop(gc->vm);
     return chunk->constants.count - 1;
 }
 
-void write_constant(GarbageCollector* gc, Chunk* chunk, Value value, i32 line)
+// Bytes of the OP_WIDE or OP_WIDE_LONG prefix at offset, or 0 for any other
+// instruction. high gets the bits the prefix adds above the low index byte.
+i32 wide_prefix(Chunk* chunk, i32 offset, u32* high)
 {
-    i32 constant = add_constant(gc, chunk, value);
-    if(constant >= 1 << 8)
+    *high = 0;
+    switch (chunk->code[offset])
     {
-        write_chunk(gc, chunk, OP_CONSTANT_LONG, line);
-        write_chunk(gc, chunk, (u8)(constant & 0x000000ff), line);
-        write_chunk(gc, chunk, (u8)((constant & 0x0000ff00) >> 8), line);
-        write_chunk(gc, chunk, (u8)((constant & 0x00ff0000) >> 16), line);
+        case OP_WIDE:
+        {
+            if (offset + 2 >= chunk->count) return 0;
+            *high = (u32)chunk->code[offset + 1] << 8;
+            return 2;
+        }
+        case OP_WIDE_LONG:
+        {
+            if (offset + 3 >= chunk->count) return 0;
+            *high = (u32)chunk->code[offset + 1] << 16 | (u32)chunk->code[offset + 2] << 8;
+            return 3;
+        }
+        default: return 0;
     }
-    else
+}
+
+// Bytes of the instruction at offset, operands and any wide prefix included
+i32 instruction_length(Chunk* chunk, i32 offset)
+{
+    u32 high = 0;
+    i32 prefix = wide_prefix(chunk, offset, &high);
+    offset += prefix;
+
+    switch (chunk->code[offset])
     {
-        write_chunk(gc, chunk, OP_CONSTANT, line);
-        write_chunk(gc, chunk, (u8)constant, line);
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_GET_PROPERTY_INSTANCE:
+        case OP_SET_PROPERTY_INSTANCE:
+        case OP_GET_SUPER:
+        case OP_ARRAY:
+        case OP_MAP:
+        case OP_ARRAY_EXTEND:
+        case OP_MAP_EXTEND:
+        case OP_CALL:
+        case OP_CLASS:
+        case OP_METHOD:
+        case OP_INLINED_RETURN: return prefix + 2;
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_INVOKE:
+        case OP_SUPER_INVOKE: return prefix + 3;
+        case OP_GUARD_CALLEE: return 5;
+        case OP_FOR_ITER: return prefix + 6;
+        case OP_SWITCH_TABLE:
+        {
+            if (offset + SWITCH_TABLE_HEADER > chunk->count) return SWITCH_TABLE_HEADER;
+            return SWITCH_TABLE_HEADER + 2 * (u16)(chunk->code[offset + 5] << 8 | chunk->code[offset + 6]);
+        }
+        case OP_SWITCH_HASH:
+        {
+            if (offset + SWITCH_HASH_HEADER > chunk->count) return SWITCH_HASH_HEADER;
+            return SWITCH_HASH_HEADER + SWITCH_HASH_ENTRY * (u16)(chunk->code[offset + 2] << 8 | chunk->code[offset + 3]);
+        }
+        case OP_CLOSURE:
+        {
+            // Each upvalue is a flags byte, is_local in bit 0 and the bytes of
+            // the index past the first above it, then the index high byte first
+            if (offset + 1 >= chunk->count) return prefix + 2;
+            ObjFunction* function = AS_FUNCTION(chunk->constants.values[high | chunk->code[offset + 1]]);
+            i32 length = 2;
+            for (i32 i = 0; i < function->upvalue_count && offset + length < chunk->count; i++)
+            {
+                length += 2 + (chunk->code[offset + length] >> 1);
+            }
+            return prefix + length;
+        }
+        default: return 1;
     }
 }
+
+// Whether value is a whole number that fits an i32, the labels and subjects OP_SWITCH_TABLE indexes with
+b32 switch_key(Value value, i32* key)
+{
+    if (IS_INT(value))
+    {
+        *key = AS_INT(value);
+        return true;
+    }
+
+    if (!IS_NUMBER(value)) return false;
+    f64 number = AS_NUMBER(value);
+    if (!(number >= INT32_MIN && number <= INT32_MAX) || number != (f64)(i32)number) return false;
+    *key = (i32)number;
+    return true;
+}
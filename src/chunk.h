@@ -8,10 +8,14 @@
 // =================================================================
 // Types
 // =================================================================
+#define SWITCH_TABLE_HEADER 9
+#define SWITCH_HASH_HEADER  6
+#define SWITCH_HASH_ENTRY   5
+
+// Changing the opcodes or their operands invalidates cached bytecode, bump CACHE_VERSION with them
 enum OpCode
 {
     OP_CONSTANT,
-    OP_CONSTANT_LONG,
     OP_NIL,
     OP_FALSE,
     OP_TRUE,
@@ -26,6 +30,14 @@ enum OpCode
     OP_GET_PROPERTY,
     OP_SET_PROPERTY,
     OP_GET_SUPER,
+    OP_ARRAY,
+    OP_MAP,
+    // Add count:1 more elements, or key value pairs, to the array or map below them.
+    // Literals longer than 255 are built this way, a chunk at a time.
+    OP_ARRAY_EXTEND,
+    OP_MAP_EXTEND,
+    OP_INDEX_GET,
+    OP_INDEX_SET,
     OP_EQUAL,
     OP_GREATER,
     OP_LESS,
@@ -35,11 +47,18 @@ enum OpCode
     OP_DIVIDE,
     OP_NOT,
     OP_NEGATE,
+    OP_BIT_AND,
+    OP_BIT_OR,
+    OP_BIT_XOR,
+    OP_BIT_NOT,
+    OP_SHIFT_LEFT,
+    OP_SHIFT_RIGHT,
     OP_PRINT,
     OP_JUMP,
     OP_JUMP_IF_FALSE,
     OP_COMPARE,
     OP_LOOP,
+    OP_FOR_ITER,
     OP_CALL,
     OP_INVOKE,
     OP_SUPER_INVOKE,
@@ -48,7 +67,46 @@ enum OpCode
     OP_RETURN,
     OP_CLASS,
     OP_INHERIT,
-    OP_METHOD
+    OP_METHOD,
+
+    // Switches on constant case labels, see switch_statement. The operands are
+    //   OP_SWITCH_TABLE min:4 count:2 default:2, then count targets:2 for the labels min to min + count - 1
+    //   OP_SWITCH_HASH  table:1 count:2 default:2, then count times label constant:3 target:2
+    // Both pop the subject. Targets count back from the end of the instruction, so 0 leaves the switch.
+    OP_SWITCH_TABLE,
+    OP_SWITCH_HASH,
+
+    // Arithmetic and comparisons on operands the optimizer knows are numbers, see optimizer.cpp
+    OP_ADD_NUMBER,
+    OP_SUBTRACT_NUMBER,
+    OP_MULTIPLY_NUMBER,
+    OP_DIVIDE_NUMBER,
+    OP_LESS_NUMBER,
+    OP_GREATER_NUMBER,
+    OP_NEGATE_NUMBER,
+
+    // Concatenation of known strings and property access on known instances, see specialize_types
+    OP_ADD_STRING,
+    OP_GET_PROPERTY_INSTANCE,
+    OP_SET_PROPERTY_INSTANCE,
+
+    // Calls the optimizer inlined, see inline_call
+    OP_GUARD_CALLEE,
+    OP_INLINED_RETURN,
+
+    // Prefixes that widen the index operand of the next instruction, a constant,
+    // local, upvalue or global slot. That instruction keeps the low byte itself:
+    //   OP_WIDE hi:1 op lo:1 ...         for indices below 2^16
+    //   OP_WIDE_LONG hi:2 op lo:1 ...    for indices below 2^24
+    OP_WIDE,
+    OP_WIDE_LONG
+};
+
+// The bytes of code from start up to the start of the next run are on line
+struct LineRun
+{
+    i32 start;
+    i32 line;
 };
 
 struct Chunk
@@ -56,8 +114,13 @@ struct Chunk
     u8* code;
     i32 count;
     i32 capacity;
-    i32* lines;
+    LineRun* lines;
+    i32 line_count;
+    i32 line_capacity;
     ValueArray constants;
+
+    // Code and lines point into a mapped bytecode image and are not ours to free
+    b32 mapped;
 };
 // =================================================================
 
@@ -67,8 +130,13 @@ struct Chunk
 void init_chunk(Chunk* chunk);
 void free_chunk(GarbageCollector* gc, Chunk* chunk);
 void write_chunk(GarbageCollector* gc, Chunk* chunk, u8 byte, i32 line);
+void truncate_chunk(Chunk* chunk, i32 count);
+void shrink_chunk(GarbageCollector* gc, Chunk* chunk);
+i32 get_line(Chunk* chunk, i32 offset);
 i32 add_constant(GarbageCollector* gc, Chunk* chunk, Value value);
-void write_constant(Chunk* chunk, Value value, i32 line);
+i32 wide_prefix(Chunk* chunk, i32 offset, u32* high);
+i32 instruction_length(Chunk* chunk, i32 offset);
+b32 switch_key(Value value, i32* key);
 // =================================================================
 
 #endif
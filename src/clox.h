@@ -3,30 +3,42 @@
 
 #include "common.h"
 
+#include "hash.h"
+#include "numeric.h"
 #include "value.h"
 #include "memory.h"
 #include "table.h"
+#include "map.h"
 #include "chunk.h"
 #include "object.h"
 #include "debug.h"
 #include "scanner.h"
 #include "compiler.h"
+#include "cache.h"
+#include "optimizer.h"
 #include "vm.h"
+#include "module.h"
 
 void repl(VM* vm);
 char* read_file(const char* path);
 void run_file(VM* vm, const char* path);
 
 #ifdef CLOX_IMPLEMENTATION
+#include "hash.cpp"
+#include "numeric.cpp"
 #include "memory.cpp"
 #include "value.cpp"
 #include "object.cpp"
 #include "table.cpp"
+#include "map.cpp"
 #include "chunk.cpp"
 #include "debug.cpp"
 #include "scanner.cpp"
 #include "compiler.cpp"
+#include "cache.cpp"
+#include "optimizer.cpp"
 #include "vm.cpp"
+#include "module.cpp"
 
 void repl(VM* vm)
 {
@@ -40,7 +52,7 @@ void repl(VM* vm)
             printf("\n");
             break;
         }
-        interpret(vm, line);
+        interpret(vm, line, NULL, false);
     }
 }
 
@@ -81,7 +93,15 @@ char* read_file(const char* path)
 void run_file(VM* vm, const char* path)
 {
     char* source = read_file(path);
-    InterpretResult result = interpret(vm, source);
+#if defined(LAZY_COMPILE)
+    InterpretResult result = interpret(vm, source, path, true);
+#elif defined(BYTECODE_CACHE)
+    char cache_path[1024];
+    cache_path_for(path, cache_path, sizeof(cache_path));
+    InterpretResult result = interpret_cached(vm, source, path, cache_path);
+#else
+    InterpretResult result = interpret(vm, source, path, false);
+#endif
     free(source);
 
     if(result == INTERPRET_COMPILE_ERROR) exit(65);
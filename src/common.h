@@ -10,6 +10,8 @@
 #include <string.h>
 #include <stdarg.h>
 #include <time.h>
+#include <atomic>
+#include <thread>
 
 using i8  = int8_t;
 using i16 = int16_t;
@@ -26,8 +28,16 @@ using f64 = double;
 
 using b32 = i32; //@Note: Much more practical for struct packing
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
 #define NAN_BOXING
 
+// Use the SwissTable layout for Table: 7-bit hash tags in a control byte array, probed 16 at a time
+//#define TABLE_SWISS
+
 #define QNAN ((u64)0x7ffc000000000000)
 #define SIGN_BIT ((uint64_t)0x8000000000000000)
 
@@ -35,11 +45,36 @@ using b32 = i32; //@Note: Much more practical for struct packing
 #define TAG_FALSE 2
 #define TAG_TRUE  3
 
+// @Note: Small strings live in the non-object NaN space, flagged by the
+// highest free payload bit. The low 48 bits hold up to 6 NUL-padded chars.
+#define TAG_SMALL_STRING ((u64)0x0002000000000000)
+
+// Integers use the next payload bit and keep an i32 in the low 32 bits
+#define TAG_INT ((u64)0x0001000000000000)
+
+// Keep the compiled bytecode of a script next to it as a .loxc file and reuse it while the source is unchanged
+#define BYTECODE_CACHE
+
+// Compile top level functions and methods on their first call instead of up front. Errors in
+// their bodies are then only reported on that call. Takes the place of BYTECODE_CACHE.
+//#define LAZY_COMPILE
+
+// Recompile a function from an SSA form of its bytecode once it has been called OPTIMIZE_THRESHOLD times
+#define OPTIMIZE_HOT_FUNCTIONS
+
+// Replace arithmetic, concatenation and property access whose operand types are known at compile time with unchecked instructions
+#define SPECIALIZE_TYPES
+
+// Seed string hashing per process so untrusted input can't be crafted to collide
+/* #define RANDOM_HASH_SEED */
+
 /* #define DEBUG_PRINT_CODE */
 /* #define DEBUG_TRACE_EXECUTION */
 
 //#define DEBUG_STRESS_GC
 #define DEBUG_LOG_GC
+// Print the probe length histogram of the intern table after every collection
+//#define DEBUG_TABLE_STATS
 
 #define UINT8_COUNT (UINT8_MAX + 1)
 
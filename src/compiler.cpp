@@ -1,9 +1,6 @@
-Compiler* current = NULL;
-ClassCompiler* current_class = NULL;
-
-Chunk* current_chunk()
+static Chunk* current_chunk(Parser* parser)
 {
-    return &current->function->chunk;
+    return &parser->compiler->function->chunk;
 }
 
 static void error_at(Parser* parser, Token* token, const char* message)
@@ -43,7 +40,7 @@ static void advance(Parser* parser)
 
     for (;;)
     {
-        parser->current = scan_token();
+        parser->current = scan_token(&parser->scanner);
         if (parser->current.type != TOKEN_ERROR) break;
 
         error_at_current(parser, parser->current.start);
@@ -74,7 +71,7 @@ static b32 match(Parser* parser, TokenType type)
 
 static void emit_byte(GarbageCollector* gc, Parser* parser, u8 byte)
 {
-    write_chunk(gc, current_chunk(), byte, parser->previous.line);
+    write_chunk(gc, current_chunk(parser), byte, parser->previous.line);
 }
 
 static void emit_bytes(GarbageCollector* gc, Parser* parser, u8 byte_1, u8 byte_2)
@@ -87,7 +84,7 @@ static void emit_loop(GarbageCollector* gc, Parser* parser, i32 loop_start)
 {
     emit_byte(gc, parser, OP_LOOP);
 
-    i32 offset = current_chunk()->count - loop_start + 2;
+    i32 offset = current_chunk(parser)->count - loop_start + 2;
     if (offset > UINT16_MAX) error(parser, "Loop body too large.");
 
     emit_byte(gc, parser, (offset >> 8) & 0xff);
@@ -99,12 +96,12 @@ static i32 emit_jump(GarbageCollector* gc, Parser* parser, u8 instruction)
     emit_byte(gc, parser, instruction);
     emit_byte(gc, parser, 0xff);
     emit_byte(gc, parser, 0xff);
-    return current_chunk()->count - 2;
+    return current_chunk(parser)->count - 2;
 }
 
 static void emit_return(GarbageCollector* gc, Parser* parser)
 {
-    if (current->type == TYPE_INITIALIZER)
+    if (parser->compiler->type == TYPE_INITIALIZER)
     {
         emit_bytes(gc, parser, OP_GET_LOCAL, 0);
     }
@@ -116,51 +113,145 @@ static void emit_return(GarbageCollector* gc, Parser* parser)
     emit_byte(gc, parser, OP_RETURN);
 }
 
-static u8 make_constant(GarbageCollector* gc, Parser* parser, Value value)
+// Emits op with an index operand, behind an OP_WIDE or OP_WIDE_LONG prefix when
+// it does not fit the byte that follows op
+static void emit_indexed(GarbageCollector* gc, Parser* parser, u8 op, i32 index)
 {
-    i32 constant = add_constant(gc, current_chunk(), value);
-    if (constant > UINT8_MAX)
+    if (index > UINT16_MAX)
+    {
+        emit_byte(gc, parser, OP_WIDE_LONG);
+        emit_bytes(gc, parser, (index >> 16) & 0xff, (index >> 8) & 0xff);
+    }
+    else if (index > UINT8_MAX)
+    {
+        emit_bytes(gc, parser, OP_WIDE, (index >> 8) & 0xff);
+    }
+    emit_bytes(gc, parser, op, index & 0xff);
+}
+
+static i32 make_constant(GarbageCollector* gc, Parser* parser, Value value)
+{
+    i32 constant = add_constant(gc, current_chunk(parser), value);
+    if (constant >= CONSTANTS_MAX)
     {
         error(parser, "Too many constants in one chunk");
         return 0;
     }
-    return (u8)constant;
+    return constant;
 }
 
 static void emit_constant(GarbageCollector* gc, Parser* parser, Value value)
 {
-    emit_bytes(gc, parser, OP_CONSTANT, make_constant(gc, parser, value));
+    emit_indexed(gc, parser, OP_CONSTANT, make_constant(gc, parser, value));
+}
+
+// Pushes value with the shortest instruction and remembers it for folding
+static void emit_value(GarbageCollector* gc, Parser* parser, Value value)
+{
+    i32 start = current_chunk(parser)->count;
+    if (IS_BOOL(value))
+    {
+        emit_byte(gc, parser, AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+    }
+    else if (IS_NIL(value))
+    {
+        emit_byte(gc, parser, OP_NIL);
+    }
+    else
+    {
+        emit_constant(gc, parser, value);
+    }
+
+    Compiler* compiler = parser->compiler;
+    if (compiler->pushed_count == PUSHED_CONSTANTS_MAX)
+    {
+        memmove(compiler->pushed, compiler->pushed + 1, sizeof(PushedConstant) * (PUSHED_CONSTANTS_MAX - 1));
+        compiler->pushed_count--;
+    }
+    compiler->pushed[compiler->pushed_count++] = {start, current_chunk(parser)->count, value};
+}
+
+// Whether the last count instructions push known values, which go in values in order
+static b32 trailing_constants(Parser* parser, i32 count, Value* values)
+{
+    Compiler* compiler = parser->compiler;
+    if (compiler->pushed_count < count) return false;
+
+    PushedConstant* first = &compiler->pushed[compiler->pushed_count - count];
+    i32 end = current_chunk(parser)->count;
+    for (i32 i = count - 1; i >= 0; i--)
+    {
+        if (first[i].end != end) return false;
+        end = first[i].start;
+        values[i] = first[i].value;
+    }
+    return compiler->last_jump_target <= first[0].start;
+}
+
+// Removes the instructions trailing_constants found, and their constants when they end the pool
+static void drop_constants(Parser* parser, i32 count)
+{
+    Chunk* chunk = current_chunk(parser);
+    Compiler* compiler = parser->compiler;
+    for (i32 i = 0; i < count; i++)
+    {
+        PushedConstant* pushed = &compiler->pushed[--compiler->pushed_count];
+        u32 high = 0;
+        i32 op = pushed->start + wide_prefix(chunk, pushed->start, &high);
+        if (chunk->code[op] == OP_CONSTANT && (i32)(high | chunk->code[op + 1]) == chunk->constants.count - 1)
+        {
+            chunk->constants.count--;
+        }
+        truncate_chunk(chunk, pushed->start);
+    }
 }
 
 static void patch_jump(Parser* parser, i32 offset)
 {
-    i32 jump = current_chunk()->count - offset - 2;
+    i32 jump = current_chunk(parser)->count - offset - 2;
+    parser->compiler->last_jump_target = current_chunk(parser)->count;
 
     if (jump > UINT16_MAX)
     {
         error(parser, "Too much code to jump over.");
     }
 
-    current_chunk()->code[offset] = (jump >> 8) & 0xff;
-    current_chunk()->code[offset + 1] = jump & 0xff;
+    current_chunk(parser)->code[offset] = (jump >> 8) & 0xff;
+    current_chunk(parser)->code[offset + 1] = jump & 0xff;
 }
 
-static void init_compiler(Compiler* compiler, GarbageCollector* gc, Parser* parser, FunctionType type)
+// Grows the locals of compiler by one, the caller fills it in
+static Local* push_local(Compiler* compiler)
 {
-    compiler->enclosing = current;
-    compiler->function = NULL;
+    if (compiler->local_count == compiler->local_capacity)
+    {
+        compiler->local_capacity = GROW_CAPACITY(compiler->local_capacity);
+        compiler->locals = (Local*)realloc(compiler->locals, sizeof(Local) * compiler->local_capacity);
+        if (compiler->locals == NULL) exit(1);
+    }
+
+    Local* local = &compiler->locals[compiler->local_count++];
+    if (compiler->local_count > compiler->function->slot_count) compiler->function->slot_count = compiler->local_count;
+    return local;
+}
+
+static void free_compiler(Compiler* compiler)
+{
+    free(compiler->locals);
+    free(compiler->consts);
+    free(compiler->upvalues);
+}
+
+static void init_compiler_function(Parser* parser, Compiler* compiler, ObjFunction* function, FunctionType type)
+{
+    compiler->enclosing = parser->compiler;
+    compiler->function = function;
     compiler->type = type;
     compiler->local_count = 0;
     compiler->scope_depth = 0;
-    compiler->function = new_function(gc, parser->store);
-    current = compiler;
-    
-    if (type != TYPE_SCRIPT)
-    {
-        current->function->name = copy_string(gc, parser->store, parser->strings, parser->previous.start, parser->previous.length);
-    }
+    parser->compiler = compiler;
 
-    Local* local = &current->locals[current->local_count++];
+    Local* local = push_local(compiler);
     local->depth       = 0;
     local->is_captured = false;
 
@@ -176,34 +267,60 @@ static void init_compiler(Compiler* compiler, GarbageCollector* gc, Parser* pars
     }           
 }
 
+static void init_compiler(Compiler* compiler, GarbageCollector* gc, Parser* parser, FunctionType type)
+{
+    compiler->function = NULL;
+    ObjFunction* function = new_function(gc, parser->store);
+    init_compiler_function(parser, compiler, function, type);
+    
+    if (type != TYPE_SCRIPT)
+    {
+        function->name = copy_string(gc, parser->store, parser->strings, parser->previous.start, parser->previous.length);
+    }
+}
+
 static ObjFunction* end_compiler(GarbageCollector* gc, Parser* parser)
 {
-    ObjFunction* function = current->function;
+    ObjFunction* function = parser->compiler->function;
 #ifdef DEBUG_PRINT_CODE
     if (!parser->had_error)
     {
-        disassemble_chunk(current_chunk(), function->name != NULL ? function->name->chars : "<script>");
+        disassemble_chunk(current_chunk(parser), function->name != NULL ? function->name->chars : "<script>");
     }
 #endif
     emit_return(gc, parser);
-    current = current->enclosing;
+#ifdef SPECIALIZE_TYPES
+    if (!parser->had_error)
+    {
+        FunctionType type = parser->compiler->type;
+        specialize_types(gc, function, type == TYPE_METHOD || type == TYPE_INITIALIZER);
+    }
+#endif
+    shrink_chunk(gc, &function->chunk);
+    parser->compiler = parser->compiler->enclosing;
 
     return function;
 }
 
-static void begin_scope()
+static void begin_scope(Parser* parser)
 {
-    current->scope_depth++;
+    parser->compiler->scope_depth++;
 }
 
 static void end_scope(GarbageCollector* gc, Parser* parser)
 {
-    current->scope_depth--;
+    parser->compiler->scope_depth--;
+
+    while (parser->compiler->const_count > 0 &&
+           parser->compiler->consts[parser->compiler->const_count - 1].depth > parser->compiler->scope_depth)
+    {
+        parser->compiler->const_count--;
+    }
 
-    while (current->local_count > 0 &&
-           current->locals[current->local_count - 1].depth > current->scope_depth)
+    while (parser->compiler->local_count > 0 &&
+           parser->compiler->locals[parser->compiler->local_count - 1].depth > parser->compiler->scope_depth)
     {        
-        if(current->locals[current->local_count - 1].is_captured)
+        if(parser->compiler->locals[parser->compiler->local_count - 1].is_captured)
         {
             emit_byte(gc, parser, OP_CLOSE_UPVALUE);
         }
@@ -212,17 +329,137 @@ static void end_scope(GarbageCollector* gc, Parser* parser)
             emit_byte(gc, parser, OP_POP);
         }
         
-        current->local_count--;
+        parser->compiler->local_count--;
     }
 }
 
+// Mirrors what the VM would do with the operands, but gives up where it would raise an error
+static b32 fold_unary(TokenType operator_type, Value operand, Value* result)
+{
+    i32 integer;
+    switch (operator_type)
+    {
+    case TOKEN_BANG:
+        *result = bool_val(is_falsey(operand));
+        return true;
+    case TOKEN_MINUS:
+        if (IS_INT(operand) && AS_INT(operand) != 0 && AS_INT(operand) != INT32_MIN)
+        {
+            *result = int_val(-AS_INT(operand));
+            return true;
+        }
+        if (!IS_NUMBER(operand)) return false;
+        *result = number_val(-AS_NUMBER(operand));
+        return true;
+    case TOKEN_TILDE:
+        if (!constant_integer(operand, &integer)) return false;
+        *result = int_val(~integer);
+        return true;
+    default:
+        return false;
+    }
+}
+
+// The same conversion as integer_operand in the VM
+static b32 constant_integer(Value value, i32* result)
+{
+    if (IS_INT(value))
+    {
+        *result = AS_INT(value);
+        return true;
+    }
+
+    if (!IS_NUMBER(value)) return false;
+    f64 number = AS_NUMBER(value);
+    if (number != floor(number) || number - number != 0) return false;
+    *result = (i32)(u32)(i64)fmod(number, 4294967296.0);
+    return true;
+}
+
+static b32 fold_binary(GarbageCollector* gc, Parser* parser, TokenType operator_type, Value a, Value b, Value* result)
+{
+    if (operator_type == TOKEN_EQUAL_EQUAL)
+    {
+        *result = bool_val(values_equal(a, b));
+        return true;
+    }
+
+    if (operator_type == TOKEN_PLUS && IS_STRING(a) && IS_STRING(b))
+    {
+        char a_buffer[SMALL_STRING_MAX + 1];
+        char b_buffer[SMALL_STRING_MAX + 1];
+        i32 a_length, b_length;
+        const char* a_chars = string_chars(a, a_buffer, &a_length);
+        const char* b_chars = string_chars(b, b_buffer, &b_length);
+
+        i32 length = a_length + b_length;
+        char* chars = ALLOCATE(gc, char, length + 1);
+        memcpy(chars, a_chars, a_length);
+        memcpy(chars + a_length, b_chars, b_length);
+        chars[length] = '\0';
+        *result = string_val(gc, parser->store, parser->strings, chars, length);
+        FREE_ARRAY(gc, char, chars, length + 1);
+        return true;
+    }
+
+    i32 x, y;
+    switch (operator_type)
+    {
+    case TOKEN_AMPERSAND:
+    case TOKEN_PIPE:
+    case TOKEN_CARET:
+    case TOKEN_LESS_LESS:
+    case TOKEN_GREATER_GREATER:
+        if (!constant_integer(a, &x) || !constant_integer(b, &y)) return false;
+        break;
+    default:
+        if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+    }
+
+    b32 ints = IS_INT(a) && IS_INT(b);
+    i64 i = ints ? AS_INT(a) : 0;
+    i64 j = ints ? AS_INT(b) : 0;
+    switch (operator_type)
+    {
+    case TOKEN_GREATER:         *result = bool_val(AS_NUMBER(a) > AS_NUMBER(b)); break;
+    case TOKEN_GREATER_EQUAL:   *result = bool_val(!(AS_NUMBER(a) < AS_NUMBER(b))); break;
+    case TOKEN_LESS:            *result = bool_val(AS_NUMBER(a) < AS_NUMBER(b)); break;
+    case TOKEN_LESS_EQUAL:      *result = bool_val(!(AS_NUMBER(a) > AS_NUMBER(b))); break;
+    case TOKEN_PLUS:            *result = ints ? narrow_number((f64)(i + j)) : number_val(AS_NUMBER(a) + AS_NUMBER(b)); break;
+    case TOKEN_MINUS:           *result = ints ? narrow_number((f64)(i - j)) : number_val(AS_NUMBER(a) - AS_NUMBER(b)); break;
+    case TOKEN_STAR:            *result = ints ? narrow_number((f64)i * (f64)j) : number_val(AS_NUMBER(a) * AS_NUMBER(b)); break;
+    case TOKEN_SLASH:
+        if (ints && j != 0 && i % j == 0 && i / j == (i32)(i / j) && !(i == 0 && j < 0)) *result = int_val((i32)(i / j));
+        else *result = number_val(AS_NUMBER(a) / AS_NUMBER(b));
+        break;
+    case TOKEN_AMPERSAND:       *result = int_val(x & y); break;
+    case TOKEN_PIPE:            *result = int_val(x | y); break;
+    case TOKEN_CARET:           *result = int_val(x ^ y); break;
+    case TOKEN_LESS_LESS:       *result = int_val((i32)((u32)x << (y & 31))); break;
+    case TOKEN_GREATER_GREATER: *result = int_val(x >> (y & 31)); break;
+    default:
+        return false;
+    }
+    return true;
+}
+
 static void binary(GarbageCollector* gc, Parser* parser, b32 can_assign)
 {
     TokenType operator_type = parser->previous.type;
 
-    ParseRule* rule = get_rule(operator_type);
+    const ParseRule* rule = get_rule(operator_type);
     parse_precedence(gc, parser, (Precedence)(rule->precedence + 1));
 
+    Value operands[2];
+    Value result;
+    if (trailing_constants(parser, 2, operands) &&
+        fold_binary(gc, parser, operator_type, operands[0], operands[1], &result))
+    {
+        drop_constants(parser, 2);
+        emit_value(gc, parser, result);
+        return;
+    }
+
     switch(operator_type)
     {
         case TOKEN_BANG_EQUAL:        emit_bytes(gc, parser, OP_EQUAL, OP_NOT); break;
@@ -235,6 +472,11 @@ static void binary(GarbageCollector* gc, Parser* parser, b32 can_assign)
         case TOKEN_MINUS:             emit_byte(gc, parser, OP_SUBTRACT); break;
         case TOKEN_STAR:              emit_byte(gc, parser, OP_MULTIPLY); break;
         case TOKEN_SLASH:             emit_byte(gc, parser, OP_DIVIDE); break;
+        case TOKEN_AMPERSAND:         emit_byte(gc, parser, OP_BIT_AND); break;
+        case TOKEN_PIPE:              emit_byte(gc, parser, OP_BIT_OR); break;
+        case TOKEN_CARET:             emit_byte(gc, parser, OP_BIT_XOR); break;
+        case TOKEN_LESS_LESS:         emit_byte(gc, parser, OP_SHIFT_LEFT); break;
+        case TOKEN_GREATER_GREATER:   emit_byte(gc, parser, OP_SHIFT_RIGHT); break;
         default:
         return;
     }
@@ -268,22 +510,90 @@ static void call(GarbageCollector* gc, Parser* parser, b32 can_assign)
 static void dot(GarbageCollector* gc, Parser* parser, b32 can_assign)
 {
     consume(parser, TOKEN_IDENTIFIER, "Expect property name after '.'.");
-    u8 name = identifier_constant(gc, parser, &parser->previous);
+    i32 name = identifier_constant(gc, parser, &parser->previous);
 
     if (can_assign && match(parser, TOKEN_EQUAL))
     {
         expression(gc, parser);
-        emit_bytes(gc, parser, OP_SET_PROPERTY, name);
+        emit_indexed(gc, parser, OP_SET_PROPERTY, name);
     }
     else if (match(parser, TOKEN_LEFT_PAREN))
     {
         u8 arg_count = argument_list(gc, parser);
-        emit_bytes(gc, parser, OP_INVOKE, name);
+        emit_indexed(gc, parser, OP_INVOKE, name);
         emit_byte(gc, parser, arg_count);
     }
     else
     {
-        emit_bytes(gc, parser, OP_GET_PROPERTY, name);
+        emit_indexed(gc, parser, OP_GET_PROPERTY, name);
+    }
+}
+
+// Long literals are built UINT8_MAX elements at a time with OP_ARRAY_EXTEND,
+// so they never hold more of the stack than a short one
+static void array(GarbageCollector* gc, Parser* parser, b32 can_assign)
+{
+    i32 element_count = 0;
+    b32 created = false;
+    if (!check(parser, TOKEN_RIGHT_BRACKET))
+    {
+        do
+        {
+            if (check(parser, TOKEN_RIGHT_BRACKET)) break; // Trailing comma
+            expression(gc, parser);
+            if (++element_count == UINT8_MAX)
+            {
+                emit_bytes(gc, parser, created ? OP_ARRAY_EXTEND : OP_ARRAY, UINT8_MAX);
+                created = true;
+                element_count = 0;
+            }
+        } while (match(parser, TOKEN_COMMA));
+    }
+    consume(parser, TOKEN_RIGHT_BRACKET, "Expect ']' after array elements.");
+    if (!created) emit_bytes(gc, parser, OP_ARRAY, element_count);
+    else if (element_count > 0) emit_bytes(gc, parser, OP_ARRAY_EXTEND, element_count);
+}
+
+// {key: value, ...}. Only reachable in expression position, a statement starting with '{' is a block.
+// Built in chunks with OP_MAP_EXTEND like array literals
+static void map(GarbageCollector* gc, Parser* parser, b32 can_assign)
+{
+    i32 entry_count = 0;
+    b32 created = false;
+    if (!check(parser, TOKEN_RIGHT_BRACE))
+    {
+        do
+        {
+            if (check(parser, TOKEN_RIGHT_BRACE)) break; // Trailing comma
+            expression(gc, parser);
+            consume(parser, TOKEN_COLON, "Expect ':' after map key.");
+            expression(gc, parser);
+            if (++entry_count == UINT8_MAX / 2)
+            {
+                emit_bytes(gc, parser, created ? OP_MAP_EXTEND : OP_MAP, UINT8_MAX / 2);
+                created = true;
+                entry_count = 0;
+            }
+        } while (match(parser, TOKEN_COMMA));
+    }
+    consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after map entries.");
+    if (!created) emit_bytes(gc, parser, OP_MAP, entry_count);
+    else if (entry_count > 0) emit_bytes(gc, parser, OP_MAP_EXTEND, entry_count);
+}
+
+static void subscript(GarbageCollector* gc, Parser* parser, b32 can_assign)
+{
+    expression(gc, parser);
+    consume(parser, TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
+
+    if (can_assign && match(parser, TOKEN_EQUAL))
+    {
+        expression(gc, parser);
+        emit_byte(gc, parser, OP_INDEX_SET);
+    }
+    else
+    {
+        emit_byte(gc, parser, OP_INDEX_GET);
     }
 }
 
@@ -291,9 +601,9 @@ static void literal(GarbageCollector* gc, Parser* parser, b32 can_assign)
 {
     switch(parser->previous.type)
     {
-    case TOKEN_FALSE: emit_byte(gc, parser, OP_FALSE); break;
-    case TOKEN_NIL: emit_byte(gc, parser, OP_NIL); break;
-    case TOKEN_TRUE: emit_byte(gc, parser, OP_TRUE); break;
+    case TOKEN_FALSE: emit_value(gc, parser, bool_val(false)); break;
+    case TOKEN_NIL: emit_value(gc, parser, nil_val()); break;
+    case TOKEN_TRUE: emit_value(gc, parser, bool_val(true)); break;
     default:
     return;
     }
@@ -308,7 +618,9 @@ static void grouping(GarbageCollector* gc, Parser* parser, b32 can_assign)
 static void number(GarbageCollector* gc, Parser* parser, b32 can_assign)
 {
     f64 value = strtod(parser->previous.start, NULL);
-    emit_constant(gc, parser, number_val(value));
+    // Literals without a fraction are ints when they fit, so "1.0" stays a double
+    b32 has_fraction = memchr(parser->previous.start, '.', parser->previous.length) != NULL;
+    emit_value(gc, parser, has_fraction ? number_val(value) : narrow_number(value));
 }
 
 static void or_(GarbageCollector* gc, Parser* parser, b32 can_assign)
@@ -325,28 +637,35 @@ static void or_(GarbageCollector* gc, Parser* parser, b32 can_assign)
 
 static void string(GarbageCollector* gc, Parser* parser, b32 can_assign)
 {
-    emit_constant(gc, parser, OBJ_VAL(copy_string(gc, parser->store, parser->strings, parser->previous.start + 1,
-                                              parser->previous.length - 2)));
+    emit_value(gc, parser, string_val(gc, parser->store, parser->strings, parser->previous.start + 1,
+                                         parser->previous.length - 2));
 }
 
 static void named_variable(GarbageCollector* gc, Parser* parser, Token name, b32 can_assign)
 {
     u8 get_op, set_op;
     b32 immutable = false;
-    i32 arg = resolve_local(parser, current, &name, &immutable);
+    Value value;
+    if (resolve_constant(parser, &name, &value))
+    {
+        emit_value(gc, parser, value);
+        return;
+    }
+
+    i32 arg = resolve_local(parser, parser->compiler, &name, &immutable);
     if (arg != -1)
     {
         get_op = OP_GET_LOCAL;
         set_op = OP_SET_LOCAL;
     }
-    else if ((arg = resolve_upvalue(parser, current, &name, &immutable)) != -1)
+    else if ((arg = resolve_upvalue(parser, parser->compiler, &name, &immutable)) != -1)
     {
         get_op = OP_GET_UPVALUE;
         set_op = OP_SET_UPVALUE;
     }
     else
     {
-        Global* global = get_global(parser, current, &name);
+        Global* global = get_global(parser, parser->compiler, &name);
         if (global)
         {
             immutable = global->immutable;
@@ -359,11 +678,11 @@ static void named_variable(GarbageCollector* gc, Parser* parser, Token name, b32
     if (can_assign && !immutable && match(parser, TOKEN_EQUAL))
     {
         expression(gc, parser);
-        emit_bytes(gc, parser, set_op, (u8)arg);
+        emit_indexed(gc, parser, set_op, arg);
     }
     else
     {
-        emit_bytes(gc, parser, get_op, (u8)arg);
+        emit_indexed(gc, parser, get_op, arg);
     }
 }
 
@@ -382,18 +701,18 @@ static Token synthetic_token(const char* text)
 
 static void super_(GarbageCollector* gc, Parser* parser, b32 can_assign)
 {
-    if (!current_class)
+    if (!parser->class_compiler)
     {
         error(parser, "Can't use 'super' outside of a class.");
     }
-    else if (!current_class->has_superclass)
+    else if (!parser->class_compiler->has_superclass)
     {
         error(parser, "Can't use 'super' in a class with no superclass.");
     }
     
     consume(parser, TOKEN_DOT, "Expect '.' after 'super'.");
     consume(parser, TOKEN_IDENTIFIER, "Expect superclass method name.");
-    u8 name = identifier_constant(gc, parser, &parser->previous);
+    i32 name = identifier_constant(gc, parser, &parser->previous);
 
     named_variable(gc, parser, synthetic_token("this"), false);
 
@@ -402,20 +721,20 @@ static void super_(GarbageCollector* gc, Parser* parser, b32 can_assign)
     {
         u8 arg_count = argument_list(gc, parser);
         named_variable(gc, parser, synthetic_token("super"), false);
-        emit_bytes(gc, parser, OP_SUPER_INVOKE, name);
+        emit_indexed(gc, parser, OP_SUPER_INVOKE, name);
         emit_byte(gc, parser, arg_count);
     }
     else
     {
         named_variable(gc, parser, synthetic_token("super"), false);
-        emit_bytes(gc, parser, OP_GET_SUPER, name);
+        emit_indexed(gc, parser, OP_GET_SUPER, name);
     }
     
 }
 
 static void this_(GarbageCollector* gc, Parser* parser, b32 can_assign)
 {
-    if (current_class != NULL)
+    if (parser->class_compiler == NULL)
     {
         error(parser, "Can't use 'this' outside of a class.");
         return;
@@ -429,10 +748,20 @@ static void unary(GarbageCollector* gc, Parser* parser, b32 can_assign)
 
     parse_precedence(gc, parser, PREC_UNARY);
 
+    Value operand;
+    Value result;
+    if (trailing_constants(parser, 1, &operand) && fold_unary(operator_type, operand, &result))
+    {
+        drop_constants(parser, 1);
+        emit_value(gc, parser, result);
+        return;
+    }
+
     switch(operator_type)
     {
     case TOKEN_BANG: emit_byte(gc, parser, OP_NOT); break;
     case TOKEN_MINUS: emit_byte(gc, parser, OP_NEGATE); break;
+    case TOKEN_TILDE: emit_byte(gc, parser, OP_BIT_NOT); break;
     default:
     return;
     }
@@ -464,7 +793,7 @@ static void parse_precedence(GarbageCollector* gc, Parser* parser, Precedence pr
     }
 }
 
-static u8 identifier_constant(GarbageCollector* gc, Parser* parser, Token* name)
+static i32 identifier_constant(GarbageCollector* gc, Parser* parser, Token* name)
 {
     return make_constant(gc, parser, OBJ_VAL(copy_string(gc, parser->store, parser->strings, name->start,
                                                      name->length)));
@@ -478,16 +807,50 @@ static b32 identifiers_equal(Token* a, Token* b)
 
 static Global* get_global(Parser* parser, Compiler* compiler, Token* name)
 {
-    for (i32 i = global_count - 1; i >= 0; i--)
+    i32 index = find_global(parser->globals, name->start, name->length, hash_string(name->start, name->length));
+    return index == -1 ? NULL : &parser->globals->globals[index];
+}
+
+// Whether name is a const whose value is known, looking outwards through the
+// enclosing functions the same way locals and upvalues resolve, then the globals
+static b32 resolve_constant(Parser* parser, Token* name, Value* value)
+{
+    for (Compiler* compiler = parser->compiler; compiler != NULL; compiler = compiler->enclosing)
     {
-        Global* global = &globals[i];
-        if (strncmp(name->start, global->name->chars, global->name->length) == 0)
+        i32 local = -1;
+        for (i32 i = compiler->local_count - 1; i >= 0; i--)
         {
-            return global;
+            if (identifiers_equal(name, &compiler->locals[i].name))
+            {
+                local = i;
+                break;
+            }
         }
+
+        for (i32 i = compiler->const_count - 1; i >= 0; i--)
+        {
+            ConstLocal* constant = &compiler->consts[i];
+            if (identifiers_equal(name, &constant->name))
+            {
+                if (local >= constant->locals_below) return false;
+
+                *value = constant->value;
+                return true;
+            }
+        }
+
+        if (local != -1) return false;
     }
 
-    return NULL;
+    // A deferred body reads globals through OP_GET_GLOBAL, so a const used before
+    // its declaration runs is still undefined, as it is when compiled eagerly
+    if (parser->deferred) return false;
+
+    Global* global = get_global(parser, parser->compiler, name);
+    if (global == NULL || !global->has_value) return false;
+
+    *value = global->value;
+    return true;
 }
 
 static i32 resolve_local(Parser* parser, Compiler* compiler, Token* name, b32* immutable)
@@ -508,7 +871,7 @@ static i32 resolve_local(Parser* parser, Compiler* compiler, Token* name, b32* i
     return -1;
 }
 
-static i32 add_upvalue(Parser* parser, Compiler* compiler, u8 index, b32 is_local)
+static i32 add_upvalue(Parser* parser, Compiler* compiler, i32 index, b32 is_local)
 {
     i32 upvalue_count = compiler->function->upvalue_count;    
     for(i32 i = 0; i < upvalue_count; i++)
@@ -520,11 +883,18 @@ static i32 add_upvalue(Parser* parser, Compiler* compiler, u8 index, b32 is_loca
         }
     }
 
-    if(upvalue_count == UINT8_COUNT)
+    if(upvalue_count == UPVALUES_MAX)
     {
         error(parser, "Too many closure variables in function.");
         return 0;
     }
+
+    if (upvalue_count == compiler->upvalue_capacity)
+    {
+        compiler->upvalue_capacity = GROW_CAPACITY(compiler->upvalue_capacity);
+        compiler->upvalues = (Upvalue*)realloc(compiler->upvalues, sizeof(Upvalue) * compiler->upvalue_capacity);
+        if (compiler->upvalues == NULL) exit(1);
+    }
     
     compiler->upvalues[upvalue_count].is_local = is_local;
     compiler->upvalues[upvalue_count].index    = index;
@@ -539,13 +909,13 @@ static i32 resolve_upvalue(Parser* parser, Compiler* compiler, Token* name, b32*
     if(local != -1)
     {
         compiler->enclosing->locals[local].is_captured = true;
-        return add_upvalue(parser, compiler, (u8)local, true);
+        return add_upvalue(parser, compiler, local, true);
     }
 
     i32 upvalue = resolve_upvalue(parser, compiler->enclosing, name, immutable);
     if(upvalue != -1)
     {
-        return add_upvalue(parser, compiler, (u8)upvalue, false);
+        return add_upvalue(parser, compiler, upvalue, false);
     }
     
     return -1;
@@ -553,13 +923,13 @@ static i32 resolve_upvalue(Parser* parser, Compiler* compiler, Token* name, b32*
 
 static void add_local(Parser* parser, Token name, b32 immutable)
 {
-    if (current->local_count == UINT8_COUNT)
+    if (parser->compiler->local_count == LOCALS_MAX)
     {
         error(parser, "Too many local variables in function.");
         return;
     }
     
-    Local* local = &current->locals[current->local_count++];
+    Local* local = push_local(parser->compiler);
     local->name        = name;
     local->depth       = -1;
     local->is_captured = false;
@@ -568,38 +938,30 @@ static void add_local(Parser* parser, Token name, b32 immutable)
 
 static void add_global(GarbageCollector* gc, Parser* parser, Token name, b32 immutable)
 {
-    if (global_count == UINT8_COUNT)
-    {
-        error(parser, "Too many global variables defined.");
-        return;
-    }
-
-    Global* global = &globals[global_count++];
-    global->name = copy_string(gc, parser->store, parser->strings, name.start, name.length);
+    // The collector walks the scope, so the entry only goes in once its name exists
+    ObjString* string = copy_string(gc, parser->store, parser->strings, name.start, name.length);
+    Global* global = push_global(parser->globals, string);
     global->immutable = immutable;
+    global->has_value = false;
 }
 
 static void declare_variable(GarbageCollector* gc, Parser* parser, b32 immutable)
 {
     Token* name = &parser->previous;
-    if (current->scope_depth == 0)
+    if (parser->compiler->scope_depth == 0)
     {
-        for (i32 i = global_count - 1; i >= 0; i--)
+        if (get_global(parser, parser->compiler, name) != NULL)
         {
-            Global* global = &globals[i];
-            if (strncmp(name->start, global->name->chars, global->name->length) == 0)
-            {
-                error(parser, "Already global with this name.");
-            }
+            error(parser, "Already global with this name.");
         }
         add_global(gc, parser, *name, immutable);
     }
     else
     {
-        for (i32 i = current->local_count - 1; i >= 0; i--)
+        for (i32 i = parser->compiler->local_count - 1; i >= 0; i--)
         {
-            Local* local = &current->locals[i];
-            if (local->depth != -1 && local->depth < current->scope_depth)
+            Local* local = &parser->compiler->locals[i];
+            if (local->depth != -1 && local->depth < parser->compiler->scope_depth)
             {
                 break;
             }
@@ -609,35 +971,46 @@ static void declare_variable(GarbageCollector* gc, Parser* parser, b32 immutable
                 error(parser, "Already variable with this name in this scope.");
             }
         }
+
+        for (i32 i = parser->compiler->const_count - 1; i >= 0; i--)
+        {
+            ConstLocal* constant = &parser->compiler->consts[i];
+            if (constant->depth < parser->compiler->scope_depth) break;
+
+            if (identifiers_equal(name, &constant->name))
+            {
+                error(parser, "Already variable with this name in this scope.");
+            }
+        }
         add_local(parser, *name, immutable);
     }
 }
 
-static u8 parse_variable(GarbageCollector* gc, Parser* parser, const char* error_message, b32 immutable)
+static i32 parse_variable(GarbageCollector* gc, Parser* parser, const char* error_message, b32 immutable)
 {
     consume(parser, TOKEN_IDENTIFIER, error_message);
 
     declare_variable(gc, parser, immutable);
-    if (current->scope_depth > 0) return 0;
+    if (parser->compiler->scope_depth > 0) return 0;
 
     return identifier_constant(gc, parser, &parser->previous);
 }
 
-static void mark_initialized()
+static void mark_initialized(Parser* parser)
 {
-    if (current->scope_depth == 0) return;
-    current->locals[current->local_count - 1].depth = current->scope_depth;
+    if (parser->compiler->scope_depth == 0) return;
+    parser->compiler->locals[parser->compiler->local_count - 1].depth = parser->compiler->scope_depth;
 }
 
-static void define_variable(GarbageCollector* gc, Parser* parser, u8 global)
+static void define_variable(GarbageCollector* gc, Parser* parser, i32 global)
 {
-    if (current->scope_depth > 0)
+    if (parser->compiler->scope_depth > 0)
     {
-        mark_initialized();
+        mark_initialized(parser);
         return;
     }
     
-    emit_bytes(gc, parser, OP_DEFINE_GLOBAL, global);
+    emit_indexed(gc, parser, OP_DEFINE_GLOBAL, global);
 }
 
 static void and_(GarbageCollector* gc, Parser* parser, b32 can_assign)
@@ -650,7 +1023,7 @@ static void and_(GarbageCollector* gc, Parser* parser, b32 can_assign)
     patch_jump(parser, end_jump);
 }
 
-static ParseRule* get_rule(TokenType type)
+static const ParseRule* get_rule(TokenType type)
 {
     return &rules[type];
 }
@@ -670,57 +1043,105 @@ static void block(GarbageCollector* gc, Parser* parser)
     consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after block.");
 }
 
-static void function(GarbageCollector* gc, Parser* parser, FunctionType type)
+static void parameters(GarbageCollector* gc, Parser* parser)
 {
-    Compiler compiler = {};
-    init_compiler(&compiler, gc, parser, type);
-    begin_scope();
-
     consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after function name.");
     if (!check(parser, TOKEN_RIGHT_PAREN))
     {
         do
         {
-            current->function->arity++;
-            if (current->function->arity > 255)
+            parser->compiler->function->arity++;
+            if (parser->compiler->function->arity > 255)
             {
                 error_at_current(parser, "Can't have more than 255 parameters.");
             }
 
-            u8 param_constant = parse_variable(gc, parser, "Expect parameter name.", true); // @Note: Check for default values?
+            i32 param_constant = parse_variable(gc, parser, "Expect parameter name.", true); // @Note: Check for default values?
             define_variable(gc, parser, param_constant);
         } while (match(parser, TOKEN_COMMA));
     }
     
     consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
-
     consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before function body.");
-    block(gc, parser);
+}
 
-    ObjFunction* function = end_compiler(gc, parser);
-    emit_bytes(gc, parser, OP_CLOSURE, make_constant(gc, parser, OBJ_VAL(function)));
+// Steps over a block whose '{' was just consumed, only matching up the braces
+static void skip_block(Parser* parser)
+{
+    i32 depth = 1;
+    for (;;)
+    {
+        if (check(parser, TOKEN_EOF))
+        {
+            error_at_current(parser, "Expect '}' after block.");
+            return;
+        }
+
+        if (check(parser, TOKEN_LEFT_BRACE)) depth++;
+        if (check(parser, TOKEN_RIGHT_BRACE) && --depth == 0) break;
+        advance(parser);
+    }
+    advance(parser);
+}
 
+static void function(GarbageCollector* gc, Parser* parser, FunctionType type)
+{
+    // Functions declared at the top of the script can only capture globals, so
+    // nothing about their body is needed until the first call
+    b32 lazy = parser->lazy && parser->compiler->type == TYPE_SCRIPT && parser->compiler->scope_depth == 0;
+
+    Compiler compiler = {};
+    init_compiler(&compiler, gc, parser, type);
+    begin_scope(parser);
+
+    const char* parameters_start = parser->current.start;
+    i32 parameters_line = parser->current.line;
+    parameters(gc, parser);
+
+    ObjFunction* function;
+    if (lazy)
+    {
+        skip_block(parser);
+        function = parser->compiler->function;
+        function->lazy_source = parameters_start;
+        function->lazy_line   = parameters_line;
+        function->lazy_type   = type;
+        parser->compiler = parser->compiler->enclosing;
+    }
+    else
+    {
+        block(gc, parser);
+        function = end_compiler(gc, parser);
+    }
+
+    emit_indexed(gc, parser, OP_CLOSURE, make_constant(gc, parser, OBJ_VAL(function)));
+
+    // A flags byte, is_local and how many index bytes follow past the first, then the index
     for(i32 i = 0; i < function->upvalue_count; i++)
     {
-        emit_byte(gc, parser, compiler.upvalues[i].is_local ? 1 : 0);
-        emit_byte(gc, parser, compiler.upvalues[i].index);
+        i32 index = compiler.upvalues[i].index;
+        i32 extra = index > UINT8_MAX ? 1 : 0;
+        emit_byte(gc, parser, (u8)(extra << 1 | (compiler.upvalues[i].is_local ? 1 : 0)));
+        if (extra) emit_byte(gc, parser, (index >> 8) & 0xff);
+        emit_byte(gc, parser, index & 0xff);
     }
+    free_compiler(&compiler);
 }
 
 static void class_declaration(GarbageCollector* gc, Parser* parser)
 {
     consume(parser, TOKEN_IDENTIFIER, "Expect class name.");
     Token class_name = parser->previous;
-    u8 name_constant = identifier_constant(gc, parser, &parser->previous);
+    i32 name_constant = identifier_constant(gc, parser, &parser->previous);
     declare_variable(gc, parser, true);
 
-    emit_bytes(gc, parser, OP_CLASS, name_constant);
+    emit_indexed(gc, parser, OP_CLASS, name_constant);
     define_variable(gc, parser, name_constant);
 
     ClassCompiler class_compiler = {};
-    class_compiler.enclosing = current_class;
+    class_compiler.enclosing = parser->class_compiler;
     class_compiler.has_superclass = false;
-    current_class = &class_compiler;
+    parser->class_compiler = &class_compiler;
 
     if (match(parser, TOKEN_LESS))
     {
@@ -732,7 +1153,7 @@ static void class_declaration(GarbageCollector* gc, Parser* parser)
             error(parser, "A class can't inherit from itself.");
         }
 
-        begin_scope();
+        begin_scope(parser);
         add_local(parser, synthetic_token("super"), true);
         define_variable(gc, parser, 0);
         
@@ -757,13 +1178,13 @@ static void class_declaration(GarbageCollector* gc, Parser* parser)
         end_scope(gc, parser);
     }
 
-    current_class = current_class->enclosing;
+    parser->class_compiler = parser->class_compiler->enclosing;
 }
 
 static void method(GarbageCollector* gc, Parser* parser)
 {
     consume(parser, TOKEN_IDENTIFIER, "Expect method name.");
-    u8 constant = identifier_constant(gc, parser, &parser->previous);
+    i32 constant = identifier_constant(gc, parser, &parser->previous);
 
     FunctionType type = TYPE_METHOD;
     if (parser->previous.length == 4 && memcmp(parser->previous.start, "init", 4) == 0)
@@ -773,13 +1194,13 @@ static void method(GarbageCollector* gc, Parser* parser)
     
     function(gc, parser, type);
     
-    emit_bytes(gc, parser, OP_METHOD, constant);
+    emit_indexed(gc, parser, OP_METHOD, constant);
 }
 
 static void fun_declaration(GarbageCollector* gc, Parser* parser)
 {
-    u8 global = parse_variable(gc, parser, "Expect function name.", true);
-    mark_initialized();
+    i32 global = parse_variable(gc, parser, "Expect function name.", true);
+    mark_initialized(parser);
     function(gc, parser, TYPE_FUNCTION);
     define_variable(gc, parser, global);
 }
@@ -791,28 +1212,90 @@ static void expression_statement(GarbageCollector* gc, Parser* parser)
     emit_byte(gc, parser, OP_POP);
 }
 
+// for (let x in iterable). The loop variable is followed by two hidden locals holding
+// the iterable and the cursor. OP_FOR_ITER steps arrays, maps, strings and ranges
+// itself and jumps straight to the body. For instances it falls through to a block
+// calling iterate(cursor) and iterator_value(cursor) on the iterable.
+static void for_in_statement(GarbageCollector* gc, Parser* parser)
+{
+    i32 variable_slot = parser->compiler->local_count - 1;
+    emit_byte(gc, parser, OP_NIL);
+    mark_initialized(parser);
+
+    expression(gc, parser);
+    add_local(parser, synthetic_token(" iterable"), true);
+    mark_initialized(parser);
+
+    emit_byte(gc, parser, OP_NIL);
+    add_local(parser, synthetic_token(" cursor"), false);
+    mark_initialized(parser);
+
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+
+    i32 iterable_slot = variable_slot + 1;
+    i32 cursor_slot   = variable_slot + 2;
+
+    i32 loop_start = current_chunk(parser)->count;
+    emit_indexed(gc, parser, OP_FOR_ITER, variable_slot);
+    emit_bytes(gc, parser, 0xff, 0xff);
+    i32 exit_jump = current_chunk(parser)->count - 2;
+    emit_bytes(gc, parser, 0xff, 0xff);
+    i32 body_jump = current_chunk(parser)->count - 2;
+
+    Token iterate = synthetic_token("iterate");
+    emit_indexed(gc, parser, OP_GET_LOCAL, iterable_slot);
+    emit_indexed(gc, parser, OP_GET_LOCAL, cursor_slot);
+    emit_indexed(gc, parser, OP_INVOKE, identifier_constant(gc, parser, &iterate));
+    emit_byte(gc, parser, 1);
+    emit_indexed(gc, parser, OP_SET_LOCAL, cursor_slot);
+    i32 protocol_exit_jump = emit_jump(gc, parser, OP_JUMP_IF_FALSE);
+    emit_byte(gc, parser, OP_POP);
+
+    Token iterator_value = synthetic_token("iterator_value");
+    emit_indexed(gc, parser, OP_GET_LOCAL, iterable_slot);
+    emit_indexed(gc, parser, OP_GET_LOCAL, cursor_slot);
+    emit_indexed(gc, parser, OP_INVOKE, identifier_constant(gc, parser, &iterator_value));
+    emit_byte(gc, parser, 1);
+    emit_indexed(gc, parser, OP_SET_LOCAL, variable_slot);
+    emit_byte(gc, parser, OP_POP);
+
+    patch_jump(parser, body_jump);
+    statement(gc, parser);
+    emit_loop(gc, parser, loop_start);
+
+    // The protocol exits with the falsey cursor still on the stack
+    patch_jump(parser, protocol_exit_jump);
+    emit_byte(gc, parser, OP_POP);
+
+    patch_jump(parser, exit_jump);
+}
+
 static void for_statement(GarbageCollector* gc, Parser* parser)
 {
-    begin_scope();
+    begin_scope(parser);
     consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
     if (match(parser, TOKEN_SEMICOLON))
     {
         
     }
-    else if (match(parser, TOKEN_LET))
+    else if (match(parser, TOKEN_LET) || match(parser, TOKEN_CONST))
     {
-        var_declaration(gc, parser, false);
-    }
-    else if (match(parser, TOKEN_CONST))
-    {
-        var_declaration(gc, parser, true);
+        b32 immutable = parser->previous.type == TOKEN_CONST;
+        i32 global = parse_variable(gc, parser, "Expect variable name.", immutable);
+        if (match(parser, TOKEN_IN))
+        {
+            for_in_statement(gc, parser);
+            end_scope(gc, parser);
+            return;
+        }
+        variable_initializer(gc, parser, global, immutable);
     }
     else
     {
         expression_statement(gc, parser);
     }
 
-    i32 loop_start = current_chunk()->count;
+    i32 loop_start = current_chunk(parser)->count;
 
     i32 exit_jump = -1;
 
@@ -829,7 +1312,7 @@ static void for_statement(GarbageCollector* gc, Parser* parser)
     {
         i32 body_jump = emit_jump(gc, parser, OP_JUMP);
 
-        i32 increment_start = current_chunk()->count;
+        i32 increment_start = current_chunk(parser)->count;
         expression(gc, parser);
         emit_byte(gc, parser, OP_POP);
         consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
@@ -852,6 +1335,9 @@ static void for_statement(GarbageCollector* gc, Parser* parser)
     end_scope(gc, parser);
 }
 
+// The bodies come first and the code picking one of them after them, once all
+// labels are known. Constant labels dispatch with one OP_SWITCH_TABLE or
+// OP_SWITCH_HASH, otherwise the labels are compared one after the other.
 static void switch_statement(GarbageCollector* gc, Parser* parser)
 {
     consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'switch'.");
@@ -860,47 +1346,213 @@ static void switch_statement(GarbageCollector* gc, Parser* parser)
 
     consume(parser, TOKEN_LEFT_BRACE, "Expect '{' after switch expression.");
 
-    i32 exit_jumps[64];
-    i32 exit_jump_count = 0;
+    i32 dispatch_jump = emit_jump(gc, parser, OP_JUMP);
+
+    SwitchCase* cases = NULL;
+    i32 case_count = 0;
+    i32 case_capacity = 0;
+    i32* exit_jumps = NULL;
+    b32 all_constant = true;
 
     while (match(parser, TOKEN_CASE))
     {
-        // Parse the case value
+        Chunk* chunk = current_chunk(parser);
+        Compiler* compiler = parser->compiler;
+        i32 start = chunk->count;
         expression(gc, parser);
-
-        // consume colon
         consume(parser, TOKEN_COLON, "Expect ':' after case value.");
 
-        // Check for equality
-        emit_byte(gc, parser, OP_COMPARE);
-        i32 then_jump = emit_jump(gc, parser, OP_JUMP_IF_FALSE);
+        if (case_count == case_capacity)
+        {
+            case_capacity = GROW_CAPACITY(case_capacity);
+            cases = (SwitchCase*)realloc(cases, sizeof(SwitchCase) * case_capacity);
+            exit_jumps = (i32*)realloc(exit_jumps, sizeof(i32) * case_capacity);
+            if (cases == NULL || exit_jumps == NULL) exit(1);
+        }
 
-        // If false
-        emit_byte(gc, parser, OP_POP); // pop the value
-        emit_byte(gc, parser, OP_POP);
-        statement(gc, parser);
+        SwitchCase* label = &cases[case_count];
+        *label = {};
+        label->constant = -1;
 
-        exit_jumps[exit_jump_count++] = emit_jump(gc, parser, OP_JUMP);
+        // The constant stays in the pool, which keeps a string label alive
+        if (trailing_constants(parser, 1, &label->value) && compiler->pushed[compiler->pushed_count - 1].start == start)
+        {
+            label->is_constant = true;
+            u32 high = 0;
+            i32 op = start + wide_prefix(chunk, start, &high);
+            if (chunk->code[op] == OP_CONSTANT) label->constant = (i32)(high | chunk->code[op + 1]);
+        }
+        else
+        {
+            all_constant = false;
+            label->length = chunk->count - start;
+            label->code   = (u8*)malloc(sizeof(u8) * (label->length + 1));
+            label->lines  = (i32*)malloc(sizeof(i32) * (label->length + 1));
+            memcpy(label->code, chunk->code + start, sizeof(u8) * label->length);
+            for (i32 i = 0; i < label->length; i++) label->lines[i] = get_line(chunk, start + i);
+        }
+        truncate_chunk(chunk, start);
+        compiler->pushed_count = 0;
 
-        patch_jump(parser, then_jump);
-        emit_byte(gc, parser, OP_POP); // pop the value
-        emit_byte(gc, parser, OP_POP);
+        label->body = chunk->count;
+        compiler->last_jump_target = chunk->count;
+        statement(gc, parser);
+        exit_jumps[case_count++] = emit_jump(gc, parser, OP_JUMP);
     }
 
+    i32 default_body = -1;
+    i32 default_exit = -1;
     if (match(parser, TOKEN_DEFAULT))
     {
         consume(parser, TOKEN_COLON, "Expect ':' after default label.");
+        default_body = current_chunk(parser)->count;
+        parser->compiler->last_jump_target = default_body;
         statement(gc, parser);
+        default_exit = emit_jump(gc, parser, OP_JUMP);
     }
 
-    for (i32 i = 0; i < exit_jump_count; i++)
+    patch_jump(parser, dispatch_jump);
+    b32 dispatched = all_constant && case_count > 0 &&
+        (emit_switch_table(gc, parser, cases, case_count, default_body) ||
+         emit_switch_hash(gc, parser, cases, case_count, default_body));
+    if (!dispatched) emit_switch_chain(gc, parser, cases, case_count, default_body);
+
+    for (i32 i = 0; i < case_count; i++)
     {
         patch_jump(parser, exit_jumps[i]);
+        free(cases[i].code);
+        free(cases[i].lines);
+    }
+    if (default_exit != -1) patch_jump(parser, default_exit);
+    free(cases);
+    free(exit_jumps);
+
+    consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after switch statement.");
+}
+
+// A target of a switch instruction ending at end
+static void emit_switch_distance(GarbageCollector* gc, Parser* parser, i32 end, i32 target)
+{
+    i32 distance = target == -1 ? 0 : end - target;
+    if (distance > UINT16_MAX) error(parser, "Too much code to jump over.");
+    emit_bytes(gc, parser, (distance >> 8) & 0xff, distance & 0xff);
+}
+
+// Indexes by the label when all labels are whole numbers close together
+static b32 emit_switch_table(GarbageCollector* gc, Parser* parser, SwitchCase* cases, i32 case_count, i32 default_body)
+{
+    i32 min = INT32_MAX;
+    i32 max = INT32_MIN;
+    for (i32 i = 0; i < case_count; i++)
+    {
+        if (!switch_key(cases[i].value, &cases[i].key)) return false;
+        if (cases[i].key < min) min = cases[i].key;
+        if (cases[i].key > max) max = cases[i].key;
+    }
+
+    i64 span = (i64)max - min + 1;
+    if (span > SWITCH_TABLE_SPAN_MAX || span > 2 * (i64)case_count) return false;
+
+    // The first of equal labels wins, like the comparisons would have it
+    i32* targets = (i32*)malloc(sizeof(i32) * span);
+    for (i32 i = 0; i < span; i++) targets[i] = default_body;
+    for (i32 i = case_count - 1; i >= 0; i--)
+    {
+        targets[cases[i].key - min] = cases[i].body;
+    }
+
+    i32 end = current_chunk(parser)->count + SWITCH_TABLE_HEADER + 2 * (i32)span;
+    emit_byte(gc, parser, OP_SWITCH_TABLE);
+    emit_bytes(gc, parser, ((u32)min >> 24) & 0xff, ((u32)min >> 16) & 0xff);
+    emit_bytes(gc, parser, ((u32)min >> 8) & 0xff, (u32)min & 0xff);
+    emit_bytes(gc, parser, (span >> 8) & 0xff, span & 0xff);
+    emit_switch_distance(gc, parser, end, default_body);
+    for (i32 i = 0; i < span; i++)
+    {
+        emit_switch_distance(gc, parser, end, targets[i]);
+    }
+
+    free(targets);
+    return true;
+}
+
+// Looks the label up in a table the VM builds from the label constants on first use
+static b32 emit_switch_hash(GarbageCollector* gc, Parser* parser, SwitchCase* cases, i32 case_count, i32 default_body)
+{
+    if (parser->compiler->switch_count > UINT8_MAX || case_count > UINT16_MAX) return false;
+
+    // nil, true and false are pushed without a constant
+    for (i32 i = 0; i < case_count; i++)
+    {
+        if (cases[i].constant == -1) cases[i].constant = make_constant(gc, parser, cases[i].value);
+    }
+
+    i32 end = current_chunk(parser)->count + SWITCH_HASH_HEADER + SWITCH_HASH_ENTRY * case_count;
+    emit_bytes(gc, parser, OP_SWITCH_HASH, (u8)parser->compiler->switch_count++);
+    emit_bytes(gc, parser, (case_count >> 8) & 0xff, case_count & 0xff);
+    emit_switch_distance(gc, parser, end, default_body);
+    for (i32 i = 0; i < case_count; i++)
+    {
+        i32 constant = cases[i].constant;
+        emit_byte(gc, parser, (constant >> 16) & 0xff);
+        emit_bytes(gc, parser, (constant >> 8) & 0xff, constant & 0xff);
+        emit_switch_distance(gc, parser, end, cases[i].body);
+    }
+    return true;
+}
+
+// Compares the subject with each label in turn, leaving it on the stack until one matches
+static void emit_switch_chain(GarbageCollector* gc, Parser* parser, SwitchCase* cases, i32 case_count, i32 default_body)
+{
+    Chunk* chunk = current_chunk(parser);
+    for (i32 i = 0; i < case_count; i++)
+    {
+        SwitchCase* label = &cases[i];
+        if (label->is_constant && label->constant != -1)
+        {
+            emit_indexed(gc, parser, OP_CONSTANT, label->constant);
+        }
+        else if (label->is_constant)
+        {
+            emit_value(gc, parser, label->value);
+        }
+        else
+        {
+            for (i32 j = 0; j < label->length; j++)
+            {
+                write_chunk(gc, chunk, label->code[j], label->lines[j]);
+            }
+        }
+
+        emit_byte(gc, parser, OP_COMPARE);
+        i32 next_jump = emit_jump(gc, parser, OP_JUMP_IF_FALSE);
+        emit_byte(gc, parser, OP_POP);
+        emit_byte(gc, parser, OP_POP);
+        emit_byte(gc, parser, OP_POP);
+        emit_loop(gc, parser, label->body);
+
+        patch_jump(parser, next_jump);
+        emit_byte(gc, parser, OP_POP);
+        emit_byte(gc, parser, OP_POP);
     }
 
     emit_byte(gc, parser, OP_POP);
+    if (default_body != -1) emit_loop(gc, parser, default_body);
+}
 
-    consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after switch statement.");
+// Compiles a statement that can never run, for its errors, and throws the code away
+static void dead_statement(GarbageCollector* gc, Parser* parser)
+{
+    Chunk* chunk = current_chunk(parser);
+    i32 count = chunk->count;
+    i32 constant_count = chunk->constants.count;
+
+    statement(gc, parser);
+
+    truncate_chunk(chunk, count);
+    chunk->constants.count = constant_count;
+    parser->compiler->pushed_count = 0;
+    if (parser->compiler->last_jump_target > count) parser->compiler->last_jump_target = count;
 }
 
 static void if_statement(GarbageCollector* gc, Parser* parser)
@@ -909,6 +1561,23 @@ static void if_statement(GarbageCollector* gc, Parser* parser)
     expression(gc, parser);
     consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
+    Value condition;
+    if (trailing_constants(parser, 1, &condition))
+    {
+        drop_constants(parser, 1);
+        if (is_falsey(condition))
+        {
+            dead_statement(gc, parser);
+            if (match(parser, TOKEN_ELSE)) statement(gc, parser);
+        }
+        else
+        {
+            statement(gc, parser);
+            if (match(parser, TOKEN_ELSE)) dead_statement(gc, parser);
+        }
+        return;
+    }
+
     i32 then_jump = emit_jump(gc, parser, OP_JUMP_IF_FALSE);
     emit_byte(gc, parser, OP_POP);
     statement(gc, parser);
@@ -922,13 +1591,14 @@ static void if_statement(GarbageCollector* gc, Parser* parser)
     patch_jump(parser, else_jump);
 }
 
-static void var_declaration(GarbageCollector* gc, Parser* parser, b32 immutable)
+static void variable_initializer(GarbageCollector* gc, Parser* parser, i32 global, b32 immutable)
 {
-    u8 global = parse_variable(gc, parser, "Expect variable name.", immutable);
-
+    Value value;
+    b32 has_value = false;
     if (match(parser, TOKEN_EQUAL))
     {
         expression(gc, parser);
+        has_value = immutable && trailing_constants(parser, 1, &value);
     }
     else if (immutable && !match(parser, TOKEN_EQUAL))
     {
@@ -940,7 +1610,44 @@ static void var_declaration(GarbageCollector* gc, Parser* parser, b32 immutable)
     }
 
     consume(parser, TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
-    define_variable(gc, parser, global);
+    if (!has_value || parser->had_error)
+    {
+        define_variable(gc, parser, global);
+        return;
+    }
+
+    Compiler* compiler = parser->compiler;
+    if (compiler->scope_depth == 0)
+    {
+        define_variable(gc, parser, global);
+        Global* declared = &parser->globals->globals[parser->globals->count - 1];
+        declared->has_value = true;
+        declared->value     = value;
+        return;
+    }
+
+    // The local becomes a ConstLocal and its slot and initializer go away
+    Local* local = &compiler->locals[--compiler->local_count];
+    drop_constants(parser, 1);
+
+    if (compiler->const_count == compiler->const_capacity)
+    {
+        compiler->const_capacity = GROW_CAPACITY(compiler->const_capacity);
+        compiler->consts = (ConstLocal*)realloc(compiler->consts, sizeof(ConstLocal) * compiler->const_capacity);
+        if (compiler->consts == NULL) exit(1);
+    }
+
+    ConstLocal* constant = &compiler->consts[compiler->const_count++];
+    constant->name         = local->name;
+    constant->depth        = compiler->scope_depth;
+    constant->locals_below = compiler->local_count;
+    constant->value        = value;
+}
+
+static void var_declaration(GarbageCollector* gc, Parser* parser, b32 immutable)
+{
+    i32 global = parse_variable(gc, parser, "Expect variable name.", immutable);
+    variable_initializer(gc, parser, global, immutable);
 }
 
 static void print_statement(GarbageCollector* gc, Parser* parser)
@@ -952,7 +1659,7 @@ static void print_statement(GarbageCollector* gc, Parser* parser)
 
 static void return_statement(GarbageCollector* gc, Parser* parser)
 {
-    if (current->type == TYPE_SCRIPT)
+    if (parser->compiler->type == TYPE_SCRIPT)
     {
         error(parser, "Can't return from top-level code.");
     }
@@ -963,7 +1670,7 @@ static void return_statement(GarbageCollector* gc, Parser* parser)
     }
     else
     {
-        if (current->type == TYPE_INITIALIZER)
+        if (parser->compiler->type == TYPE_INITIALIZER)
         {
             error(parser, "Can't return a value from an initializer.");
         }
@@ -976,12 +1683,28 @@ static void return_statement(GarbageCollector* gc, Parser* parser)
 
 static void while_statement(GarbageCollector* gc, Parser* parser)
 {
-    i32 loop_start = current_chunk()->count;
+    i32 loop_start = current_chunk(parser)->count;
     
     consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
     expression(gc, parser);
     consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
+    Value condition;
+    if (trailing_constants(parser, 1, &condition))
+    {
+        drop_constants(parser, 1);
+        if (is_falsey(condition))
+        {
+            dead_statement(gc, parser);
+        }
+        else
+        {
+            statement(gc, parser);
+            emit_loop(gc, parser, loop_start);
+        }
+        return;
+    }
+
     i32 exit_jump = emit_jump(gc, parser, OP_JUMP_IF_FALSE);
 
     emit_byte(gc, parser, OP_POP);
@@ -993,6 +1716,30 @@ static void while_statement(GarbageCollector* gc, Parser* parser)
     emit_byte(gc, parser, OP_POP);
 }
 
+// Only records the path. The loader runs every imported module before the
+// script that imports it, so there is nothing to emit.
+static void import_declaration(GarbageCollector* gc, Parser* parser)
+{
+    if (parser->compiler->type != TYPE_SCRIPT || parser->compiler->scope_depth > 0)
+    {
+        error(parser, "Can only import at the top level.");
+    }
+
+    consume(parser, TOKEN_STRING, "Expect module path after 'import'.");
+    Token path = parser->previous;
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after import.");
+    if (parser->had_error) return;
+
+    ImportList* imports = parser->imports;
+    if (imports->capacity < imports->count + 1)
+    {
+        i32 old_capacity = imports->capacity;
+        imports->capacity = GROW_CAPACITY(old_capacity);
+        imports->paths = GROW_ARRAY(gc, Token, imports->paths, old_capacity, imports->capacity);
+    }
+    imports->paths[imports->count++] = path;
+}
+
 static void synchronize(Parser* parser)
 {
     parser->panic_mode = false;
@@ -1011,6 +1758,7 @@ static void synchronize(Parser* parser)
         case TOKEN_WHILE:
         case TOKEN_PRINT:
         case TOKEN_RETURN:
+        case TOKEN_IMPORT:
         return;
         default:
         // @Note: Do nothing
@@ -1039,6 +1787,10 @@ static void declaration(GarbageCollector* gc, Parser* parser)
     {
         var_declaration(gc, parser, true);
     }
+    else if (match(parser, TOKEN_IMPORT))
+    {
+        import_declaration(gc, parser);
+    }
     else
     {
         statement(gc, parser);
@@ -1075,7 +1827,7 @@ static void statement(GarbageCollector* gc, Parser* parser)
     }
     else if (match(parser, TOKEN_LEFT_BRACE))
     {
-        begin_scope();
+        begin_scope(parser);
         block(gc, parser);
         end_scope(gc, parser);
     }
@@ -1085,58 +1837,82 @@ static void statement(GarbageCollector* gc, Parser* parser)
     }
 }
 
-void init_parse_rules()
-{
-    rules[TOKEN_LEFT_PAREN]    = {grouping, call,   PREC_CALL};
-    rules[TOKEN_RIGHT_PAREN]   = {NULL,     NULL,   PREC_NONE};
-    rules[TOKEN_LEFT_BRACE]    = {NULL,     NULL,   PREC_NONE}; 
-    rules[TOKEN_RIGHT_BRACE]   = {NULL,     NULL,   PREC_NONE};
-    rules[TOKEN_COMMA]         = {NULL,     NULL,   PREC_NONE};
-    rules[TOKEN_DOT]           = {NULL,     dot,    PREC_CALL};
-    rules[TOKEN_MINUS]         = {unary,    binary, PREC_TERM};
-    rules[TOKEN_PLUS]          = {NULL,     binary, PREC_TERM};
-    rules[TOKEN_SEMICOLON]     = {NULL,     NULL,   PREC_NONE};
-    rules[TOKEN_SLASH]         = {NULL,     binary, PREC_FACTOR};
-    rules[TOKEN_STAR]          = {NULL,     binary, PREC_FACTOR};
-    rules[TOKEN_BANG]          = {unary,    NULL,   PREC_NONE};
-    rules[TOKEN_BANG_EQUAL]    = {NULL,     binary, PREC_NONE};
-    rules[TOKEN_EQUAL]         = {NULL,     NULL,   PREC_NONE};
-    rules[TOKEN_EQUAL_EQUAL]   = {NULL,     binary, PREC_EQUALITY};
-    rules[TOKEN_GREATER]       = {NULL,     binary, PREC_COMPARISON};
-    rules[TOKEN_GREATER_EQUAL] = {NULL,     binary, PREC_COMPARISON};
-    rules[TOKEN_LESS]          = {NULL,     binary, PREC_COMPARISON};
-    rules[TOKEN_LESS_EQUAL]    = {NULL,     binary, PREC_COMPARISON};
-    rules[TOKEN_IDENTIFIER]    = {variable, NULL,   PREC_NONE};
-    rules[TOKEN_STRING]        = {string,   NULL,   PREC_NONE};
-    rules[TOKEN_NUMBER]        = {number,   NULL,   PREC_NONE};
-    rules[TOKEN_AND]           = {NULL,     and_,   PREC_NONE};
-    rules[TOKEN_CLASS]         = {NULL,     NULL,   PREC_NONE};
-    rules[TOKEN_ELSE]          = {NULL,     NULL,   PREC_NONE};
-    rules[TOKEN_FALSE]         = {literal,  NULL,   PREC_NONE};
-    rules[TOKEN_FOR]           = {NULL,     NULL,   PREC_NONE};
-    rules[TOKEN_FUN]           = {NULL,     NULL,   PREC_NONE};
-    rules[TOKEN_IF]            = {NULL,     NULL,   PREC_NONE};
-    rules[TOKEN_NIL]           = {literal,  NULL,   PREC_NONE};
-    rules[TOKEN_OR]            = {NULL,     or_,    PREC_NONE};
-    rules[TOKEN_PRINT]         = {NULL,     NULL,   PREC_NONE};
-    rules[TOKEN_RETURN]        = {NULL,     NULL,   PREC_NONE};
-    rules[TOKEN_SUPER]         = {super_,   NULL,   PREC_NONE};
-    rules[TOKEN_THIS]          = {this_,    NULL,   PREC_NONE};
-    rules[TOKEN_TRUE]          = {literal,  NULL,   PREC_NONE};
-    rules[TOKEN_LET]           = {NULL,     NULL,   PREC_NONE};
-    rules[TOKEN_CONST]         = {NULL,     NULL,   PREC_NONE};
-    rules[TOKEN_WHILE]         = {NULL,     NULL,   PREC_NONE};
-    rules[TOKEN_ERROR]         = {NULL,     NULL,   PREC_NONE};
-    rules[TOKEN_EOF]           = {NULL,     NULL,   PREC_NONE};
-}
-
-ObjFunction* compile(GarbageCollector* gc, const char* source, ObjectStore* output_store, Table* output_strings)
-{
-    init_scanner(source);
-
+// Indexed by TokenType, so it has to list the tokens in the same order
+const ParseRule rules[TOKEN_EOF + 1] =
+{
+    /* TOKEN_LEFT_PAREN      */ {grouping, call,      PREC_CALL},
+    /* TOKEN_RIGHT_PAREN     */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_LEFT_BRACE      */ {map,      NULL,      PREC_NONE},
+    /* TOKEN_RIGHT_BRACE     */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_LEFT_BRACKET    */ {array,    subscript, PREC_CALL},
+    /* TOKEN_RIGHT_BRACKET   */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_COMMA           */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_DOT             */ {NULL,     dot,       PREC_CALL},
+    /* TOKEN_MINUS           */ {unary,    binary,    PREC_TERM},
+    /* TOKEN_PLUS            */ {NULL,     binary,    PREC_TERM},
+    /* TOKEN_SEMICOLON       */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_SLASH           */ {NULL,     binary,    PREC_FACTOR},
+    /* TOKEN_STAR            */ {NULL,     binary,    PREC_FACTOR},
+    /* TOKEN_COLON           */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_AMPERSAND       */ {NULL,     binary,    PREC_BIT_AND},
+    /* TOKEN_PIPE            */ {NULL,     binary,    PREC_BIT_OR},
+    /* TOKEN_CARET           */ {NULL,     binary,    PREC_BIT_XOR},
+    /* TOKEN_TILDE           */ {unary,    NULL,      PREC_NONE},
+    /* TOKEN_BANG            */ {unary,    NULL,      PREC_NONE},
+    /* TOKEN_BANG_EQUAL      */ {NULL,     binary,    PREC_NONE},
+    /* TOKEN_EQUAL           */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_EQUAL_EQUAL     */ {NULL,     binary,    PREC_EQUALITY},
+    /* TOKEN_GREATER         */ {NULL,     binary,    PREC_COMPARISON},
+    /* TOKEN_GREATER_EQUAL   */ {NULL,     binary,    PREC_COMPARISON},
+    /* TOKEN_LESS            */ {NULL,     binary,    PREC_COMPARISON},
+    /* TOKEN_LESS_EQUAL      */ {NULL,     binary,    PREC_COMPARISON},
+    /* TOKEN_LESS_LESS       */ {NULL,     binary,    PREC_SHIFT},
+    /* TOKEN_GREATER_GREATER */ {NULL,     binary,    PREC_SHIFT},
+    /* TOKEN_IDENTIFIER      */ {variable, NULL,      PREC_NONE},
+    /* TOKEN_STRING          */ {string,   NULL,      PREC_NONE},
+    /* TOKEN_NUMBER          */ {number,   NULL,      PREC_NONE},
+    /* TOKEN_AND             */ {NULL,     and_,      PREC_NONE},
+    /* TOKEN_CLASS           */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_ELSE            */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_FALSE           */ {literal,  NULL,      PREC_NONE},
+    /* TOKEN_FOR             */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_FUN             */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_IF              */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_IN              */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_NIL             */ {literal,  NULL,      PREC_NONE},
+    /* TOKEN_OR              */ {NULL,     or_,       PREC_NONE},
+    /* TOKEN_PRINT           */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_RETURN          */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_SUPER           */ {super_,   NULL,      PREC_NONE},
+    /* TOKEN_THIS            */ {this_,    NULL,      PREC_NONE},
+    /* TOKEN_TRUE            */ {literal,  NULL,      PREC_NONE},
+    /* TOKEN_LET             */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_CONST           */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_WHILE           */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_SWITCH          */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_CASE            */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_DEFAULT         */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_CONTINUE        */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_IMPORT          */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_ERROR           */ {NULL,     NULL,      PREC_NONE},
+    /* TOKEN_EOF             */ {NULL,     NULL,      PREC_NONE},
+};
+
+// With lazy set, the returned functions keep pointing into source until they are first called.
+// All of the state lives in the parser and the arguments, so separate heaps can compile at once.
+// The paths of import statements are appended to imports, pointing into source.
+ObjFunction* compile(GarbageCollector* gc, const char* source, ObjectStore* output_store, Table* output_strings, GlobalScope* globals, ImportList* imports, b32 lazy)
+{
     Parser parser = {};
+    init_scanner(&parser.scanner, source);
     parser.store = output_store;
     parser.strings = output_strings;
+    parser.globals = globals;
+    parser.imports = imports;
+    parser.lazy = lazy;
+
+    Parser* enclosing_parser = gc->parser;
+    gc->parser = &parser;
 
     Compiler compiler = {};
     init_compiler(&compiler, gc, &parser, TYPE_SCRIPT);
@@ -1149,15 +1925,142 @@ ObjFunction* compile(GarbageCollector* gc, const char* source, ObjectStore* outp
     }
   
     ObjFunction* function = end_compiler(gc, &parser);
+    free_compiler(&compiler);
+    gc->parser = enclosing_parser;
     return parser.had_error ? NULL : function;
 }
 
+// Compiles the body of a function that compile skipped, rescanning its source
+// from the parameter list. Returns false after reporting compile errors.
+b32 compile_lazy_function(GarbageCollector* gc, ObjFunction* function, ObjectStore* output_store, Table* output_strings, GlobalScope* globals)
+{
+    Parser parser = {};
+    init_scanner_at(&parser.scanner, function->lazy_source, function->lazy_line);
+    parser.store = output_store;
+    parser.strings = output_strings;
+    parser.globals = globals;
+    parser.deferred = true;
+
+    function->lazy_source = NULL;
+    function->arity = 0;
+
+    // Lazy methods belong to classes without a superclass
+    ClassCompiler class_compiler = {};
+    if (function->lazy_type != TYPE_FUNCTION) parser.class_compiler = &class_compiler;
+
+    Parser* enclosing_parser = gc->parser;
+    gc->parser = &parser;
+
+    Compiler compiler = {};
+    init_compiler_function(&parser, &compiler, function, (FunctionType)function->lazy_type);
+    begin_scope(&parser);
+
+    advance(&parser);
+    parameters(gc, &parser);
+    block(gc, &parser);
+    end_compiler(gc, &parser);
+    free_compiler(&compiler);
+
+    gc->parser = enclosing_parser;
+    return !parser.had_error;
+}
+
+void init_global_scope(GlobalScope* scope)
+{
+    scope->globals         = NULL;
+    scope->count           = 0;
+    scope->capacity        = 0;
+    scope->buckets         = NULL;
+    scope->bucket_capacity = 0;
+}
+
+void free_global_scope(GlobalScope* scope)
+{
+    free(scope->globals);
+    free(scope->buckets);
+    init_global_scope(scope);
+}
+
+// A module compiles against its own copy of the globals, see add_module
+void copy_global_scope(GlobalScope* scope, GlobalScope* source)
+{
+    init_global_scope(scope);
+    for (i32 i = 0; i < source->count; i++) *push_global(scope, source->globals[i].name) = source->globals[i];
+}
+
+// Grows the scope by one global named name, the caller fills in the rest.
+// Lookups find it from now on, over any earlier global with the same name.
+Global* push_global(GlobalScope* scope, ObjString* name)
+{
+    if (scope->count == scope->capacity)
+    {
+        scope->capacity = GROW_CAPACITY(scope->capacity);
+        scope->globals = (Global*)realloc(scope->globals, sizeof(Global) * scope->capacity);
+        if (scope->globals == NULL) exit(1);
+    }
+
+    Global* global = &scope->globals[scope->count++];
+    global->name = name;
+
+    if (scope->count * 4 > scope->bucket_capacity * 3)
+    {
+        free(scope->buckets);
+        scope->bucket_capacity = scope->bucket_capacity < 8 ? 8 : scope->bucket_capacity * 2;
+        scope->buckets = (i32*)calloc(scope->bucket_capacity, sizeof(i32));
+        if (scope->buckets == NULL) exit(1);
+        for (i32 i = 0; i < scope->count; i++) index_global(scope, i);
+    }
+    else
+    {
+        index_global(scope, scope->count - 1);
+    }
+    return global;
+}
+
+// The index of the latest global with this name, or -1
+i32 find_global(GlobalScope* scope, const char* chars, i32 length, u32 hash)
+{
+    if (scope->bucket_capacity == 0) return -1;
+
+    u32 mask = (u32)scope->bucket_capacity - 1;
+    for (u32 bucket = hash & mask;; bucket = (bucket + 1) & mask)
+    {
+        i32 entry = scope->buckets[bucket];
+        if (entry == 0) return -1;
+
+        ObjString* name = scope->globals[entry - 1].name;
+        if (name->hash == hash && name->length == length && memcmp(name->chars, chars, length) == 0) return entry - 1;
+    }
+}
+
+static void index_global(GlobalScope* scope, i32 index)
+{
+    ObjString* name = scope->globals[index].name;
+    u32 mask = (u32)scope->bucket_capacity - 1;
+    for (u32 bucket = name->hash & mask;; bucket = (bucket + 1) & mask)
+    {
+        i32 entry = scope->buckets[bucket];
+        ObjString* other = entry == 0 ? NULL : scope->globals[entry - 1].name;
+        if (other == NULL || (other->length == name->length && memcmp(other->chars, name->chars, name->length) == 0))
+        {
+            scope->buckets[bucket] = index + 1;
+            return;
+        }
+    }
+}
+
 void mark_compiler_roots(GarbageCollector* gc)
 {
-    Compiler* compiler = current;
+    if (gc->parser == NULL) return;
+
+    Compiler* compiler = gc->parser->compiler;
     while(compiler != NULL)
     {
         mark_object(gc, (Obj*)compiler->function);
+        for (i32 i = 0; i < compiler->const_count; i++)
+        {
+            mark_value(gc, compiler->consts[i].value);
+        }
         compiler = compiler->enclosing;
     }
 }
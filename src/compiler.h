@@ -8,8 +8,17 @@
 // =================================================================
 // Types
 // =================================================================
+// The string tokens of a script's import statements, quotes included
+struct ImportList
+{
+    Token* paths;
+    i32 count;
+    i32 capacity;
+};
+
 struct Parser
 {
+    Scanner scanner;
     Token current;
     Token previous;
 
@@ -18,6 +27,18 @@ struct Parser
 
     ObjectStore* store;
     Table* strings;
+    struct GlobalScope* globals;
+    ImportList* imports;
+
+    struct Compiler* compiler;
+    struct ClassCompiler* class_compiler;
+
+    // Leave the bodies of top level functions and methods for compile_lazy_function
+    b32 lazy;
+
+    // Compiling one of those bodies on its first call. The global scope is complete
+    // by then, so it holds consts whose declarations may not have run yet.
+    b32 deferred;
 };
 
 enum Precedence
@@ -28,9 +49,13 @@ enum Precedence
     PREC_AND,         // and
     PREC_EQUALITY,    // == !=
     PREC_COMPARISON,  // < > <= >=
+    PREC_BIT_OR,      // |
+    PREC_BIT_XOR,     // ^
+    PREC_BIT_AND,     // &
+    PREC_SHIFT,       // << >>
     PREC_TERM,        // + -
     PREC_FACTOR,      // * /
-    PREC_UNARY,       // ! -
+    PREC_UNARY,       // ! - ~
     PREC_CALL,        // . ()
     PREC_PRIMARY
 };
@@ -51,12 +76,27 @@ struct Local
     b32 immutable;
 };
 
+// A const local initialized with a constant. It takes no stack slot, every read
+// pushes the value, closures included.
+struct ConstLocal
+{
+    Token name;
+    i32 depth;
+    i32 locals_below; // Locals at or above this index were declared after it
+    Value value;
+};
+
 struct Upvalue
 {
-    u8 index;
+    i32 index;
     b32 is_local;
 };
 
+// Indices past a byte take an OP_WIDE or OP_WIDE_LONG prefix
+#define LOCALS_MAX    (1 << 16)
+#define UPVALUES_MAX  (1 << 16)
+#define CONSTANTS_MAX (1 << 24)
+
 enum FunctionType
 {
     TYPE_FUNCTION,
@@ -69,10 +109,53 @@ struct Global
 {
     ObjString* name;
     b32 immutable;
+
+    // A const initialized with a constant. Reads compiled after the declaration
+    // push the value, but the global is still defined for code compiled before it.
+    b32 has_value;
+    Value value;
 };
 
-Global globals[UINT8_COUNT];
-i32 global_count;
+// Globals declared so far. It outlives a single compile so that later REPL
+// lines and lazily compiled bodies see the same declarations.
+struct GlobalScope
+{
+    Global* globals;
+    i32 count;
+    i32 capacity;
+
+    // Open addressing on the name hash. A bucket holds the index of the latest
+    // global with that name plus one, or 0 while empty.
+    i32* buckets;
+    i32 bucket_capacity;
+};
+
+// An instruction at the end of the chunk that pushes a known value
+struct PushedConstant
+{
+    i32 start;
+    i32 end;
+    Value value;
+};
+
+#define PUSHED_CONSTANTS_MAX 16
+
+// A dense table is used while the labels cover at least half of the keys in their range
+#define SWITCH_TABLE_SPAN_MAX 1024
+
+// A case of a switch statement. The label is compiled where it appears and then
+// taken out again, a constant keeps only its value and any other label its code.
+struct SwitchCase
+{
+    b32 is_constant;
+    Value value;
+    i32 constant; // Of the OP_CONSTANT that pushed value, or -1
+    i32 key;      // value as an OP_SWITCH_TABLE key, see emit_switch_table
+    u8* code;
+    i32* lines;
+    i32 length;
+    i32 body;     // Offset of the statement
+};
 
 struct Compiler
 {
@@ -81,12 +164,27 @@ struct Compiler
     ObjFunction* function;
     FunctionType type;
     
-    Local locals[UINT8_COUNT];
+    Local* locals;
     i32 local_count;
+    i32 local_capacity;
 
-    Upvalue upvalues[UINT8_COUNT];
+    ConstLocal* consts;
+    i32 const_count;
+    i32 const_capacity;
+
+    Upvalue* upvalues; // function->upvalue_count of them
+    i32 upvalue_capacity;
     
     i32 scope_depth;
+
+    // The constants pushed by the last instructions, for folding. They are only
+    // used while they still end the chunk and no jump lands between them.
+    PushedConstant pushed[PUSHED_CONSTANTS_MAX];
+    i32 pushed_count;
+    i32 last_jump_target;
+
+    // OP_SWITCH_HASH instructions so far, each has its own table at run time
+    i32 switch_count;
 };
 
 struct ClassCompiler
@@ -95,15 +193,20 @@ struct ClassCompiler
     b32 has_superclass;
 };
 
-ParseRule rules[TOKEN_EOF];
-
+extern const ParseRule rules[TOKEN_EOF + 1];
 
 // =================================================================
 // API Functions
 // =================================================================
-ObjFunction* compile(GarbageCollector* gc, const char* source, ObjectStore* output_store, Table* output_strings);
+ObjFunction* compile(GarbageCollector* gc, const char* source, ObjectStore* output_store, Table* output_strings, GlobalScope* globals, ImportList* imports, b32 lazy);
+b32          compile_lazy_function(GarbageCollector* gc, ObjFunction* function, ObjectStore* output_store, Table* output_strings, GlobalScope* globals);
 void mark_compiler_roots(GarbageCollector* gc);
-void init_parse_rules();
+
+void    init_global_scope(GlobalScope* scope);
+void    free_global_scope(GlobalScope* scope);
+void    copy_global_scope(GlobalScope* scope, GlobalScope* source);
+Global* push_global(GlobalScope* scope, ObjString* name);
+i32     find_global(GlobalScope* scope, const char* chars, i32 length, u32 hash);
 // =================================================================
 
 // =================================================================
@@ -116,26 +219,46 @@ static void error(Parser* parser, const char* message);
 static void advance(Parser* parser);
 static void consume(Parser* parser, TokenType type, const char* message);
 
-static Chunk* current_chunk();
+static Chunk* current_chunk(Parser* parser);
 
 static void emit_byte(GarbageCollector* gc, Parser* pasrer, u8 byte);
 static void emit_bytes(GarbageCollector* gc, Parser* pasrer, u8 byte_1, u8 byte_2);
 static void emit_return(GarbageCollector* gc, Parser* parser);
-static u8 make_constant(GarbageCollector* gc, Parser* parser, Value value);
-static u8 identifier_constant(GarbageCollector* gc, Parser* parser, Token* name);
-static void emit_constant(GarbageCollector* gc, Parser* parser);
+static void emit_indexed(GarbageCollector* gc, Parser* parser, u8 op, i32 index);
+static i32 make_constant(GarbageCollector* gc, Parser* parser, Value value);
+static i32 identifier_constant(GarbageCollector* gc, Parser* parser, Token* name);
+static void emit_constant(GarbageCollector* gc, Parser* parser, Value value);
+static void emit_value(GarbageCollector* gc, Parser* parser, Value value);
+static b32  trailing_constants(Parser* parser, i32 count, Value* values);
+static void drop_constants(Parser* parser, i32 count);
+static b32  constant_integer(Value value, i32* result);
+static b32  fold_unary(TokenType operator_type, Value operand, Value* result);
+static b32  fold_binary(GarbageCollector* gc, Parser* parser, TokenType operator_type, Value a, Value b, Value* result);
+static void dead_statement(GarbageCollector* gc, Parser* parser);
+static void emit_switch_distance(GarbageCollector* gc, Parser* parser, i32 end, i32 target);
+static b32  emit_switch_table(GarbageCollector* gc, Parser* parser, SwitchCase* cases, i32 case_count, i32 default_body);
+static b32  emit_switch_hash(GarbageCollector* gc, Parser* parser, SwitchCase* cases, i32 case_count, i32 default_body);
+static void emit_switch_chain(GarbageCollector* gc, Parser* parser, SwitchCase* cases, i32 case_count, i32 default_body);
+static Local* push_local(Compiler* compiler);
+static void  free_compiler(Compiler* compiler);
 static ObjFunction* end_compiler(Parser* parser);
 static void parse_precedence(GarbageCollector* gc, Parser* parser, Precedence precedence);
-static ParseRule* get_rule(TokenType type);
+static const ParseRule* get_rule(TokenType type);
 static void expression(GarbageCollector* gc, Parser* parser);
 static void declaration(GarbageCollector* gc, Parser* parser);
 static void var_declaration(GarbageCollector* gc, Parser* parser, b32 immutable);
+static void variable_initializer(GarbageCollector* gc, Parser* parser, i32 global, b32 immutable);
 static void statement(GarbageCollector* gc, Parser* parser);
 static void method(GarbageCollector* gc, Parser* parser);
+static void parameters(GarbageCollector* gc, Parser* parser);
+static void skip_block(Parser* parser);
+static void import_declaration(GarbageCollector* gc, Parser* parser);
 
 static i32 resolve_local(Parser* parser, Compiler* compiler, Token* name, b32* immutable);
 static i32 resolve_upvalue(Parser* parser, Compiler* compiler, Token* name, b32* immutable);
 static Global* get_global(Parser* parser, Compiler* compiler, Token* name);
+static void    index_global(GlobalScope* scope, i32 index);
+static b32     resolve_constant(Parser* parser, Token* name, Value* value);
 // =================================================================
 
 #endif
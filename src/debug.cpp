@@ -9,15 +9,22 @@ void disassemble_chunk(Chunk* chunk, const char* name)
 }
 
 i32 disassemble_instruction(Chunk* chunk, i32 offset)
+{
+    return disassemble_operation(chunk, offset, 0);
+}
+
+// wide holds the bits an OP_WIDE or OP_WIDE_LONG prefix adds to the index operand
+static i32 disassemble_operation(Chunk* chunk, i32 offset, u32 wide)
 {
     printf("%04d ", offset);
-    if(offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1])
+    i32 line = get_line(chunk, offset);
+    if(offset > 0 && line == get_line(chunk, offset - 1))
     {
         printf("   | ");
     }
     else
     {
-        printf("%4d ", chunk->lines[offset]);
+        printf("%4d ", line);
     }
 
     u8 instruction = chunk->code[offset];
@@ -25,11 +32,7 @@ i32 disassemble_instruction(Chunk* chunk, i32 offset)
     {
         case OP_CONSTANT:
         {
-            return constant_instruction("OP_CONSTANT", chunk, offset);
-        }
-        case OP_CONSTANT_LONG:
-        {
-            return constant_long_instruction("OP_CONSTANT_LONG", chunk, offset);
+            return constant_instruction("OP_CONSTANT", chunk, offset, wide);
         }
         case OP_NIL:
         {
@@ -49,43 +52,67 @@ i32 disassemble_instruction(Chunk* chunk, i32 offset)
         }
         case OP_GET_LOCAL:
         {
-            return byte_instruction("OP_GET_LOCAL", chunk, offset);
+            return byte_instruction("OP_GET_LOCAL", chunk, offset, wide);
         }
         case OP_SET_LOCAL:
         {
-            return byte_instruction("OP_SET_LOCAL", chunk, offset);
+            return byte_instruction("OP_SET_LOCAL", chunk, offset, wide);
         }
         case OP_GET_GLOBAL:
         {
-            return constant_instruction("OP_GET_GLOBAL", chunk, offset);
+            return constant_instruction("OP_GET_GLOBAL", chunk, offset, wide);
         }
         case OP_DEFINE_GLOBAL:
         {
-            return constant_instruction("OP_DEFINE_GLOBAL", chunk, offset);
+            return constant_instruction("OP_DEFINE_GLOBAL", chunk, offset, wide);
         }
         case OP_SET_GLOBAL:
         {
-            return constant_instruction("OP_SET_GLOBAL", chunk, offset);
+            return constant_instruction("OP_SET_GLOBAL", chunk, offset, wide);
         }
         case OP_GET_UPVALUE:
         {
-            return byte_instruction("OP_GET_UPVALUE", chunk, offset);
+            return byte_instruction("OP_GET_UPVALUE", chunk, offset, wide);
         }
         case OP_SET_UPVALUE:
         {
-            return byte_instruction("OP_SET_UPVALUE", chunk, offset);
+            return byte_instruction("OP_SET_UPVALUE", chunk, offset, wide);
         }
         case OP_GET_PROPERTY:
         {
-            return constant_instruction("OP_GET_PROPERTY", chunk, offset);
+            return constant_instruction("OP_GET_PROPERTY", chunk, offset, wide);
         }
         case OP_SET_PROPERTY:
         {
-            return constant_instruction("OP_SET_PROPERTY", chunk, offset);
+            return constant_instruction("OP_SET_PROPERTY", chunk, offset, wide);
         }
         case OP_GET_SUPER:
         {
-            return constant_instruction("OP_GET_SUPER", chunk, offset);
+            return constant_instruction("OP_GET_SUPER", chunk, offset, wide);
+        }
+        case OP_ARRAY:
+        {
+            return byte_instruction("OP_ARRAY", chunk, offset, wide);
+        }
+        case OP_MAP:
+        {
+            return byte_instruction("OP_MAP", chunk, offset, wide);
+        }
+        case OP_ARRAY_EXTEND:
+        {
+            return byte_instruction("OP_ARRAY_EXTEND", chunk, offset, wide);
+        }
+        case OP_MAP_EXTEND:
+        {
+            return byte_instruction("OP_MAP_EXTEND", chunk, offset, wide);
+        }
+        case OP_INDEX_GET:
+        {
+            return simple_instruction("OP_INDEX_GET", offset);
+        }
+        case OP_INDEX_SET:
+        {
+            return simple_instruction("OP_INDEX_SET", offset);
         }
         case OP_EQUAL:
         {
@@ -123,6 +150,30 @@ i32 disassemble_instruction(Chunk* chunk, i32 offset)
         {
             return simple_instruction("OP_NEGATE", offset);
         }
+        case OP_BIT_AND:
+        {
+            return simple_instruction("OP_BIT_AND", offset);
+        }
+        case OP_BIT_OR:
+        {
+            return simple_instruction("OP_BIT_OR", offset);
+        }
+        case OP_BIT_XOR:
+        {
+            return simple_instruction("OP_BIT_XOR", offset);
+        }
+        case OP_BIT_NOT:
+        {
+            return simple_instruction("OP_BIT_NOT", offset);
+        }
+        case OP_SHIFT_LEFT:
+        {
+            return simple_instruction("OP_SHIFT_LEFT", offset);
+        }
+        case OP_SHIFT_RIGHT:
+        {
+            return simple_instruction("OP_SHIFT_RIGHT", offset);
+        }
         case OP_PRINT:
         {
             return simple_instruction("OP_PRINT", offset);
@@ -143,22 +194,26 @@ i32 disassemble_instruction(Chunk* chunk, i32 offset)
         {
             return jump_instruction("OP_LOOP", -1, chunk, offset);
         }
+        case OP_FOR_ITER:
+        {
+            return for_iter_instruction("OP_FOR_ITER", chunk, offset, wide);
+        }
         case OP_CALL:
         {
-            return byte_instruction("OP_CALL", chunk, offset);
+            return byte_instruction("OP_CALL", chunk, offset, wide);
         }
         case OP_INVOKE:
         {
-            return invoke_instruction("OP_INVOKE", chunk, offset);
+            return invoke_instruction("OP_INVOKE", chunk, offset, wide);
         }
         case OP_SUPER_INVOKE:
         {
-            return invoke_instruction("OP_SUPER_INVOKE", chunk, offset);
+            return invoke_instruction("OP_SUPER_INVOKE", chunk, offset, wide);
         }
         case OP_CLOSURE:
         {
-            offset++;
-            u8 constant = chunk->code[offset++];
+            u32 constant = index_operand(chunk, offset, wide);
+            offset += 2;
             printf("%-16s %4d ", "OP_CLOSURE", constant);
             print_value(chunk->constants.values[constant]);
             printf("\n");
@@ -166,10 +221,12 @@ i32 disassemble_instruction(Chunk* chunk, i32 offset)
             ObjFunction* function = AS_FUNCTION(chunk->constants.values[constant]);
             for(i32 j = 0; j < function->upvalue_count; j++)
             {
-                i32 is_local = chunk->code[offset++];
+                i32 start    = offset;
+                u8 flags     = chunk->code[offset++];
                 i32 index    = chunk->code[offset++];
+                for (i32 byte = 0; byte < flags >> 1; byte++) index = index << 8 | chunk->code[offset++];
                 printf("%04d      |                     %s %d\n",
-                       offset - 2, is_local ? "local" : "upvalue", index);
+                       start, flags & 1 ? "local" : "upvalue", index);
             }
         
             return offset;
@@ -184,7 +241,7 @@ i32 disassemble_instruction(Chunk* chunk, i32 offset)
         }
         case OP_CLASS:
         {
-            return constant_instruction("OP_CLASS", chunk, offset);
+            return constant_instruction("OP_CLASS", chunk, offset, wide);
         }
         case OP_INHERIT:
         {
@@ -192,7 +249,68 @@ i32 disassemble_instruction(Chunk* chunk, i32 offset)
         }
         case OP_METHOD:
         {
-            return constant_instruction("OP_METHOD", chunk, offset);
+            return constant_instruction("OP_METHOD", chunk, offset, wide);
+        }
+        case OP_SWITCH_TABLE:
+        {
+            return switch_table_instruction("OP_SWITCH_TABLE", chunk, offset);
+        }
+        case OP_SWITCH_HASH:
+        {
+            return switch_hash_instruction("OP_SWITCH_HASH", chunk, offset);
+        }
+        case OP_GUARD_CALLEE:
+        {
+            return guard_instruction("OP_GUARD_CALLEE", chunk, offset);
+        }
+        case OP_INLINED_RETURN:
+        {
+            return byte_instruction("OP_INLINED_RETURN", chunk, offset, wide);
+        }
+        case OP_ADD_NUMBER:
+        {
+            return simple_instruction("OP_ADD_NUMBER", offset);
+        }
+        case OP_SUBTRACT_NUMBER:
+        {
+            return simple_instruction("OP_SUBTRACT_NUMBER", offset);
+        }
+        case OP_MULTIPLY_NUMBER:
+        {
+            return simple_instruction("OP_MULTIPLY_NUMBER", offset);
+        }
+        case OP_DIVIDE_NUMBER:
+        {
+            return simple_instruction("OP_DIVIDE_NUMBER", offset);
+        }
+        case OP_LESS_NUMBER:
+        {
+            return simple_instruction("OP_LESS_NUMBER", offset);
+        }
+        case OP_GREATER_NUMBER:
+        {
+            return simple_instruction("OP_GREATER_NUMBER", offset);
+        }
+        case OP_NEGATE_NUMBER:
+        {
+            return simple_instruction("OP_NEGATE_NUMBER", offset);
+        }
+        case OP_ADD_STRING:
+        {
+            return simple_instruction("OP_ADD_STRING", offset);
+        }
+        case OP_GET_PROPERTY_INSTANCE:
+        {
+            return constant_instruction("OP_GET_PROPERTY_INSTANCE", chunk, offset, wide);
+        }
+        case OP_SET_PROPERTY_INSTANCE:
+        {
+            return constant_instruction("OP_SET_PROPERTY_INSTANCE", chunk, offset, wide);
+        }
+        case OP_WIDE:
+        case OP_WIDE_LONG:
+        {
+            return wide_instruction(instruction == OP_WIDE ? "OP_WIDE" : "OP_WIDE_LONG", chunk, offset);
         }
         default:
         {
@@ -208,9 +326,26 @@ static i32 simple_instruction(const char* name, i32 offset)
     return offset + 1;
 }
 
-static i32 byte_instruction(const char* name, Chunk* chunk, i32 offset)
+// Prints the prefix on its own line and then the instruction it widens
+static i32 wide_instruction(const char* name, Chunk* chunk, i32 offset)
+{
+    u32 high = 0;
+    i32 prefix = wide_prefix(chunk, offset, &high);
+    printf("%s\n", name);
+    if (prefix == 0) return offset + 1;
+
+    return disassemble_operation(chunk, offset + prefix, high);
+}
+
+// The operand after the opcode at offset, with the bits of a prefix before it
+static u32 index_operand(Chunk* chunk, i32 offset, u32 wide)
 {
-    u8 slot = chunk->code[offset + 1];
+    return wide | chunk->code[offset + 1];
+}
+
+static i32 byte_instruction(const char* name, Chunk* chunk, i32 offset, u32 wide)
+{
+    u32 slot = index_operand(chunk, offset, wide);
     printf("%-16s %4d\n", name, slot);
     return offset + 2;
 }
@@ -223,32 +358,73 @@ static i32 jump_instruction(const char* name, i32 sign, Chunk* chunk, i32 offset
     return offset + 3;
 }
 
-static i32 constant_instruction(const char* name, Chunk* chunk, i32 offset)
+static i32 guard_instruction(const char* name, Chunk* chunk, i32 offset)
 {
     u8 constant = chunk->code[offset + 1];
+    u8 arg_count = chunk->code[offset + 2];
+    u16 jump = (u16)(chunk->code[offset + 3] << 8) | chunk->code[offset + 4];
     printf("%-16s %4d '", name, constant);
     print_value(chunk->constants.values[constant]);
-    printf("'\n");
-    return offset + 2;
+    printf("' (%d args) -> %d\n", arg_count, offset + 5 + jump);
+    return offset + 5;
 }
 
-static i32 invoke_instruction(const char* name, Chunk* chunk, i32 offset)
+static i32 switch_table_instruction(const char* name, Chunk* chunk, i32 offset)
 {
-    u8 constant = chunk->code[offset + 1];
-    u8 arg_count = chunk->code[offset + 2];
-    printf("%-16s (%d args) %4d '", name, arg_count, constant);
+    u8* code = chunk->code + offset;
+    i32 min = (i32)((u32)code[1] << 24 | (u32)code[2] << 16 | (u32)code[3] << 8 | code[4]);
+    u16 count = (u16)(code[5] << 8 | code[6]);
+    i32 end = offset + SWITCH_TABLE_HEADER + 2 * count;
+    printf("%-16s %4d.. default -> %d\n", name, min, end - (u16)(code[7] << 8 | code[8]));
+    for (i32 i = 0; i < count; i++)
+    {
+        u8* target = code + SWITCH_TABLE_HEADER + 2 * i;
+        printf("%04d      |                     %d -> %d\n",
+               offset + SWITCH_TABLE_HEADER + 2 * i, min + i, end - (u16)(target[0] << 8 | target[1]));
+    }
+    return end;
+}
+
+static i32 switch_hash_instruction(const char* name, Chunk* chunk, i32 offset)
+{
+    u8* code = chunk->code + offset;
+    u16 count = (u16)(code[2] << 8 | code[3]);
+    i32 end = offset + SWITCH_HASH_HEADER + SWITCH_HASH_ENTRY * count;
+    printf("%-16s %4d default -> %d\n", name, code[1], end - (u16)(code[4] << 8 | code[5]));
+    for (i32 i = 0; i < count; i++)
+    {
+        u8* entry = code + SWITCH_HASH_HEADER + SWITCH_HASH_ENTRY * i;
+        printf("%04d      |                     '", offset + SWITCH_HASH_HEADER + SWITCH_HASH_ENTRY * i);
+        print_value(chunk->constants.values[(u32)entry[0] << 16 | (u32)entry[1] << 8 | entry[2]]);
+        printf("' -> %d\n", end - (u16)(entry[3] << 8 | entry[4]));
+    }
+    return end;
+}
+
+static i32 for_iter_instruction(const char* name, Chunk* chunk, i32 offset, u32 wide)
+{
+    u32 slot = index_operand(chunk, offset, wide);
+    u16 exit = (u16)(chunk->code[offset + 2] << 8) | chunk->code[offset + 3];
+    u16 body = (u16)(chunk->code[offset + 4] << 8) | chunk->code[offset + 5];
+    printf("%-16s %4d exit -> %d, body -> %d\n", name, slot, offset + 4 + exit, offset + 6 + body);
+    return offset + 6;
+}
+
+static i32 constant_instruction(const char* name, Chunk* chunk, i32 offset, u32 wide)
+{
+    u32 constant = index_operand(chunk, offset, wide);
+    printf("%-16s %4d '", name, constant);
     print_value(chunk->constants.values[constant]);
     printf("'\n");
-    return offset + 3;
+    return offset + 2;
 }
 
-static i32 constant_long_instruction(const char* name, Chunk* chunk, i32 offset)
+static i32 invoke_instruction(const char* name, Chunk* chunk, i32 offset, u32 wide)
 {
-    i32 constant = (chunk->code[offset + 1])
-        | (chunk->code[offset + 2] << 8)
-        | (chunk->code[offset + 3] << 16);
-    printf("%-16s %4d '", name, constant);
+    u32 constant = index_operand(chunk, offset, wide);
+    u8 arg_count = chunk->code[offset + 2];
+    printf("%-16s (%d args) %4d '", name, arg_count, constant);
     print_value(chunk->constants.values[constant]);
     printf("'\n");
-    return offset + 4;
+    return offset + 3;
 }
@@ -15,12 +15,18 @@ void disassemble_chunk(Chunk* chunk, const char* name);
 // =================================================================
 // Internal Functions
 // =================================================================
+static i32 disassemble_operation(Chunk* chunk, i32 offset, u32 wide);
 static i32 simple_instruction(const char* name, i32 offset);
-static i32 byte_instruction(const char* name, Chunk* chunk, i32 offset);
+static i32 byte_instruction(const char* name, Chunk* chunk, i32 offset, u32 wide);
 static i32 jump_instruction(const char* name, i32 sign, Chunk* chunk, i32 offset);        
-static i32 constant_instruction(const char* name, Chunk* chunk, i32 offset);
-static i32 invoke_instruction(const char* name, Chunk* chunk, i32 offset);
-static i32 constant_long_instruction(const char* name, Chunk* chunk, i32 offset);
+static i32 constant_instruction(const char* name, Chunk* chunk, i32 offset, u32 wide);
+static i32 guard_instruction(const char* name, Chunk* chunk, i32 offset);
+static i32 invoke_instruction(const char* name, Chunk* chunk, i32 offset, u32 wide);
+static i32 wide_instruction(const char* name, Chunk* chunk, i32 offset);
+static u32 index_operand(Chunk* chunk, i32 offset, u32 wide);
+static i32 switch_table_instruction(const char* name, Chunk* chunk, i32 offset);
+static i32 switch_hash_instruction(const char* name, Chunk* chunk, i32 offset);
+static i32 for_iter_instruction(const char* name, Chunk* chunk, i32 offset, u32 wide);
 // =================================================================
 
 #endif
@@ -0,0 +1,233 @@
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define HASH_PRIME_32 0x9E3779B1u
+#define HASH_PRIME_64 0x9E3779B185EBCA87ull
+
+// Random 64-bit keys, xor'ed with the input so no fixed input zeroes the multiplies
+static const u64 hash_base_secret[8] =
+{
+    0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull, 0xdb979083e96dd4deull, 0x1f67b3b7a4a44072ull,
+    0x78e5c0cc4ee679cbull, 0x2172ffcc7dd05a82ull, 0x8e2443f7744608b8ull, 0x4c263a81e69035e0ull,
+};
+
+// The secret used by hash_string. Only reseed before any string is hashed.
+static u64 hash_secret[8] =
+{
+    0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull, 0xdb979083e96dd4deull, 0x1f67b3b7a4a44072ull,
+    0x78e5c0cc4ee679cbull, 0x2172ffcc7dd05a82ull, 0x8e2443f7744608b8ull, 0x4c263a81e69035e0ull,
+};
+static u64 hash_seed = 0;
+
+static void derive_secret(u64 seed, u64* secret)
+{
+    for (i32 i = 0; i < 8; i += 2)
+    {
+        secret[i]     = hash_base_secret[i] + seed;
+        secret[i + 1] = hash_base_secret[i + 1] - seed;
+    }
+}
+
+void seed_hash(u64 seed)
+{
+    hash_seed = seed;
+    derive_secret(seed, hash_secret);
+}
+
+static inline u64 hash_read_64(const u8* p)
+{
+    u64 value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline u64 hash_read_32(const u8* p)
+{
+    u32 value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// Full 64x64 -> 128 bit multiply with the halves xor'ed together
+static inline u64 hash_mul_fold(u64 a, u64 b)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    u64 high;
+    u64 low = _umul128(a, b, &high);
+    return low ^ high;
+#elif defined(__SIZEOF_INT128__)
+    unsigned __int128 product = (unsigned __int128)a * b;
+    return (u64)product ^ (u64)(product >> 64);
+#else
+    u64 a_lo = a & 0xffffffff, a_hi = a >> 32;
+    u64 b_lo = b & 0xffffffff, b_hi = b >> 32;
+    u64 lo_lo = a_lo * b_lo;
+    u64 hi_lo = a_hi * b_lo;
+    u64 lo_hi = a_lo * b_hi;
+    u64 hi_hi = a_hi * b_hi;
+    u64 cross = (lo_lo >> 32) + (hi_lo & 0xffffffff) + lo_hi;
+    u64 high  = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    u64 low   = (cross << 32) | (lo_lo & 0xffffffff);
+    return low ^ high;
+#endif
+}
+
+static inline u64 hash_avalanche(u64 h)
+{
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ull;
+    h ^= h >> 32;
+    return h;
+}
+
+// Each 64 byte stripe feeds eight independent 64-bit lanes, so the bulk loop
+// has no serial dependency between words and maps directly onto SIMD lanes.
+static void hash_accumulate(u64* acc, const u8* p, size_t stripes, const u64* secret)
+{
+#ifdef SIMD_SSE2
+    __m128i* xacc = (__m128i*)acc;
+    for (size_t s = 0; s < stripes; s++)
+    {
+        const u8* stripe = p + s * HASH_STRIPE_SIZE;
+        for (i32 i = 0; i < 4; i++)
+        {
+            __m128i data    = _mm_loadu_si128((const __m128i*)(stripe + i * 16));
+            __m128i key     = _mm_xor_si128(data, _mm_loadu_si128((const __m128i*)(secret + i * 2)));
+            __m128i key_hi  = _mm_shuffle_epi32(key, _MM_SHUFFLE(0, 3, 0, 1));
+            __m128i product = _mm_mul_epu32(key, key_hi);
+            __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+            __m128i lanes   = _mm_loadu_si128(xacc + i);
+            lanes = _mm_add_epi64(lanes, swapped);
+            _mm_storeu_si128(xacc + i, _mm_add_epi64(lanes, product));
+        }
+    }
+#else
+    for (size_t s = 0; s < stripes; s++)
+    {
+        const u8* stripe = p + s * HASH_STRIPE_SIZE;
+        for (i32 i = 0; i < 8; i++)
+        {
+            u64 data = hash_read_64(stripe + i * 8);
+            u64 key  = data ^ secret[i];
+            acc[i ^ 1] += data;
+            acc[i]     += (key & 0xffffffff) * (key >> 32);
+        }
+    }
+#endif
+}
+
+static void hash_scramble(u64* acc, const u64* secret)
+{
+#ifdef SIMD_SSE2
+    __m128i* xacc  = (__m128i*)acc;
+    __m128i  prime = _mm_set1_epi32((i32)HASH_PRIME_32);
+    for (i32 i = 0; i < 4; i++)
+    {
+        __m128i lanes = _mm_loadu_si128(xacc + i);
+        lanes = _mm_xor_si128(lanes, _mm_srli_epi64(lanes, 47));
+        lanes = _mm_xor_si128(lanes, _mm_loadu_si128((const __m128i*)(secret + i * 2)));
+        __m128i product_lo = _mm_mul_epu32(lanes, prime);
+        __m128i product_hi = _mm_mul_epu32(_mm_shuffle_epi32(lanes, _MM_SHUFFLE(0, 3, 0, 1)), prime);
+        _mm_storeu_si128(xacc + i, _mm_add_epi64(product_lo, _mm_slli_epi64(product_hi, 32)));
+    }
+#else
+    for (i32 i = 0; i < 8; i++)
+    {
+        u64 lane = acc[i];
+        lane ^= lane >> 47;
+        lane ^= secret[i];
+        acc[i] = lane * HASH_PRIME_32;
+    }
+#endif
+}
+
+static u64 hash_bytes_with_secret(const u8* p, size_t length, u64 seed, const u64* secret)
+{
+    u64 h = length * HASH_PRIME_64 ^ seed;
+
+    if (length <= 16)
+    {
+        u64 a = 0;
+        u64 b = 0;
+        if (length >= 8)
+        {
+            a = hash_read_64(p);
+            b = hash_read_64(p + length - 8);
+        }
+        else if (length >= 4)
+        {
+            a = hash_read_32(p);
+            b = hash_read_32(p + length - 4);
+        }
+        else if (length > 0)
+        {
+            a = ((u64)p[0] << 16) | ((u64)p[length >> 1] << 8) | p[length - 1];
+        }
+        return hash_avalanche(h ^ hash_mul_fold(a ^ secret[0], b ^ secret[1] ^ h));
+    }
+
+    if (length < HASH_BULK_THRESHOLD)
+    {
+        // Overlapping 16 byte reads from both ends towards the middle
+        size_t rounds = (length - 1) / 32 + 1;
+        for (size_t i = 0; i < rounds; i++)
+        {
+            const u8* front = p + i * 16;
+            const u8* back  = p + length - (i + 1) * 16;
+            h += hash_mul_fold(hash_read_64(front) ^ secret[i * 2], hash_read_64(front + 8) ^ secret[i * 2 + 1] ^ seed);
+            h += hash_mul_fold(hash_read_64(back) ^ secret[7 - i * 2], hash_read_64(back + 8) ^ secret[6 - i * 2] ^ seed);
+        }
+        return hash_avalanche(h);
+    }
+
+    u64 acc[8] =
+    {
+        HASH_PRIME_32, HASH_PRIME_64, secret[2], secret[3],
+        secret[4], secret[5], HASH_PRIME_64 ^ seed, HASH_PRIME_32
+    };
+
+    size_t stripes = length / HASH_STRIPE_SIZE;
+    size_t block   = 0;
+    while (block + HASH_STRIPES_PER_SCRAMBLE <= stripes)
+    {
+        hash_accumulate(acc, p + block * HASH_STRIPE_SIZE, HASH_STRIPES_PER_SCRAMBLE, secret);
+        hash_scramble(acc, secret);
+        block += HASH_STRIPES_PER_SCRAMBLE;
+    }
+    hash_accumulate(acc, p + block * HASH_STRIPE_SIZE, stripes - block, secret);
+
+    // The last stripe always covers the final bytes, overlapping what came before
+    hash_accumulate(acc, p + length - HASH_STRIPE_SIZE, 1, secret);
+
+    for (i32 i = 0; i < 8; i += 2)
+    {
+        h += hash_mul_fold(acc[i] ^ secret[i], acc[i + 1] ^ secret[i + 1]);
+    }
+    return hash_avalanche(h);
+}
+
+u64 hash_bytes(const void* data, size_t length, u64 seed)
+{
+    if (seed == hash_seed)
+    {
+        return hash_bytes_with_secret((const u8*)data, length, seed, hash_secret);
+    }
+
+    u64 secret[8];
+    derive_secret(seed, secret);
+    return hash_bytes_with_secret((const u8*)data, length, seed, secret);
+}
+
+u32 hash_string(const char* key, i32 length)
+{
+    u64 h = hash_bytes_with_secret((const u8*)key, (size_t)length, hash_seed, hash_secret);
+    return (u32)(h ^ (h >> 32));
+}
+
+// For fixed size keys such as number bits and pointers
+u32 hash_u64(u64 value)
+{
+    u64 h = hash_mul_fold(value ^ hash_secret[0], HASH_PRIME_64 ^ hash_secret[1]);
+    return (u32)(h ^ (h >> 32));
+}
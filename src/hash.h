@@ -0,0 +1,32 @@
+#ifndef CLOX_HASH_H
+#define CLOX_HASH_H
+
+// =================================================================
+// API
+// =================================================================
+
+// Strings at least this long go through the striped accumulator
+#define HASH_BULK_THRESHOLD 128
+#define HASH_STRIPE_SIZE 64
+#define HASH_STRIPES_PER_SCRAMBLE 16
+
+// =================================================================
+// API Functions
+// =================================================================
+void seed_hash(u64 seed);
+u64 hash_bytes(const void* data, size_t length, u64 seed);
+u32 hash_string(const char* key, i32 length);
+u32 hash_u64(u64 value);
+// =================================================================
+
+// =================================================================
+// Internal Functions
+// =================================================================
+static inline u64 hash_read_64(const u8* p);
+static inline u64 hash_read_32(const u8* p);
+static inline u64 hash_mul_fold(u64 a, u64 b);
+static void hash_accumulate(u64* acc, const u8* p, size_t stripes, const u64* secret);
+static void hash_scramble(u64* acc, const u64* secret);
+// =================================================================
+
+#endif
@@ -3,11 +3,13 @@
 
 int main(int argc, const char* argv[])
 {
+#ifdef RANDOM_HASH_SEED
+    seed_hash((u64)time(NULL) ^ ((u64)clock() << 32) ^ (u64)(uintptr_t)&argc);
+#endif
+
     VM vm = {};
-    global_count = 0;
 
     init_vm(&vm);
-    init_parse_rules();
 
     if (argc == 1)
     {
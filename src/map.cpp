@@ -0,0 +1,191 @@
+// Keys that are values_equal must hash the same, so strings hash by content
+// (small strings, slices and interned strings can all be equal), vectors by
+// their components and -0 like +0. Every other object hashes by identity.
+u32 hash_value(Value value)
+{
+    if (IS_NUMBER(value))
+    {
+        f64 number = AS_NUMBER(value) + 0.0; // -0 + 0 is +0
+        u64 bits;
+        memcpy(&bits, &number, sizeof(bits));
+        return hash_u64(bits);
+    }
+
+    if (IS_STRING(value))
+    {
+        if (is_obj_type(value, OBJ_STRING)) return AS_STRING(value)->hash;
+
+        char buffer[SMALL_STRING_MAX + 1];
+        i32 length;
+        const char* chars = string_chars(value, buffer, &length);
+        return hash_string(chars, length);
+    }
+
+    if (IS_VECTOR(value))
+    {
+        ObjVector* vector = AS_VECTOR(value);
+        u32 hash = (u32)vector->count;
+        for (i32 i = 0; i < vector->count; i++)
+        {
+            f64 component = vector->components[i] + 0.0;
+            u64 bits;
+            memcpy(&bits, &component, sizeof(bits));
+            hash = hash * 31 + hash_u64(bits);
+        }
+        return hash;
+    }
+
+    if (IS_OBJ(value)) return hash_u64((u64)(uintptr_t)AS_OBJ(value));
+    if (IS_BOOL(value)) return hash_u64(AS_BOOL(value) ? 3 : 2);
+    return hash_u64(1);
+}
+
+void init_map(Map* map)
+{
+    map->count    = 0;
+    map->used     = 0;
+    map->capacity = 0;
+    map->entries  = NULL;
+    map->index    = NULL;
+}
+
+void free_map(GarbageCollector* gc, Map* map)
+{
+    FREE_ARRAY(gc, MapEntry, map->entries, map->capacity);
+    FREE_ARRAY(gc, i32, map->index, map->capacity * 2);
+    init_map(map);
+}
+
+// Returns the entry number of key, or -1 with slot set to the empty index slot it would go in
+static i32 map_find(Map* map, Value key, u32 hash, u32* slot)
+{
+    u32 mask = (u32)(map->capacity * 2 - 1);
+    u32 i = hash & mask;
+    for (;;)
+    {
+        i32 entry_index = map->index[i];
+        if (entry_index == -1)
+        {
+            *slot = i;
+            return -1;
+        }
+
+        MapEntry* entry = &map->entries[entry_index];
+        if (entry->live && entry->hash == hash && values_equal(entry->key, key))
+        {
+            *slot = i;
+            return entry_index;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+// Rebuilds the index and drops dead entries
+static void map_adjust_capacity(GarbageCollector* gc, Map* map, i32 capacity)
+{
+    MapEntry* entries = ALLOCATE(gc, MapEntry, capacity);
+    i32* index = ALLOCATE(gc, i32, capacity * 2);
+    for (i32 i = 0; i < capacity * 2; i++)
+    {
+        index[i] = -1;
+    }
+
+    u32 mask = (u32)(capacity * 2 - 1);
+    i32 count = 0;
+    for (i32 i = 0; i < map->used; i++)
+    {
+        MapEntry* entry = &map->entries[i];
+        if (!entry->live) continue;
+
+        u32 slot = entry->hash & mask;
+        while (index[slot] != -1)
+        {
+            slot = (slot + 1) & mask;
+        }
+        index[slot] = count;
+        entries[count++] = *entry;
+    }
+
+    FREE_ARRAY(gc, MapEntry, map->entries, map->capacity);
+    FREE_ARRAY(gc, i32, map->index, map->capacity * 2);
+
+    map->entries  = entries;
+    map->index    = index;
+    map->capacity = capacity;
+    map->count    = count;
+    map->used     = count;
+}
+
+b32 map_get(Map* map, Value key, Value* value)
+{
+    if (map->count == 0) return false;
+
+    u32 slot;
+    i32 entry_index = map_find(map, key, hash_value(key), &slot);
+    if (entry_index == -1) return false;
+
+    *value = map->entries[entry_index].value;
+    return true;
+}
+
+// Returns true if the key was not in the map yet
+b32 map_set(GarbageCollector* gc, Map* map, Value key, Value value)
+{
+    u32 hash = hash_value(key);
+    u32 slot;
+    if (map->capacity > 0)
+    {
+        i32 entry_index = map_find(map, key, hash, &slot);
+        if (entry_index != -1)
+        {
+            map->entries[entry_index].value = value;
+            return false;
+        }
+    }
+
+    if (map->used + 1 > map->capacity)
+    {
+        // Compact in place when at least half of the entries are dead
+        i32 capacity = map->count + 1 <= map->capacity / 2 ? map->capacity : GROW_CAPACITY(map->capacity);
+        map_adjust_capacity(gc, map, capacity);
+        map_find(map, key, hash, &slot);
+    }
+
+    MapEntry* entry = &map->entries[map->used];
+    entry->key   = key;
+    entry->value = value;
+    entry->hash  = hash;
+    entry->live  = true;
+    map->index[slot] = map->used;
+    map->used++;
+    map->count++;
+    return true;
+}
+
+// The index slot keeps pointing at the dead entry, so probe chains through it stay intact
+b32 map_delete(Map* map, Value key)
+{
+    if (map->count == 0) return false;
+
+    u32 slot;
+    i32 entry_index = map_find(map, key, hash_value(key), &slot);
+    if (entry_index == -1) return false;
+
+    MapEntry* entry = &map->entries[entry_index];
+    entry->live  = false;
+    entry->key   = nil_val();
+    entry->value = nil_val();
+    map->count--;
+    return true;
+}
+
+void mark_map(GarbageCollector* gc, Map* map)
+{
+    for (i32 i = 0; i < map->used; i++)
+    {
+        MapEntry* entry = &map->entries[i];
+        if (!entry->live) continue;
+        mark_value(gc, entry->key);
+        mark_value(gc, entry->value);
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef CLOX_MAP_H
+#define CLOX_MAP_H
+
+// =================================================================
+// API
+// =================================================================
+
+// =================================================================
+// Types
+// =================================================================
+struct MapEntry
+{
+    Value key;
+    Value value;
+    u32 hash;
+    b32 live;
+};
+
+// A hash map keyed by any Value, using values_equal for key equality. Like Table,
+// entries are dense and in insertion order with a separate index of entry numbers.
+// A removed entry stays in place, dead, until the next resize compacts it away.
+struct Map
+{
+    i32 count;
+    i32 used;
+    i32 capacity;
+    MapEntry* entries;
+
+    // Linear probing, -1 when empty. Always twice the entry capacity.
+    i32* index;
+};
+// =================================================================
+
+// =================================================================
+// API Functions
+// =================================================================
+void init_map(Map* map);
+void free_map(GarbageCollector* gc, Map* map);
+b32  map_get(Map* map, Value key, Value* value);
+b32  map_set(GarbageCollector* gc, Map* map, Value key, Value value);
+b32  map_delete(Map* map, Value key);
+void mark_map(GarbageCollector* gc, Map* map);
+u32  hash_value(Value value);
+// =================================================================
+
+// =================================================================
+// Internal Functions
+// =================================================================
+static i32 map_find(Map* map, Value key, u32 hash, u32* slot);
+static void map_adjust_capacity(GarbageCollector* gc, Map* map, i32 capacity);
+// =================================================================
+
+#endif
@@ -3,7 +3,9 @@
 void* reallocate(GarbageCollector* gc, void* pointer, size_t old_size, size_t new_size)
 {
     gc->bytes_allocated += new_size - old_size;
-    if (new_size > old_size)
+
+    // A staging heap has no VM and so no roots, it is never collected
+    if (new_size > old_size && gc->vm != NULL)
     {
 #ifdef DEBUG_STRESS_GC
         collect_garbage(gc);
@@ -70,6 +72,11 @@ static void blacken_object(GarbageCollector* gc, Obj* object)
 #endif
     switch(object->type)
     {
+        case OBJ_ARRAY:
+        {
+            mark_array(gc, &((ObjArray*)object)->values);
+        }
+        break;
         case OBJ_BOUND_METHOD:
         {
             ObjBoundMethod* bound = (ObjBoundMethod*)object;
@@ -108,13 +115,26 @@ static void blacken_object(GarbageCollector* gc, Obj* object)
             mark_table(gc, &instance->fields);
         }
         break;
+        case OBJ_MAP:
+        {
+            mark_map(gc, &((ObjMap*)object)->map);
+        }
+        break;
         case OBJ_UPVALUE:
         {
             mark_value(gc, ((ObjUpvalue*)object)->closed);
         }
         break;
+        case OBJ_SLICE:
+        {
+            mark_object(gc, (Obj*)((ObjSlice*)object)->parent);
+        }
+        break;
+        case OBJ_FLOAT64_ARRAY:
         case OBJ_NATIVE:
+        case OBJ_RANGE:
         case OBJ_STRING:
+        case OBJ_VECTOR:
         break;
     }
 }
@@ -138,6 +158,12 @@ static void mark_roots(VM* vm)
     }
 
     mark_table(&vm->gc, &vm->globals);
+    mark_table(&vm->gc, &vm->modules);
+    for (i32 i = 0; i < vm->global_scope.count; i++)
+    {
+        mark_object(&vm->gc, (Obj*)vm->global_scope.globals[i].name);
+        if (vm->global_scope.globals[i].has_value) mark_value(&vm->gc, vm->global_scope.globals[i].value);
+    }
 
     mark_object(&vm->gc, (Obj*)vm->init_string);
     mark_compiler_roots(&vm->gc);
@@ -192,6 +218,10 @@ void collect_garbage(GarbageCollector* gc)
     table_remove_white(&gc->vm->strings);
     sweep(gc, &gc->vm->store);
 
+#ifdef DEBUG_TABLE_STATS
+    print_table_stats(&gc->vm->strings, "strings");
+#endif
+
     gc->next_gc = gc->bytes_allocated * GC_HEAP_GROW_FACTOR;
 
 #ifdef DEBUG_LOG_GC
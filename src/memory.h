@@ -15,6 +15,13 @@ struct GarbageCollector
 
     size_t bytes_allocated;
     size_t next_gc;
+
+    // Recycled vector objects, see new_vector
+    struct ObjVector* free_vectors;
+    struct VectorBlock* vector_blocks;
+
+    // The compile running on this heap, its functions are roots until it finishes
+    struct Parser* parser;
 };
 
 // =================================================================
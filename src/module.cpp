@@ -0,0 +1,325 @@
+// Compiles everything the script at importer_path imports, directly or not, then
+// merges the results into the VM and runs the modules in dependency order, each
+// one once. Modules are found a wave at a time: the imports of one wave are only
+// known once it is compiled, and every module in the next wave compiles in
+// parallel. The caller keeps the importing script rooted and runs it afterwards.
+InterpretResult import_modules(VM* vm, const char* importer_path, ImportList* imports)
+{
+    ModuleGraph graph = {};
+    Module* importer = (Module*)calloc(1, sizeof(Module));
+    if (importer_path != NULL)
+    {
+        importer->path = resolve_module_path(NULL, importer_path, (i32)strlen(importer_path));
+    }
+    graph.capacity = GROW_CAPACITY(0);
+    graph.modules  = (Module**)malloc(sizeof(Module*) * graph.capacity);
+    graph.modules[graph.count++] = importer;
+
+    importer->imports = *imports;
+    b32 ok = add_dependencies(vm, &graph, importer);
+    importer->imports = {}; // The caller owns those
+
+    for (i32 start = 1; ok && start < graph.count;)
+    {
+        i32 end = graph.count;
+        compile_wave(&graph, start, end);
+
+        for (i32 i = start; i < end; i++)
+        {
+            Module* module = graph.modules[i];
+            if (module->failed)
+            {
+                fprintf(stderr, "Could not compile module \"%s\".\n", module->path);
+                ok = false;
+                continue;
+            }
+
+            if (!add_dependencies(vm, &graph, module)) ok = false;
+
+            // Nothing points into the source any more once the imports are resolved
+            FREE_ARRAY(&module->gc, Token, module->imports.paths, module->imports.capacity);
+            module->imports = {};
+            free(module->source);
+            module->source = NULL;
+        }
+        start = end;
+    }
+
+    for (i32 i = 1; ok && i < graph.count; i++)
+    {
+        merge_module(vm, graph.modules[i]);
+    }
+
+    InterpretResult result = ok ? run_module(vm, &graph, 0) : INTERPRET_COMPILE_ERROR;
+
+    for (i32 i = 0; i < graph.count; i++)
+    {
+        free_module(graph.modules[i]);
+    }
+    free(graph.modules);
+    return result;
+}
+
+// Joins path onto the directory of importer_path, or the working directory when
+// it is NULL, and makes it absolute. Returns NULL when there is no such file.
+static char* resolve_module_path(const char* importer_path, const char* path, i32 length)
+{
+    char joined[MODULE_PATH_MAX];
+    i32 directory_length = 0;
+    if (importer_path != NULL && path[0] != '/')
+    {
+        const char* slash = strrchr(importer_path, '/');
+#ifdef _WIN32
+        const char* backslash = strrchr(importer_path, '\\');
+        if (backslash > slash) slash = backslash;
+#endif
+        if (slash != NULL) directory_length = (i32)(slash - importer_path + 1);
+    }
+    if (directory_length + length >= MODULE_PATH_MAX) return NULL;
+
+    if (directory_length > 0) memcpy(joined, importer_path, directory_length);
+    memcpy(joined + directory_length, path, length);
+    joined[directory_length + length] = '\0';
+
+#ifdef _WIN32
+    char* resolved = _fullpath(NULL, joined, 0);
+#else
+    char* resolved = realpath(joined, NULL);
+#endif
+    if (resolved == NULL) return NULL;
+
+    FILE* file = fopen(resolved, "rb");
+    if (file == NULL)
+    {
+        free(resolved);
+        return NULL;
+    }
+    fclose(file);
+    return resolved;
+}
+
+// Returns the index of the module at path, adding it when it is new, or -1 when
+// the VM has already run it. Takes ownership of path.
+static i32 add_module(VM* vm, ModuleGraph* graph, char* path)
+{
+    for (i32 i = 0; i < graph->count; i++)
+    {
+        if (graph->modules[i]->path != NULL && strcmp(graph->modules[i]->path, path) == 0)
+        {
+            free(path);
+            return i;
+        }
+    }
+
+    i32 length = (i32)strlen(path);
+    ObjString* name = table_find_string(&vm->strings, path, length, hash_string(path, length));
+    Value loaded;
+    if (name != NULL && table_get(&vm->modules, name, &loaded))
+    {
+        free(path);
+        return -1;
+    }
+
+    if (graph->capacity < graph->count + 1)
+    {
+        graph->capacity = GROW_CAPACITY(graph->capacity);
+        graph->modules  = (Module**)realloc(graph->modules, sizeof(Module*) * graph->capacity);
+    }
+
+    Module* module = (Module*)calloc(1, sizeof(Module));
+    module->path = path;
+    init_table(&module->strings);
+    copy_global_scope(&module->globals, &vm->global_scope);
+    module->inherited_globals = vm->global_scope.count;
+
+    graph->modules[graph->count++] = module;
+    return graph->count - 1;
+}
+
+// Resolves the import statements of a compiled module. Returns false after
+// reporting the imports that name no file.
+static b32 add_dependencies(VM* vm, ModuleGraph* graph, Module* module)
+{
+    ImportList* imports = &module->imports;
+    if (imports->count == 0) return true;
+
+    b32 found = true;
+    module->dependencies = (i32*)malloc(sizeof(i32) * imports->count);
+    for (i32 i = 0; i < imports->count; i++)
+    {
+        Token* token = &imports->paths[i];
+        char* path = resolve_module_path(module->path, token->start + 1, token->length - 2);
+        if (path == NULL)
+        {
+            fprintf(stderr, "[line %d] Could not find module \"%.*s\".\n", token->line, token->length - 2, token->start + 1);
+            found = false;
+            continue;
+        }
+
+        i32 index = add_module(vm, graph, path);
+        if (index != -1) module->dependencies[module->dependency_count++] = index;
+    }
+    return found;
+}
+
+// Runs on a worker. Only touches the module itself, besides reading the
+// globals of the VM that add_module copied.
+static void compile_module(Module* module)
+{
+    module->source   = read_file(module->path);
+    module->function = compile(&module->gc, module->source, &module->store, &module->strings,
+                               &module->globals, &module->imports, false);
+    module->failed   = module->function == NULL;
+}
+
+static void compile_worker(CompileWave* wave)
+{
+    for (;;)
+    {
+        i32 index = wave->next++;
+        if (index >= wave->end) return;
+
+        compile_module(wave->graph->modules[index]);
+    }
+}
+
+// The calling thread works on the wave too, so a single module needs no thread
+static void compile_wave(ModuleGraph* graph, i32 start, i32 end)
+{
+    CompileWave wave;
+    wave.graph = graph;
+    wave.next  = start;
+    wave.end   = end;
+
+    i32 thread_count = (i32)std::thread::hardware_concurrency();
+    if (thread_count > end - start) thread_count = end - start;
+    if (thread_count > MODULE_WORKERS_MAX) thread_count = MODULE_WORKERS_MAX;
+
+    std::thread workers[MODULE_WORKERS_MAX];
+    for (i32 i = 1; i < thread_count; i++)
+    {
+        workers[i] = std::thread(compile_worker, &wave);
+    }
+
+    compile_worker(&wave);
+
+    for (i32 i = 1; i < thread_count; i++)
+    {
+        workers[i].join();
+    }
+}
+
+// Moves the functions of a compiled module into the VM's store and points them
+// at strings interned in the VM. The staged strings are freed with the staging
+// heap, so nothing is copied but the characters of strings the VM did not have.
+static void merge_module(VM* vm, Module* module)
+{
+    // Functions go first and unmarked, so once the script is rooted a collection
+    // traces them like any other object
+    i32 function_count = 0;
+    for (Obj* object = module->store.objects; object != NULL; object = object->next)
+    {
+        if (object->type == OBJ_FUNCTION) function_count++;
+    }
+    ObjFunction** functions = (ObjFunction**)malloc(sizeof(ObjFunction*) * function_count);
+
+    Obj* staged_strings = NULL;
+    Obj* object = module->store.objects;
+    function_count = 0;
+    while (object != NULL)
+    {
+        Obj* next = object->next;
+        if (object->type == OBJ_FUNCTION)
+        {
+            object->is_marked = false;
+            object->next = vm->store.objects;
+            vm->store.objects = object;
+            functions[function_count++] = (ObjFunction*)object;
+        }
+        else
+        {
+            object->next = staged_strings;
+            staged_strings = object;
+        }
+        object = next;
+    }
+    module->store.objects = staged_strings;
+
+    push(vm, OBJ_VAL(module->function));
+    ObjString* path = copy_string(&vm->gc, &vm->store, &vm->strings, module->path, (i32)strlen(module->path));
+    push(vm, OBJ_VAL(path));
+    table_set(&vm->gc, &vm->modules, path, OBJ_VAL(module->function));
+    pop(vm);
+    pop(vm);
+
+    for (i32 i = 0; i < function_count; i++)
+    {
+        ObjFunction* function = functions[i];
+        if (function->name != NULL)
+        {
+            function->name = copy_string(&vm->gc, &vm->store, &vm->strings, function->name->chars, function->name->length);
+        }
+
+        ValueArray* constants = &function->chunk.constants;
+        for (i32 j = 0; j < constants->count; j++)
+        {
+            if (!is_obj_type(constants->values[j], OBJ_STRING)) continue;
+
+            ObjString* string = AS_STRING(constants->values[j]);
+            constants->values[j] = OBJ_VAL(copy_string(&vm->gc, &vm->store, &vm->strings, string->chars, string->length));
+        }
+    }
+    free(functions);
+
+    for (i32 i = module->inherited_globals; i < module->globals.count; i++)
+    {
+        ObjString* name = module->globals.globals[i].name;
+        name = copy_string(&vm->gc, &vm->store, &vm->strings, name->chars, name->length);
+
+        if (find_global(&vm->global_scope, name->chars, name->length, name->hash) != -1) continue;
+
+        Global* global = push_global(&vm->global_scope, name);
+        *global = module->globals.globals[i];
+        global->name = name;
+        if (global->has_value && is_obj_type(global->value, OBJ_STRING))
+        {
+            ObjString* string = AS_STRING(global->value);
+            global->value = OBJ_VAL(copy_string(&vm->gc, &vm->store, &vm->strings, string->chars, string->length));
+        }
+    }
+
+    free_objects(&module->store, &module->gc);
+    free_table(&module->gc, &module->strings);
+
+    // The merged functions are the VM's to free now
+    vm->gc.bytes_allocated += module->gc.bytes_allocated;
+    module->gc.bytes_allocated = 0;
+}
+
+static InterpretResult run_module(VM* vm, ModuleGraph* graph, i32 index)
+{
+    Module* module = graph->modules[index];
+    if (module->visited) return INTERPRET_OK;
+    module->visited = true;
+
+    for (i32 i = 0; i < module->dependency_count; i++)
+    {
+        InterpretResult result = run_module(vm, graph, module->dependencies[i]);
+        if (result != INTERPRET_OK) return result;
+    }
+
+    if (module->function == NULL) return INTERPRET_OK;
+    return run_script(vm, module->function);
+}
+
+static void free_module(Module* module)
+{
+    free_objects(&module->store, &module->gc);
+    free_table(&module->gc, &module->strings);
+    FREE_ARRAY(&module->gc, Token, module->imports.paths, module->imports.capacity);
+    free_global_scope(&module->globals);
+    free(module->dependencies);
+    free(module->source);
+    free(module->path);
+    free(module);
+}
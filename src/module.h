@@ -0,0 +1,77 @@
+#ifndef CLOX_MODULE_H
+#define CLOX_MODULE_H
+
+// =================================================================
+// API
+// =================================================================
+
+// Most threads a wave of modules is compiled on, the calling thread included
+#define MODULE_WORKERS_MAX 64
+#define MODULE_PATH_MAX 1024
+
+// =================================================================
+// Types
+// =================================================================
+
+// A script file found through import statements. It is compiled on a worker
+// into a staging heap of its own, a GarbageCollector without a VM that never
+// collects, and nothing else touches it until merge_module moves the result
+// into the VM.
+struct Module
+{
+    char* path; // Absolute, so every spelling of a path loads the module once
+    char* source;
+    ObjFunction* function;
+
+    GarbageCollector gc;
+    ObjectStore store;
+    Table strings;
+    GlobalScope globals;
+    i32 inherited_globals; // globals below this were copied from the VM
+
+    ImportList imports;
+    i32* dependencies; // Indices into the graph, in import order
+    i32 dependency_count;
+
+    b32 failed;
+    b32 visited;
+};
+
+// Module 0 is the script doing the imports. It is already compiled in the VM
+// and has no function here, its caller runs it.
+struct ModuleGraph
+{
+    Module** modules;
+    i32 count;
+    i32 capacity;
+};
+
+struct CompileWave
+{
+    ModuleGraph* graph;
+    std::atomic<i32> next;
+    i32 end;
+};
+// =================================================================
+
+// =================================================================
+// API Functions
+// =================================================================
+InterpretResult import_modules(VM* vm, const char* importer_path, ImportList* imports);
+// =================================================================
+
+// =================================================================
+// Internal Functions
+// =================================================================
+static char* resolve_module_path(const char* importer_path, const char* path, i32 length);
+static i32   add_module(VM* vm, ModuleGraph* graph, char* path);
+static b32   add_dependencies(VM* vm, ModuleGraph* graph, Module* module);
+static void  compile_module(Module* module);
+static void  compile_worker(CompileWave* wave);
+static void  compile_wave(ModuleGraph* graph, i32 start, i32 end);
+static void  merge_module(VM* vm, Module* module);
+static InterpretResult run_module(VM* vm, ModuleGraph* graph, i32 index);
+static void  free_module(Module* module);
+// =================================================================
+
+#endif
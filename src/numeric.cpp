@@ -0,0 +1,422 @@
+#ifdef SIMD_SSE2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// MSVC exposes every intrinsic regardless of /arch, GCC and Clang need the
+// target attribute to emit VEX encodings in an otherwise SSE2 build.
+#if defined(__GNUC__) && !defined(__AVX__)
+#define NUMERIC_AVX_TARGET __attribute__((target("avx")))
+#else
+#define NUMERIC_AVX_TARGET
+#endif
+#endif
+
+// =================================================================
+// Scalar
+// =================================================================
+static f64 sum_scalar(const f64* a, i32 n)
+{
+    f64 s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    i32 i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        s0 += a[i];
+        s1 += a[i + 1];
+        s2 += a[i + 2];
+        s3 += a[i + 3];
+    }
+    for (; i < n; i++) s0 += a[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+static f64 dot_scalar(const f64* a, const f64* b, i32 n)
+{
+    f64 s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    i32 i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; i++) s0 += a[i] * b[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+// Any NaN makes min and max NaN, whatever its position and the width of the kernel
+static f64 min_scalar(const f64* a, i32 n)
+{
+    f64 result = INFINITY;
+    for (i32 i = 0; i < n; i++)
+    {
+        if (a[i] != a[i]) return NAN;
+        if (a[i] < result) result = a[i];
+    }
+    return result;
+}
+
+static f64 max_scalar(const f64* a, i32 n)
+{
+    f64 result = -INFINITY;
+    for (i32 i = 0; i < n; i++)
+    {
+        if (a[i] != a[i]) return NAN;
+        if (a[i] > result) result = a[i];
+    }
+    return result;
+}
+
+static void scale_scalar(f64* a, f64 k, i32 n)
+{
+    for (i32 i = 0; i < n; i++) a[i] *= k;
+}
+
+static void axpy_scalar(f64 alpha, const f64* x, f64* y, i32 n)
+{
+    for (i32 i = 0; i < n; i++) y[i] += alpha * x[i];
+}
+
+static void add_scalar(const f64* a, const f64* b, f64* out, i32 n)
+{
+    for (i32 i = 0; i < n; i++) out[i] = a[i] + b[i];
+}
+
+static void mul_scalar(const f64* a, const f64* b, f64* out, i32 n)
+{
+    for (i32 i = 0; i < n; i++) out[i] = a[i] * b[i];
+}
+
+#ifdef SIMD_SSE2
+// =================================================================
+// SSE2, two lanes with two accumulators to hide the add latency
+// =================================================================
+static inline f64 horizontal_add_sse2(__m128d v)
+{
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+static f64 sum_sse2(const f64* a, i32 n)
+{
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    i32 i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(a + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(a + i + 2));
+    }
+    f64 result = horizontal_add_sse2(_mm_add_pd(acc0, acc1));
+    for (; i < n; i++) result += a[i];
+    return result;
+}
+
+static f64 dot_sse2(const f64* a, const f64* b, i32 n)
+{
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    i32 i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+    f64 result = horizontal_add_sse2(_mm_add_pd(acc0, acc1));
+    for (; i < n; i++) result += a[i] * b[i];
+    return result;
+}
+
+static f64 min_sse2(const f64* a, i32 n)
+{
+    // _mm_min_pd drops a NaN in its first operand, so NaNs are tracked on the side
+    __m128d acc = _mm_set1_pd(INFINITY);
+    __m128d nan = _mm_setzero_pd();
+    i32 i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128d x = _mm_loadu_pd(a + i);
+        acc = _mm_min_pd(acc, x);
+        nan = _mm_or_pd(nan, _mm_cmpunord_pd(x, x));
+    }
+    if (_mm_movemask_pd(nan)) return NAN;
+
+    acc = _mm_min_sd(acc, _mm_unpackhi_pd(acc, acc));
+    f64 result = _mm_cvtsd_f64(acc);
+    for (; i < n; i++)
+    {
+        if (a[i] != a[i]) return NAN;
+        if (a[i] < result) result = a[i];
+    }
+    return result;
+}
+
+static f64 max_sse2(const f64* a, i32 n)
+{
+    // _mm_max_pd drops a NaN in its first operand, so NaNs are tracked on the side
+    __m128d acc = _mm_set1_pd(-INFINITY);
+    __m128d nan = _mm_setzero_pd();
+    i32 i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128d x = _mm_loadu_pd(a + i);
+        acc = _mm_max_pd(acc, x);
+        nan = _mm_or_pd(nan, _mm_cmpunord_pd(x, x));
+    }
+    if (_mm_movemask_pd(nan)) return NAN;
+
+    acc = _mm_max_sd(acc, _mm_unpackhi_pd(acc, acc));
+    f64 result = _mm_cvtsd_f64(acc);
+    for (; i < n; i++)
+    {
+        if (a[i] != a[i]) return NAN;
+        if (a[i] > result) result = a[i];
+    }
+    return result;
+}
+
+static void scale_sse2(f64* a, f64 k, i32 n)
+{
+    __m128d factor = _mm_set1_pd(k);
+    i32 i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        _mm_storeu_pd(a + i, _mm_mul_pd(_mm_loadu_pd(a + i), factor));
+    }
+    for (; i < n; i++) a[i] *= k;
+}
+
+static void axpy_sse2(f64 alpha, const f64* x, f64* y, i32 n)
+{
+    __m128d factor = _mm_set1_pd(alpha);
+    i32 i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128d product = _mm_mul_pd(_mm_loadu_pd(x + i), factor);
+        _mm_storeu_pd(y + i, _mm_add_pd(_mm_loadu_pd(y + i), product));
+    }
+    for (; i < n; i++) y[i] += alpha * x[i];
+}
+
+static void add_sse2(const f64* a, const f64* b, f64* out, i32 n)
+{
+    i32 i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    }
+    for (; i < n; i++) out[i] = a[i] + b[i];
+}
+
+static void mul_sse2(const f64* a, const f64* b, f64* out, i32 n)
+{
+    i32 i = 0;
+    for (; i + 2 <= n; i += 2)
+    {
+        _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    }
+    for (; i < n; i++) out[i] = a[i] * b[i];
+}
+
+// =================================================================
+// AVX, four lanes with two accumulators
+// =================================================================
+NUMERIC_AVX_TARGET static inline f64 horizontal_add_avx(__m256d v)
+{
+    __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+}
+
+NUMERIC_AVX_TARGET static f64 sum_avx(const f64* a, i32 n)
+{
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    i32 i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(a + i));
+        acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(a + i + 4));
+    }
+    f64 result = horizontal_add_avx(_mm256_add_pd(acc0, acc1));
+    for (; i < n; i++) result += a[i];
+    return result;
+}
+
+NUMERIC_AVX_TARGET static f64 dot_avx(const f64* a, const f64* b, i32 n)
+{
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    i32 i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+    }
+    f64 result = horizontal_add_avx(_mm256_add_pd(acc0, acc1));
+    for (; i < n; i++) result += a[i] * b[i];
+    return result;
+}
+
+NUMERIC_AVX_TARGET static f64 min_avx(const f64* a, i32 n)
+{
+    __m256d acc = _mm256_set1_pd(INFINITY);
+    __m256d nan = _mm256_setzero_pd();
+    i32 i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256d x = _mm256_loadu_pd(a + i);
+        acc = _mm256_min_pd(acc, x);
+        nan = _mm256_or_pd(nan, _mm256_cmp_pd(x, x, _CMP_UNORD_Q));
+    }
+    if (_mm256_movemask_pd(nan)) return NAN;
+
+    __m128d half = _mm_min_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+    half = _mm_min_sd(half, _mm_unpackhi_pd(half, half));
+    f64 result = _mm_cvtsd_f64(half);
+    for (; i < n; i++)
+    {
+        if (a[i] != a[i]) return NAN;
+        if (a[i] < result) result = a[i];
+    }
+    return result;
+}
+
+NUMERIC_AVX_TARGET static f64 max_avx(const f64* a, i32 n)
+{
+    __m256d acc = _mm256_set1_pd(-INFINITY);
+    __m256d nan = _mm256_setzero_pd();
+    i32 i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256d x = _mm256_loadu_pd(a + i);
+        acc = _mm256_max_pd(acc, x);
+        nan = _mm256_or_pd(nan, _mm256_cmp_pd(x, x, _CMP_UNORD_Q));
+    }
+    if (_mm256_movemask_pd(nan)) return NAN;
+
+    __m128d half = _mm_max_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+    half = _mm_max_sd(half, _mm_unpackhi_pd(half, half));
+    f64 result = _mm_cvtsd_f64(half);
+    for (; i < n; i++)
+    {
+        if (a[i] != a[i]) return NAN;
+        if (a[i] > result) result = a[i];
+    }
+    return result;
+}
+
+NUMERIC_AVX_TARGET static void scale_avx(f64* a, f64 k, i32 n)
+{
+    __m256d factor = _mm256_set1_pd(k);
+    i32 i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        _mm256_storeu_pd(a + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), factor));
+    }
+    for (; i < n; i++) a[i] *= k;
+}
+
+NUMERIC_AVX_TARGET static void axpy_avx(f64 alpha, const f64* x, f64* y, i32 n)
+{
+    __m256d factor = _mm256_set1_pd(alpha);
+    i32 i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256d product = _mm256_mul_pd(_mm256_loadu_pd(x + i), factor);
+        _mm256_storeu_pd(y + i, _mm256_add_pd(_mm256_loadu_pd(y + i), product));
+    }
+    for (; i < n; i++) y[i] += alpha * x[i];
+}
+
+NUMERIC_AVX_TARGET static void add_avx(const f64* a, const f64* b, f64* out, i32 n)
+{
+    i32 i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    for (; i < n; i++) out[i] = a[i] + b[i];
+}
+
+NUMERIC_AVX_TARGET static void mul_avx(const f64* a, const f64* b, f64* out, i32 n)
+{
+    i32 i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    for (; i < n; i++) out[i] = a[i] * b[i];
+}
+#endif
+
+// =================================================================
+// Dispatch
+// =================================================================
+
+// AVX needs both the instructions and an OS that saves the YMM registers on context switch
+SimdLevel detect_simd_level()
+{
+#ifdef SIMD_SSE2
+#if defined(_MSC_VER)
+    i32 info[4];
+    __cpuid(info, 1);
+    b32 has_osxsave = (info[2] & (1 << 27)) != 0;
+    b32 has_avx     = (info[2] & (1 << 28)) != 0;
+    if (has_osxsave && has_avx && (_xgetbv(0) & 0x6) == 0x6) return SIMD_LEVEL_AVX;
+#elif defined(__GNUC__)
+    if (__builtin_cpu_supports("avx")) return SIMD_LEVEL_AVX;
+#endif
+    return SIMD_LEVEL_SSE2;
+#else
+    return SIMD_LEVEL_SCALAR;
+#endif
+}
+
+// Levels the build can't provide fall back to the best one it can
+void select_numeric_kernels(SimdLevel level)
+{
+    numeric.level = SIMD_LEVEL_SCALAR;
+    numeric.sum   = sum_scalar;
+    numeric.dot   = dot_scalar;
+    numeric.min   = min_scalar;
+    numeric.max   = max_scalar;
+    numeric.scale = scale_scalar;
+    numeric.axpy  = axpy_scalar;
+    numeric.add   = add_scalar;
+    numeric.mul   = mul_scalar;
+
+#ifdef SIMD_SSE2
+    if (level == SIMD_LEVEL_SSE2)
+    {
+        numeric.level = SIMD_LEVEL_SSE2;
+        numeric.sum   = sum_sse2;
+        numeric.dot   = dot_sse2;
+        numeric.min   = min_sse2;
+        numeric.max   = max_sse2;
+        numeric.scale = scale_sse2;
+        numeric.axpy  = axpy_sse2;
+        numeric.add   = add_sse2;
+        numeric.mul   = mul_sse2;
+    }
+    else if (level == SIMD_LEVEL_AVX)
+    {
+        numeric.level = SIMD_LEVEL_AVX;
+        numeric.sum   = sum_avx;
+        numeric.dot   = dot_avx;
+        numeric.min   = min_avx;
+        numeric.max   = max_avx;
+        numeric.scale = scale_avx;
+        numeric.axpy  = axpy_avx;
+        numeric.add   = add_avx;
+        numeric.mul   = mul_avx;
+    }
+#endif
+}
+
+// Every VM calls this, possibly from several threads, so the kernels are picked once
+void init_numeric()
+{
+    static const b32 selected = (select_numeric_kernels(detect_simd_level()), true);
+    (void)selected;
+}
@@ -0,0 +1,44 @@
+#ifndef CLOX_NUMERIC_H
+#define CLOX_NUMERIC_H
+
+// =================================================================
+// API
+// =================================================================
+
+// =================================================================
+// Types
+// =================================================================
+enum SimdLevel
+{
+    SIMD_LEVEL_SCALAR,
+    SIMD_LEVEL_SSE2,
+    SIMD_LEVEL_AVX
+};
+
+// Bulk kernels over raw f64 buffers. Reductions over n == 0 return 0 for
+// sum and dot, +inf for min and -inf for max.
+struct NumericKernels
+{
+    SimdLevel level;
+    f64  (*sum)(const f64* a, i32 n);
+    f64  (*dot)(const f64* a, const f64* b, i32 n);
+    f64  (*min)(const f64* a, i32 n);
+    f64  (*max)(const f64* a, i32 n);
+    void (*scale)(f64* a, f64 k, i32 n);
+    void (*axpy)(f64 alpha, const f64* x, f64* y, i32 n);
+    void (*add)(const f64* a, const f64* b, f64* out, i32 n);
+    void (*mul)(const f64* a, const f64* b, f64* out, i32 n);
+};
+
+NumericKernels numeric;
+// =================================================================
+
+// =================================================================
+// API Functions
+// =================================================================
+SimdLevel detect_simd_level();
+void      select_numeric_kernels(SimdLevel level);
+void      init_numeric();
+// =================================================================
+
+#endif
@@ -3,6 +3,11 @@ static inline b32 is_obj_type(Value value, ObjType type)
     return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
 
+static inline b32 is_string(Value value)
+{
+    return IS_SMALL_STRING(value) || is_obj_type(value, OBJ_STRING) || is_obj_type(value, OBJ_SLICE);
+}
+
 static Obj* allocate_object(GarbageCollector* gc, ObjectStore* store, size_t size, ObjType type)
 {
     Obj* object = (Obj*)reallocate(gc, NULL, 0, size);
@@ -31,8 +36,18 @@ ObjFunction* new_function(GarbageCollector* gc, ObjectStore* store)
     ObjFunction* function = ALLOCATE_OBJ(gc, ObjFunction, OBJ_FUNCTION);
     function->arity = 0;
     function->upvalue_count = 0;
+    function->slot_count = 0;
     function->name = NULL;
+    function->image = NULL;
+    function->image_index = 0;
+    function->lazy_source = NULL;
+    function->lazy_line = 0;
+    function->lazy_type = 0;
+    function->call_count = 0;
+    function->switch_maps = NULL;
+    function->switch_map_count = 0;
     init_chunk(&function->chunk);
+    init_chunk(&function->baseline);
     return function;
 }
 
@@ -66,6 +81,122 @@ ObjClosure* new_closure(GarbageCollector* gc, ObjFunction* function, ObjectStore
     return closure;
 }
 
+ObjArray* new_array(GarbageCollector* gc, ObjectStore* store)
+{
+    ObjArray* array = ALLOCATE_OBJ(gc, ObjArray, OBJ_ARRAY);
+    init_value_array(&array->values);
+    return array;
+}
+
+// The elements start out as zero
+ObjFloat64Array* new_float64_array(GarbageCollector* gc, ObjectStore* store, i32 count)
+{
+    // The buffer is allocated first so a collection can't see a half built array
+    f64* values = ALLOCATE(gc, f64, count);
+    if (count > 0) memset(values, 0, sizeof(f64) * count);
+
+    ObjFloat64Array* array = ALLOCATE_OBJ(gc, ObjFloat64Array, OBJ_FLOAT64_ARRAY);
+    array->count  = count;
+    array->values = values;
+    return array;
+}
+
+ObjMap* new_map(GarbageCollector* gc, ObjectStore* store)
+{
+    ObjMap* map = ALLOCATE_OBJ(gc, ObjMap, OBJ_MAP);
+    init_map(&map->map);
+    return map;
+}
+
+ObjRange* new_range(GarbageCollector* gc, ObjectStore* store, f64 start, f64 end)
+{
+    ObjRange* range = ALLOCATE_OBJ(gc, ObjRange, OBJ_RANGE);
+    range->start = start;
+    range->end   = end;
+    return range;
+}
+
+// Vectors are accounted like any other allocation so they still drive collections,
+// but the memory itself comes from blocks that are only released by free_vector_pool.
+ObjVector* new_vector(GarbageCollector* gc, ObjectStore* store, i32 count, const f64* components)
+{
+    gc->bytes_allocated += sizeof(ObjVector);
+#ifdef DEBUG_STRESS_GC
+    collect_garbage(gc);
+#endif
+    if (gc->bytes_allocated > gc->next_gc)
+    {
+        collect_garbage(gc);
+    }
+
+    if (gc->free_vectors == NULL)
+    {
+        VectorBlock* block = (VectorBlock*)malloc(sizeof(VectorBlock));
+        if (block == NULL) exit(1);
+        block->next = gc->vector_blocks;
+        gc->vector_blocks = block;
+
+        for (i32 i = VECTOR_BLOCK_SIZE - 1; i >= 0; i--)
+        {
+            block->vectors[i].obj.next = (Obj*)gc->free_vectors;
+            gc->free_vectors = &block->vectors[i];
+        }
+    }
+
+    ObjVector* vector = gc->free_vectors;
+    gc->free_vectors = (ObjVector*)vector->obj.next;
+
+    vector->obj.type      = OBJ_VECTOR;
+    vector->obj.is_marked = false;
+    vector->obj.next      = store->objects;
+    store->objects        = &vector->obj;
+
+    vector->count = count;
+    for (i32 i = 0; i < VECTOR_MAX; i++)
+    {
+        vector->components[i] = i < count ? components[i] : 0;
+    }
+
+#ifdef DEBUG_LOG_GC
+    printf("%p allocate %zu for %d\n", (void*)vector, sizeof(ObjVector), OBJ_VECTOR);
+#endif
+    return vector;
+}
+
+void free_vector_pool(GarbageCollector* gc)
+{
+    VectorBlock* block = gc->vector_blocks;
+    while (block != NULL)
+    {
+        VectorBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    gc->vector_blocks = NULL;
+    gc->free_vectors  = NULL;
+}
+
+ObjSlice* new_slice(GarbageCollector* gc, ObjectStore* store, Value string, i32 start, i32 length)
+{
+    ObjString* parent;
+    if (IS_SLICE(string))
+    {
+        ObjSlice* slice = AS_SLICE(string);
+        parent = slice->parent;
+        start += slice->start;
+    }
+    else
+    {
+        parent = AS_STRING(string);
+    }
+
+    ObjSlice* slice = ALLOCATE_OBJ(gc, ObjSlice, OBJ_SLICE);
+    slice->parent = parent;
+    slice->start  = start;
+    slice->length = length;
+    return slice;
+}
+
 static NativeArguments make_native_arguments(i32 arity, ...)
 {
     NativeArguments arguments = {};
@@ -74,7 +205,7 @@ static NativeArguments make_native_arguments(i32 arity, ...)
     va_start(args, arity);
     for(i32 i = 0; i < arity; i++)
     {
-        ValueType type = va_arg(args, ValueType);
+        ValueType type = (ValueType)va_arg(args, int); // Enums are promoted to int through varargs
         arguments.types[i] = type;
     }
     va_end(args);
@@ -89,30 +220,17 @@ ObjNative* new_native(GarbageCollector* gc, NativeFn function, NativeArguments a
     return native;
 }
 
-static u32 hash_string(const char* key, i32 length)
-{
-    u32 hash = 2166136261u;
-
-    for (i32 i = 0; i < length; i++)
-    {
-        hash ^= key[i];
-        hash += 16777619;
-    }
-
-    return hash;
-}
-
 static ObjString* allocate_string(GarbageCollector* gc, ObjectStore* store, Table* strings, const char* chars, i32 length)
 {
     ObjString* string = (ObjString*)allocate_object(gc, store, sizeof(ObjString) + length + 1, OBJ_STRING);
     string->length = length;
     string->hash = hash_string(chars, length);
 
-    push(gc->vm, OBJ_VAL(string));
+    if (gc->vm != NULL) push(gc->vm, OBJ_VAL(string));
 
     table_set(gc, strings, string, nil_val());
 
-    pop(gc->vm);
+    if (gc->vm != NULL) pop(gc->vm);
 
     memcpy(string->chars, chars, length);
     string->chars[length] = '\0';
@@ -130,6 +248,70 @@ ObjString* copy_string(GarbageCollector* gc, ObjectStore* store, Table* strings,
     return allocate_string(gc, store, strings, chars, length);
 }
 
+// Short strings never touch the heap or the intern table, so every string value
+// of length <= SMALL_STRING_MAX is inline and every longer one is interned.
+Value string_val(GarbageCollector* gc, ObjectStore* store, Table* strings, const char* chars, i32 length)
+{
+#ifdef NAN_BOXING
+    if (length <= SMALL_STRING_MAX)
+    {
+        return small_string_val(chars, length);
+    }
+#endif
+    return OBJ_VAL(copy_string(gc, store, strings, chars, length));
+}
+
+// Returns the characters of any string value. Small strings are decoded into
+// small_buffer, which must hold SMALL_STRING_MAX + 1 bytes.
+const char* string_chars(Value value, char* small_buffer, i32* length)
+{
+#ifdef NAN_BOXING
+    if (IS_SMALL_STRING(value))
+    {
+        *length = small_string_chars(value, small_buffer);
+        return small_buffer;
+    }
+#endif
+    if (IS_SLICE(value))
+    {
+        ObjSlice* slice = AS_SLICE(value);
+        *length = slice->length;
+        return slice->parent->chars + slice->start;
+    }
+
+    ObjString* string = AS_STRING(value);
+    *length = string->length;
+    return string->chars;
+}
+
+b32 vectors_equal(Value a, Value b)
+{
+    if (!IS_VECTOR(a) || !IS_VECTOR(b)) return false;
+
+    ObjVector* u = AS_VECTOR(a);
+    ObjVector* v = AS_VECTOR(b);
+    if (u->count != v->count) return false;
+    for (i32 i = 0; i < u->count; i++)
+    {
+        if (u->components[i] != v->components[i]) return false;
+    }
+    return true;
+}
+
+// Only needed when a slice is involved, everything else is equal by identity
+b32 strings_equal(Value a, Value b)
+{
+    if (!IS_SLICE(a) && !IS_SLICE(b)) return false;
+    if (!is_string(a) || !is_string(b)) return false;
+
+    char a_buffer[SMALL_STRING_MAX + 1];
+    char b_buffer[SMALL_STRING_MAX + 1];
+    i32 a_length, b_length;
+    const char* a_chars = string_chars(a, a_buffer, &a_length);
+    const char* b_chars = string_chars(b, b_buffer, &b_length);
+    return a_length == b_length && memcmp(a_chars, b_chars, a_length) == 0;
+}
+
 ObjUpvalue*  new_upvalue(GarbageCollector* gc, ObjectStore* store, Value* slot)
 {
     ObjUpvalue* upvalue = ALLOCATE_OBJ(gc, ObjUpvalue, OBJ_UPVALUE);
@@ -159,8 +341,10 @@ ObjString* take_string(GarbageCollector* gc, ObjectStore* store, Table* strings,
         FREE_ARRAY(gc, char, chars, length + 1);
         return interned;
     }
-    
-    return allocate_string(gc, store, strings, chars, length);
+
+    ObjString* string = allocate_string(gc, store, strings, chars, length);
+    FREE_ARRAY(gc, char, chars, length + 1);
+    return string;
 }
 
 void free_object(GarbageCollector* gc, Obj* object)
@@ -170,6 +354,13 @@ void free_object(GarbageCollector* gc, Obj* object)
 #endif
     switch (object->type)
     {
+        case OBJ_ARRAY:
+        {
+            ObjArray* array = (ObjArray*)object;
+            free_value_array(gc, &array->values);
+            FREE(gc, ObjArray, object);
+        }
+        break;
         case OBJ_BOUND_METHOD:
         {
             FREE(gc, ObjBoundMethod, object);
@@ -189,10 +380,20 @@ void free_object(GarbageCollector* gc, Obj* object)
             FREE(gc, ObjClosure, object);
         }
         break;
+        case OBJ_FLOAT64_ARRAY:
+        {
+            ObjFloat64Array* array = (ObjFloat64Array*)object;
+            FREE_ARRAY(gc, f64, array->values, array->count);
+            FREE(gc, ObjFloat64Array, object);
+        }
+        break;
         case OBJ_FUNCTION:
         {
             ObjFunction* function = (ObjFunction*)object;
             free_chunk(gc, &function->chunk);
+            if (function->baseline.code != NULL) free_chunk(gc, &function->baseline);
+            for (i32 i = 0; i < function->switch_map_count; i++) free_map(gc, &function->switch_maps[i]);
+            FREE_ARRAY(gc, Map, function->switch_maps, function->switch_map_count);
             FREE(gc, ObjFunction, object);
         }
         break;
@@ -203,11 +404,28 @@ void free_object(GarbageCollector* gc, Obj* object)
             FREE(gc, ObjInstance, object);
         }
         break;
+        case OBJ_MAP:
+        {
+            ObjMap* map = (ObjMap*)object;
+            free_map(gc, &map->map);
+            FREE(gc, ObjMap, object);
+        }
+        break;
         case OBJ_NATIVE:
         {
             FREE(gc, ObjNative, object);
         }
         break;
+        case OBJ_RANGE:
+        {
+            FREE(gc, ObjRange, object);
+        }
+        break;
+        case OBJ_SLICE:
+        {
+            FREE(gc, ObjSlice, object);
+        }
+        break;
         case OBJ_STRING:
         {
             FREE(gc, ObjString, object);
@@ -218,6 +436,13 @@ void free_object(GarbageCollector* gc, Obj* object)
             FREE(gc, ObjUpvalue, object);
         }
         break;
+        case OBJ_VECTOR:
+        {
+            gc->bytes_allocated -= sizeof(ObjVector);
+            object->next = (Obj*)gc->free_vectors;
+            gc->free_vectors = (ObjVector*)object;
+        }
+        break;
     }
 }
 
@@ -225,6 +450,18 @@ void print_object(Value value)
 {
     switch(AS_OBJ(value)->type)
     {
+        case OBJ_ARRAY:
+        {
+            ValueArray* values = &AS_ARRAY(value)->values;
+            printf("[");
+            for (i32 i = 0; i < values->count; i++)
+            {
+                if (i > 0) printf(", ");
+                print_value(values->values[i]);
+            }
+            printf("]");
+        }
+        break;
         case OBJ_BOUND_METHOD:
         {
             print_function(AS_BOUND_METHOD(value)->method->function);
@@ -240,6 +477,18 @@ void print_object(Value value)
             print_function(AS_CLOSURE(value)->function);
         }
         break;
+        case OBJ_FLOAT64_ARRAY:
+        {
+            ObjFloat64Array* array = AS_FLOAT64_ARRAY(value);
+            printf("[");
+            for (i32 i = 0; i < array->count; i++)
+            {
+                if (i > 0) printf(", ");
+                print_number(array->values[i]);
+            }
+            printf("]");
+        }
+        break;
         case OBJ_FUNCTION:
         {
             print_function(AS_FUNCTION(value));
@@ -251,11 +500,44 @@ void print_object(Value value)
                    AS_INSTANCE(value)->klass->name->chars);
         }
         break;
+        case OBJ_MAP:
+        {
+            Map* map = &AS_MAP(value)->map;
+            printf("{");
+            b32 first = true;
+            for (i32 i = 0; i < map->used; i++)
+            {
+                MapEntry* entry = &map->entries[i];
+                if (!entry->live) continue;
+                if (!first) printf(", ");
+                first = false;
+                print_value(entry->key);
+                printf(": ");
+                print_value(entry->value);
+            }
+            printf("}");
+        }
+        break;
         case OBJ_NATIVE:
         {
             printf("<native fn>");
         }
         break;
+        case OBJ_RANGE:
+        {
+            printf("range(");
+            print_number(AS_RANGE(value)->start);
+            printf(", ");
+            print_number(AS_RANGE(value)->end);
+            printf(")");
+        }
+        break;
+        case OBJ_SLICE:
+        {
+            ObjSlice* slice = AS_SLICE(value);
+            printf("%.*s", slice->length, slice->parent->chars + slice->start);
+        }
+        break;
         case OBJ_STRING:
         {
             printf("%s", AS_CSTRING(value));
@@ -266,5 +548,17 @@ void print_object(Value value)
             printf("upvalue");
         }
         break;
+        case OBJ_VECTOR:
+        {
+            ObjVector* vector = AS_VECTOR(value);
+            printf("vec%d(", vector->count);
+            for (i32 i = 0; i < vector->count; i++)
+            {
+                if (i > 0) printf(", ");
+                print_number(vector->components[i]);
+            }
+            printf(")");
+        }
+        break;
     }
 }
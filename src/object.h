@@ -11,7 +11,7 @@
 
 #define OBJ_TYPE(value) ((value).as.obj->type)
 
-#define IS_STRING(value) (is_obj_type(value, OBJ_STRING))
+#define IS_STRING(value) (is_string(value))
 #define IS_INSTANCE(value) (is_obj_type(value, OBJ_INSTANCE))
 #define IS_NATIVE(value) (is_obj_type(value, OBJ_NATIVE))
 #define IS_FUNCTION(value) (is_obj_type(value, OBJ_FUNCTION))
@@ -19,6 +19,12 @@
 #define IS_BOUND_METHOD(value) (is_obj_type(value, OBJ_BOUND_METHOD))
 #define IS_CLASS(value) (is_obj_type(value, OBJ_CLOSURE))
 #define IS_UPVALUE(value) (is_obj_type(value, OBJ_UPVALUE))
+#define IS_SLICE(value) (is_obj_type(value, OBJ_SLICE))
+#define IS_ARRAY(value) (is_obj_type(value, OBJ_ARRAY))
+#define IS_FLOAT64_ARRAY(value) (is_obj_type(value, OBJ_FLOAT64_ARRAY))
+#define IS_VECTOR(value) (is_obj_type(value, OBJ_VECTOR))
+#define IS_MAP(value) (is_obj_type(value, OBJ_MAP))
+#define IS_RANGE(value) (is_obj_type(value, OBJ_RANGE))
 
 #define AS_OBJ_TYPE(value, type) ((type*)AS_OBJ(value))
 #define AS_NATIVE(value)       (AS_OBJ_TYPE(value, ObjNative))
@@ -30,17 +36,29 @@
 #define AS_CSTRING(value)      (AS_OBJ_TYPE(value, ObjString)->chars)
 #define AS_STRING(value)       (AS_OBJ_TYPE(value, ObjString))
 #define AS_UPVALUE(value)      (AS_OBJ_TYPE(value, ObjUpvalue))
+#define AS_SLICE(value)        (AS_OBJ_TYPE(value, ObjSlice))
+#define AS_ARRAY(value)        (AS_OBJ_TYPE(value, ObjArray))
+#define AS_FLOAT64_ARRAY(value) (AS_OBJ_TYPE(value, ObjFloat64Array))
+#define AS_VECTOR(value)       (AS_OBJ_TYPE(value, ObjVector))
+#define AS_MAP(value)          (AS_OBJ_TYPE(value, ObjMap))
+#define AS_RANGE(value)        (AS_OBJ_TYPE(value, ObjRange))
 
 enum ObjType
 {
+    OBJ_ARRAY,
     OBJ_BOUND_METHOD,
     OBJ_CLASS,
     OBJ_CLOSURE,
+    OBJ_FLOAT64_ARRAY,
     OBJ_FUNCTION,
     OBJ_INSTANCE,
+    OBJ_MAP,
     OBJ_NATIVE,
+    OBJ_RANGE,
+    OBJ_SLICE,
     OBJ_STRING,
-    OBJ_UPVALUE
+    OBJ_UPVALUE,
+    OBJ_VECTOR
 };
 
 struct Obj
@@ -60,6 +78,63 @@ struct ObjString
     char chars[1];
 };
 
+// A view into part of an interned string. Slices are never interned themselves,
+// they keep their parent alive and compare by content.
+struct ObjSlice
+{
+    Obj obj;
+    ObjString* parent;
+    i32 start;
+    i32 length;
+};
+
+// A growable list of values stored contiguously
+struct ObjArray
+{
+    Obj obj;
+    ValueArray values;
+};
+
+// A fixed length buffer of raw doubles for the bulk numeric natives
+struct ObjFloat64Array
+{
+    Obj obj;
+    i32 count;
+    f64* values;
+};
+
+struct ObjMap
+{
+    Obj obj;
+    Map map;
+};
+
+// The numbers start, start + 1, ... up to but not including end
+struct ObjRange
+{
+    Obj obj;
+    f64 start;
+    f64 end;
+};
+
+#define VECTOR_MAX 4
+#define VECTOR_BLOCK_SIZE 256
+
+// An immutable vec2, vec3 or vec4. Vectors are recycled through a free list
+// instead of the allocator, since math code creates one per operation.
+struct ObjVector
+{
+    Obj obj;
+    i32 count;
+    f64 components[VECTOR_MAX];
+};
+
+struct VectorBlock
+{
+    VectorBlock* next;
+    ObjVector vectors[VECTOR_BLOCK_SIZE];
+};
+
 struct ObjUpvalue
 {
     Obj obj;
@@ -73,8 +148,29 @@ struct ObjFunction
     Obj obj;
     i32 arity;
     i32 upvalue_count;
+    i32 slot_count; // Most locals the body has at once, the receiver or callee included
     Chunk chunk;
     ObjString* name;
+
+    // Set while the constants are still only in this bytecode image, see load_image_constants
+    struct BytecodeImage* image;
+    u32 image_index;
+
+    // Set while the body is still uncompiled: where its parameter list starts and
+    // the FunctionType to compile it as, see compile_lazy_function
+    const char* lazy_source;
+    i32 lazy_line;
+    i32 lazy_type;
+
+    // Calls so far, counted up to OPTIMIZE_THRESHOLD. Once optimize_function has
+    // replaced the code in chunk, baseline keeps the old code and lines for the
+    // frames still running it. The constants stay in chunk.
+    i32 call_count;
+    Chunk baseline;
+
+    // One table per OP_SWITCH_HASH, see switch_labels. The keys are constants of the chunk.
+    Map* switch_maps;
+    i32 switch_map_count;
 };
 
 struct ObjClosure
@@ -113,7 +209,7 @@ struct NativeArguments
     ValueType types[MAX_ARITY];
 };
 
-using NativeFn = Value(*)(i32 arg_count, Value* args);
+using NativeFn = Value(*)(struct VM* vm, i32 arg_count, Value* args);
 struct ObjNative
 {
     Obj obj;
@@ -142,9 +238,20 @@ ObjFunction*    new_function(GarbageCollector* gc, ObjectStore* store);
 ObjInstance*    new_instance(GarbageCollector* gc, ObjectStore* store, ObjClass* klass);
 ObjBoundMethod* new_bound_method(GarbageCollector* gc, ObjectStore* store, Value receiver, ObjClosure* method);
 ObjClass*       new_class(GarbageCollector* gc, ObjectStore* store, ObjString* name);
+ObjArray*       new_array(GarbageCollector* gc, ObjectStore* store);
+ObjFloat64Array* new_float64_array(GarbageCollector* gc, ObjectStore* store, i32 count);
+ObjMap*         new_map(GarbageCollector* gc, ObjectStore* store);
+ObjRange*       new_range(GarbageCollector* gc, ObjectStore* store, f64 start, f64 end);
+ObjVector*      new_vector(GarbageCollector* gc, ObjectStore* store, i32 count, const f64* components);
+ObjSlice*       new_slice(GarbageCollector* gc, ObjectStore* store, Value string, i32 start, i32 length);
 ObjClosure*     new_closure(GarbageCollector* gc, ObjFunction* function, ObjectStore* store);
 ObjNative*      new_native(GarbageCollector* gc, NativeFn function, NativeArguments arguments, ObjectStore* store);
 ObjString*      take_string(GarbageCollector* gc, ObjectStore*, Table* strings, char*, i32);
+Value           string_val(GarbageCollector* gc, ObjectStore* store, Table* strings, const char* chars, i32 length);
+const char*     string_chars(Value value, char* small_buffer, i32* length);
+b32             strings_equal(Value a, Value b);
+b32             vectors_equal(Value a, Value b);
+void            free_vector_pool(GarbageCollector* gc);
 void            print_object(Value);
 void            free_object(GarbageCollector* gc, Obj*);
 // =================================================================
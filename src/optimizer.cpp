@@ -0,0 +1,2124 @@
+// The optimizing tier. A function that gets hot is recompiled from its own
+// bytecode: the code is split into basic blocks and put in SSA form, where each
+// slot of the frame holds a value at every instruction and "let b = a;" makes b
+// the same value as a. On that form the optimizer
+//   - forwards phis that only ever see one value, so copies propagate through loops,
+//   - infers which values are always numbers, from constants, from arithmetic on
+//     numbers and from the comparisons and bitwise operators that fail on anything else,
+//   - numbers values so side effect free code computing the same value shares one,
+//   - and finds the loops and the code in them that computes the same every iteration.
+// The result is the same bytecode with that code run once, before the loop or the
+// first time it comes up, and the value kept in a slot added to the frame. Arithmetic
+// on known numbers uses the unchecked OP_*_NUMBER instructions. run() executes it like
+// any other code. Returns false and leaves the function alone when nothing improves.
+// specialize_types runs the same inference on every function as it is compiled.
+b32 optimize_function(GarbageCollector* gc, ObjFunction* function)
+{
+    Optimizer optimizer = {};
+    optimizer.gc       = gc;
+    optimizer.function = function;
+    optimizer.chunk    = &function->chunk;
+    optimizer.source_lines = decode_lines(&function->chunk);
+
+    b32 ok = build_ir(&optimizer);
+    if (ok && inline_calls(&optimizer))
+    {
+        // The spliced code is analyzed from scratch, arguments flow into the bodies
+        optimizer.inlined = {};
+        optimizer.inlined.code      = optimizer.code;
+        optimizer.inlined.count     = optimizer.count;
+        optimizer.inlined.capacity  = optimizer.capacity;
+        optimizer.inlined.constants = function->chunk.constants;
+        free(optimizer.source_lines);
+        optimizer.source_lines = optimizer.lines;
+        optimizer.code     = NULL;
+        optimizer.lines    = NULL;
+        optimizer.count    = 0;
+        optimizer.capacity = 0;
+
+        free_ir(&optimizer);
+        optimizer.chunk = &optimizer.inlined;
+        optimizer.improved = true;
+        ok = build_ir(&optimizer);
+    }
+
+    if (ok)
+    {
+        remove_trivial_phis(&optimizer);
+        infer_types(&optimizer);
+        find_loops(&optimizer);
+        number_values(&optimizer);
+
+        optimizer.temp_limit = UINT8_COUNT - optimizer.max_height;
+        if (optimizer.temp_limit > OPTIMIZER_TEMPS_MAX) optimizer.temp_limit = OPTIMIZER_TEMPS_MAX;
+
+        hoist_invariants(&optimizer);
+        ok = eliminate_common_subexpressions(&optimizer) && emit_optimized(&optimizer) && optimizer.improved;
+    }
+
+    if (ok)
+    {
+        Chunk optimized;
+        init_chunk(&optimized);
+        for (i32 i = 0; i < optimizer.count; i++)
+        {
+            write_chunk(gc, &optimized, optimizer.code[i], optimizer.lines[i]);
+        }
+        shrink_chunk(gc, &optimized);
+
+        Chunk* chunk = &function->chunk;
+        function->baseline = *chunk;
+        init_value_array(&function->baseline.constants);
+
+        chunk->code          = optimized.code;
+        chunk->count         = optimized.count;
+        chunk->capacity      = optimized.capacity;
+        chunk->lines         = optimized.lines;
+        chunk->line_count    = optimized.line_count;
+        chunk->line_capacity = optimized.line_capacity;
+        chunk->mapped        = false;
+
+#ifdef DEBUG_PRINT_CODE
+        char name[128];
+        snprintf(name, sizeof(name), "%s (optimized)", function->name != NULL ? function->name->chars : "<script>");
+        disassemble_chunk(chunk, name);
+#endif
+    }
+
+    free_optimizer(&optimizer);
+    return ok;
+}
+
+// Rewrites the instructions whose operand types are known with their unchecked
+// forms in place, so nothing moves. Runs on every function as it is compiled,
+// method says slot 0 holds the receiver. Touches nothing but the function.
+void specialize_types(GarbageCollector* gc, ObjFunction* function, b32 method)
+{
+    Optimizer optimizer = {};
+    optimizer.gc       = gc;
+    optimizer.function = function;
+    optimizer.chunk    = &function->chunk;
+    optimizer.method   = method;
+
+    if (build_ir(&optimizer))
+    {
+        remove_trivial_phis(&optimizer);
+        infer_types(&optimizer);
+
+        for (i32 index = 0; index < optimizer.instruction_count; index++)
+        {
+            IrInstruction* instruction = &optimizer.instructions[index];
+            if (optimizer.blocks[instruction->block].order == -1) continue;
+            function->chunk.code[instruction->offset] = unchecked_op(&optimizer, index);
+        }
+    }
+
+    free_optimizer(&optimizer);
+}
+
+// Expands the line runs of chunk to a line per byte, the optimizer looks one up for every instruction it emits
+static i32* decode_lines(Chunk* chunk)
+{
+    i32* lines = (i32*)calloc(chunk->count + 1, sizeof(i32));
+    if (lines == NULL) exit(1);
+
+    for (i32 run = 0; run < chunk->line_count; run++)
+    {
+        i32 end = run + 1 < chunk->line_count ? chunk->lines[run + 1].start : chunk->count;
+        for (i32 offset = chunk->lines[run].start; offset < end; offset++)
+        {
+            lines[offset] = chunk->lines[run].line;
+        }
+    }
+    return lines;
+}
+
+static b32 build_ir(Optimizer* optimizer)
+{
+    return decode_instructions(optimizer) && build_blocks(optimizer) && build_ssa(optimizer);
+}
+
+static b32 decode_instructions(Optimizer* optimizer)
+{
+    Chunk* chunk = optimizer->chunk;
+    optimizer->instructions   = (IrInstruction*)malloc(sizeof(IrInstruction) * (chunk->count + 1));
+    optimizer->instruction_at = (i32*)malloc(sizeof(i32) * (chunk->count + 1));
+    for (i32 offset = 0; offset <= chunk->count; offset++)
+    {
+        optimizer->instruction_at[offset] = -1;
+    }
+
+    for (i32 offset = 0; offset < chunk->count;)
+    {
+        // Wide operands only come up in functions with more slots or constants than
+        // the optimized code can address, upvalue pairs included
+        u8 op = chunk->code[offset];
+        if (op == OP_WIDE || op == OP_WIDE_LONG) return false;
+
+        i32 length = instruction_length(chunk, offset);
+        if (offset + length > chunk->count) return false;
+        if (op == OP_CLOSURE && length != 2 + 2 * AS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]])->upvalue_count) return false;
+
+        IrInstruction* instruction = &optimizer->instructions[optimizer->instruction_count];
+        instruction->offset      = offset;
+        instruction->length      = length;
+        instruction->op          = checked_op(chunk->code[offset]);
+        instruction->specialized = instruction->op != chunk->code[offset];
+        instruction->block       = -1;
+        instruction->height      = 0;
+        instruction->value       = -1;
+        instruction->defines[0]  = -1;
+        instruction->defines[1]  = -1;
+        instruction->range_start = -1;
+        instruction->receiver    = -1;
+        instruction->load        = -1;
+        instruction->skipped     = false;
+
+        optimizer->instruction_at[offset] = optimizer->instruction_count++;
+        offset += length;
+    }
+    return optimizer->instruction_count > 0;
+}
+
+// How many places the instruction can jump to
+static i32 jump_target_count(Optimizer* optimizer, IrInstruction* instruction)
+{
+    u8* code = optimizer->chunk->code + instruction->offset;
+    switch (instruction->op)
+    {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_GUARD_CALLEE: return 1;
+        case OP_FOR_ITER:     return 2;
+        case OP_SWITCH_TABLE: return 1 + (u16)(code[5] << 8 | code[6]);
+        case OP_SWITCH_HASH:  return 1 + (u16)(code[2] << 8 | code[3]);
+        default:              return 0;
+    }
+}
+
+// The instruction a jump goes to, or -1 when it lands outside the code or inside
+// an instruction. which picks between the exit and the body of OP_FOR_ITER, and
+// between the default and the entries of a switch.
+static i32 jump_target(Optimizer* optimizer, IrInstruction* instruction, i32 which)
+{
+    u8* code = optimizer->chunk->code + instruction->offset;
+    i32 end = instruction->offset + instruction->length;
+    i32 target;
+    switch (instruction->op)
+    {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE: target = instruction->offset + 3 + (u16)(code[1] << 8 | code[2]); break;
+        case OP_LOOP:          target = instruction->offset + 3 - (u16)(code[1] << 8 | code[2]); break;
+        case OP_GUARD_CALLEE:  target = instruction->offset + 5 + (u16)(code[3] << 8 | code[4]); break;
+        case OP_FOR_ITER:
+        {
+            target = which == 0 ? instruction->offset + 4 + (u16)(code[2] << 8 | code[3])
+                                : instruction->offset + 6 + (u16)(code[4] << 8 | code[5]);
+        }
+        break;
+        case OP_SWITCH_TABLE:
+        {
+            u8* distance = which == 0 ? code + 7 : code + SWITCH_TABLE_HEADER + 2 * (which - 1);
+            target = end - (u16)(distance[0] << 8 | distance[1]);
+        }
+        break;
+        case OP_SWITCH_HASH:
+        {
+            u8* distance = which == 0 ? code + 4 : code + SWITCH_HASH_HEADER + SWITCH_HASH_ENTRY * (which - 1) + 3;
+            target = end - (u16)(distance[0] << 8 | distance[1]);
+        }
+        break;
+        default: return -1;
+    }
+
+    if (target < 0 || target >= optimizer->chunk->count) return -1;
+    return optimizer->instruction_at[target];
+}
+
+static b32 build_blocks(Optimizer* optimizer)
+{
+    i32 count = optimizer->instruction_count;
+    b32* leaders = (b32*)calloc(count + 1, sizeof(b32));
+    leaders[0] = true;
+
+    b32 ok = true;
+    i32 successor_count = 0;
+    for (i32 i = 0; i < count; i++)
+    {
+        IrInstruction* instruction = &optimizer->instructions[i];
+        i32 targets = jump_target_count(optimizer, instruction);
+        for (i32 which = 0; which < targets; which++)
+        {
+            i32 target = jump_target(optimizer, instruction, which);
+            if (target < 0)
+            {
+                ok = false;
+                break;
+            }
+            leaders[target] = true;
+        }
+        if (targets > 0 || instruction->op == OP_RETURN) leaders[i + 1] = true;
+        successor_count += targets + 1;
+    }
+
+    optimizer->blocks = (IrBlock*)malloc(sizeof(IrBlock) * count);
+    for (i32 i = 0; ok && i < count; i++)
+    {
+        if (leaders[i])
+        {
+            IrBlock* block = &optimizer->blocks[optimizer->block_count++];
+            *block = {};
+            block->first       = i;
+            block->idom        = -1;
+            block->loop        = -1;
+            block->parent_loop = -1;
+            block->hoisted     = -1;
+        }
+        optimizer->instructions[i].block = optimizer->block_count - 1;
+        optimizer->blocks[optimizer->block_count - 1].end = i + 1;
+    }
+    free(leaders);
+
+    // Each edge once, a switch can send several labels to the same case
+    optimizer->successors = (i32*)malloc(sizeof(i32) * (successor_count + 1));
+    i32 successor_used = 0;
+    for (i32 b = 0; ok && b < optimizer->block_count; b++)
+    {
+        IrBlock* block = &optimizer->blocks[b];
+        IrInstruction* last = &optimizer->instructions[block->end - 1];
+        i32 next = block->end < count ? optimizer->instructions[block->end].block : -1;
+        i32* successors = optimizer->successors + successor_used;
+        block->successors = successor_used;
+
+        switch (last->op)
+        {
+            case OP_JUMP:
+            case OP_LOOP:
+            case OP_SWITCH_TABLE:
+            case OP_SWITCH_HASH:
+            case OP_RETURN: break;
+            default: successors[block->successor_count++] = next; break;
+        }
+
+        i32 targets = jump_target_count(optimizer, last);
+        for (i32 which = 0; which < targets; which++)
+        {
+            i32 successor = optimizer->instructions[jump_target(optimizer, last, which)].block;
+            b32 seen = false;
+            for (i32 k = 0; k < block->successor_count; k++)
+            {
+                if (successors[k] == successor) seen = true;
+            }
+            if (!seen) successors[block->successor_count++] = successor;
+        }
+        successor_used += block->successor_count;
+
+        // Running off the end of the code
+        for (i32 i = 0; i < block->successor_count; i++)
+        {
+            if (successors[i] < 0) ok = false;
+        }
+    }
+    if (!ok) return false;
+
+    order_blocks(optimizer);
+
+    // Only reachable blocks count as predecessors
+    for (i32 i = 0; i < optimizer->order_count; i++)
+    {
+        IrBlock* block = &optimizer->blocks[optimizer->order[i]];
+        for (i32 j = 0; j < block->successor_count; j++)
+        {
+            optimizer->blocks[optimizer->successors[block->successors + j]].predecessor_count++;
+        }
+    }
+
+    i32 predecessor_count = 0;
+    for (i32 b = 0; b < optimizer->block_count; b++)
+    {
+        optimizer->blocks[b].predecessors = predecessor_count;
+        predecessor_count += optimizer->blocks[b].predecessor_count;
+        optimizer->blocks[b].predecessor_count = 0;
+    }
+
+    optimizer->predecessors = (i32*)malloc(sizeof(i32) * (predecessor_count + 1));
+    for (i32 i = 0; i < optimizer->order_count; i++)
+    {
+        i32 b = optimizer->order[i];
+        IrBlock* block = &optimizer->blocks[b];
+        for (i32 j = 0; j < block->successor_count; j++)
+        {
+            IrBlock* successor = &optimizer->blocks[optimizer->successors[block->successors + j]];
+            optimizer->predecessors[successor->predecessors + successor->predecessor_count++] = b;
+        }
+    }
+
+    find_dominators(optimizer);
+    return true;
+}
+
+// Fills order with the blocks reachable from the first one in reverse postorder
+static void order_blocks(Optimizer* optimizer)
+{
+    i32 count = optimizer->block_count;
+    i32* stack          = (i32*)malloc(sizeof(i32) * count);
+    i32* next_successor = (i32*)calloc(count, sizeof(i32));
+    i32* postorder      = (i32*)malloc(sizeof(i32) * count);
+    for (i32 b = 0; b < count; b++)
+    {
+        optimizer->blocks[b].order = -1;
+    }
+
+    i32 top = 0;
+    i32 visited = 0;
+    stack[top++] = 0;
+    optimizer->blocks[0].order = 0;
+    while (top > 0)
+    {
+        i32 b = stack[top - 1];
+        IrBlock* block = &optimizer->blocks[b];
+        if (next_successor[b] < block->successor_count)
+        {
+            i32 successor = optimizer->successors[block->successors + next_successor[b]++];
+            if (optimizer->blocks[successor].order == -1)
+            {
+                optimizer->blocks[successor].order = 0;
+                stack[top++] = successor;
+            }
+        }
+        else
+        {
+            postorder[visited++] = b;
+            top--;
+        }
+    }
+
+    optimizer->order = (i32*)malloc(sizeof(i32) * count);
+    optimizer->order_count = visited;
+    for (i32 i = 0; i < visited; i++)
+    {
+        i32 b = postorder[visited - 1 - i];
+        optimizer->order[i] = b;
+        optimizer->blocks[b].order = i;
+    }
+
+    free(stack);
+    free(next_successor);
+    free(postorder);
+}
+
+// The iterative algorithm from "A Simple, Fast Dominance Algorithm" by Cooper, Harvey and Kennedy
+static void find_dominators(Optimizer* optimizer)
+{
+    IrBlock* blocks = optimizer->blocks;
+    blocks[0].idom = 0;
+
+    b32 changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (i32 i = 1; i < optimizer->order_count; i++)
+        {
+            IrBlock* block = &blocks[optimizer->order[i]];
+            i32 idom = -1;
+            for (i32 j = 0; j < block->predecessor_count; j++)
+            {
+                i32 predecessor = optimizer->predecessors[block->predecessors + j];
+                if (blocks[predecessor].idom == -1) continue;
+                if (idom == -1)
+                {
+                    idom = predecessor;
+                    continue;
+                }
+
+                i32 a = predecessor;
+                i32 b = idom;
+                while (a != b)
+                {
+                    while (blocks[a].order > blocks[b].order) a = blocks[a].idom;
+                    while (blocks[b].order > blocks[a].order) b = blocks[b].idom;
+                }
+                idom = a;
+            }
+
+            if (block->idom != idom)
+            {
+                block->idom = idom;
+                changed = true;
+            }
+        }
+    }
+}
+
+static b32 dominates(Optimizer* optimizer, i32 block, i32 other)
+{
+    for (;;)
+    {
+        if (other == block) return true;
+        if (other == 0) return false;
+        other = optimizer->blocks[other].idom;
+    }
+}
+
+// A loop is a header with the blocks of every back edge to it, an edge from a
+// block the header dominates. Headers come before the loops inside them in
+// reverse postorder, so those overwrite the loop of their blocks afterwards.
+static void find_loops(Optimizer* optimizer)
+{
+    i32* stack   = (i32*)malloc(sizeof(i32) * (optimizer->block_count + 1));
+    i32* visited = (i32*)malloc(sizeof(i32) * optimizer->block_count);
+    for (i32 b = 0; b < optimizer->block_count; b++)
+    {
+        visited[b] = -1;
+    }
+
+    for (i32 i = 0; i < optimizer->order_count; i++)
+    {
+        i32 header = optimizer->order[i];
+        IrBlock* block = &optimizer->blocks[header];
+
+        i32 top = 0;
+        for (i32 j = 0; j < block->predecessor_count; j++)
+        {
+            i32 predecessor = optimizer->predecessors[block->predecessors + j];
+            if (dominates(optimizer, header, predecessor)) stack[top++] = predecessor;
+        }
+        if (top == 0) continue;
+
+        block->parent_loop = block->loop;
+        block->loop = header;
+        visited[header] = header;
+        while (top > 0)
+        {
+            i32 b = stack[--top];
+            if (visited[b] == header) continue;
+            visited[b] = header;
+            optimizer->blocks[b].loop = header;
+
+            IrBlock* member = &optimizer->blocks[b];
+            for (i32 j = 0; j < member->predecessor_count; j++)
+            {
+                i32 predecessor = optimizer->predecessors[member->predecessors + j];
+                if (visited[predecessor] != header) stack[top++] = predecessor;
+            }
+        }
+    }
+
+    free(stack);
+    free(visited);
+}
+
+static b32 in_loop(Optimizer* optimizer, i32 block, i32 header)
+{
+    for (i32 loop = optimizer->blocks[block].loop; loop != -1; loop = optimizer->blocks[loop].parent_loop)
+    {
+        if (loop == header) return true;
+    }
+    return false;
+}
+
+static i32 new_value(Optimizer* optimizer, IrValueKind kind, i32 block, i32 instruction)
+{
+    if (optimizer->value_capacity < optimizer->value_count + 1)
+    {
+        optimizer->value_capacity = GROW_CAPACITY(optimizer->value_capacity);
+        optimizer->values = (IrValue*)realloc(optimizer->values, sizeof(IrValue) * optimizer->value_capacity);
+    }
+
+    i32 index = optimizer->value_count++;
+    IrValue* value = &optimizer->values[index];
+    value->kind           = kind;
+    value->op             = 0;
+    value->types          = 0;
+    value->operands[0]    = -1;
+    value->operands[1]    = -1;
+    value->phi_operands   = -1;
+    value->block          = block;
+    value->instruction    = instruction;
+    value->constant       = nil_val();
+    value->forward        = -1;
+    value->number         = index;
+    value->next_same_hash = -1;
+    value->temp           = -1;
+    value->hoisted        = false;
+    value->next_hoisted   = -1;
+    return index;
+}
+
+// Follows forwarded phis
+static i32 find_value(Optimizer* optimizer, i32 value)
+{
+    i32 found = value;
+    while (optimizer->values[found].forward != -1) found = optimizer->values[found].forward;
+
+    while (optimizer->values[value].forward != -1)
+    {
+        i32 next = optimizer->values[value].forward;
+        optimizer->values[value].forward = found;
+        value = next;
+    }
+    return found;
+}
+
+// The value at runtime, refinements only add what the optimizer knows about it
+static i32 root_value(Optimizer* optimizer, i32 value)
+{
+    value = find_value(optimizer, value);
+    while (optimizer->values[value].kind == IR_REFINE)
+    {
+        value = find_value(optimizer, optimizer->values[value].operands[0]);
+    }
+    return value;
+}
+
+static u8 value_types(Optimizer* optimizer, i32 value)
+{
+    return optimizer->values[find_value(optimizer, value)].types;
+}
+
+// Instructions that only read their operands and raise the same error or
+// produce an equal value every time they see the same operands
+static b32 is_pure_op(u8 op)
+{
+    switch (op)
+    {
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_BIT_AND:
+        case OP_BIT_OR:
+        case OP_BIT_XOR:
+        case OP_BIT_NOT:
+        case OP_SHIFT_LEFT:
+        case OP_SHIFT_RIGHT: return true;
+        default: return false;
+    }
+}
+
+// Instructions that raise an error unless every operand is a number
+static b32 is_number_check(u8 op)
+{
+    switch (op)
+    {
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_BIT_AND:
+        case OP_BIT_OR:
+        case OP_BIT_XOR:
+        case OP_BIT_NOT:
+        case OP_SHIFT_LEFT:
+        case OP_SHIFT_RIGHT: return true;
+        default: return false;
+    }
+}
+
+// The instruction an unchecked form was specialized from, the analysis only
+// deals with those
+static u8 checked_op(u8 op)
+{
+    switch (op)
+    {
+        case OP_ADD_NUMBER:
+        case OP_ADD_STRING:            return OP_ADD;
+        case OP_SUBTRACT_NUMBER:       return OP_SUBTRACT;
+        case OP_MULTIPLY_NUMBER:       return OP_MULTIPLY;
+        case OP_DIVIDE_NUMBER:         return OP_DIVIDE;
+        case OP_LESS_NUMBER:           return OP_LESS;
+        case OP_GREATER_NUMBER:        return OP_GREATER;
+        case OP_NEGATE_NUMBER:         return OP_NEGATE;
+        case OP_GET_PROPERTY_INSTANCE: return OP_GET_PROPERTY;
+        case OP_SET_PROPERTY_INSTANCE: return OP_SET_PROPERTY;
+        default:                       return op;
+    }
+}
+
+// Applies the instruction at index to the values in slots. While building, it
+// creates the values the instruction produces and records them in it, afterwards
+// it replays those. starts, ends and pure track the code that pushed each slot
+// for range_start. Returns false on code the optimizer does not handle.
+static b32 simulate_instruction(Optimizer* optimizer, i32 index, i32* slots, i32* height,
+                                i32* starts, i32* ends, b32* pure, b32 building)
+{
+    IrInstruction* instruction = &optimizer->instructions[index];
+    u8* code = optimizer->chunk->code + instruction->offset;
+    i32 top = *height;
+    instruction->height = top;
+
+    i32 pops = 0;
+    b32 pushes = false;
+    i32 pushed = -1; // A new IR_UNKNOWN
+    b32 pushed_pure = false;
+    i32 pushed_start = index;
+
+    switch (instruction->op)
+    {
+        case OP_CONSTANT:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        {
+            if (building)
+            {
+                i32 value = new_value(optimizer, IR_CONSTANT, instruction->block, index);
+                switch (instruction->op)
+                {
+                    case OP_CONSTANT: optimizer->values[value].constant = optimizer->chunk->constants.values[code[1]]; break;
+                    case OP_NIL:      optimizer->values[value].constant = nil_val(); break;
+                    case OP_TRUE:     optimizer->values[value].constant = bool_val(true); break;
+                    case OP_FALSE:    optimizer->values[value].constant = bool_val(false); break;
+                }
+                instruction->value = value;
+            }
+            pushes = true;
+            pushed = instruction->value;
+            pushed_pure = true;
+        }
+        break;
+        case OP_GET_LOCAL:
+        {
+            if (code[1] >= top) return false;
+            pushes = true;
+            if (!optimizer->captured[code[1]])
+            {
+                pushed = slots[code[1]];
+                pushed_pure = true;
+                instruction->value = pushed;
+            }
+        }
+        break;
+        case OP_SET_LOCAL:
+        {
+            if (code[1] >= top) return false;
+            slots[code[1]] = slots[top - 1];
+            pure[top - 1] = false;
+        }
+        break;
+        case OP_SET_GLOBAL:
+        case OP_SET_UPVALUE:
+        case OP_JUMP_IF_FALSE:
+        {
+            if (top < 1) return false;
+            pure[top - 1] = false;
+        }
+        break;
+        case OP_POP:
+        case OP_PRINT:
+        case OP_SWITCH_TABLE:
+        case OP_SWITCH_HASH:
+        case OP_DEFINE_GLOBAL:
+        case OP_CLOSE_UPVALUE:
+        case OP_INHERIT:
+        case OP_METHOD:
+        case OP_RETURN: pops = 1; break;
+        case OP_GET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_CLASS:
+        case OP_CLOSURE: pushes = true; break;
+        case OP_COMPARE:
+        {
+            if (top < 2) return false;
+            pushes = true;
+        }
+        break;
+        case OP_GET_PROPERTY:
+        {
+            if (top < 1) return false;
+            if (building) instruction->receiver = slots[top - 1];
+            pops = 1;
+            pushes = true;
+        }
+        break;
+        case OP_GET_SUPER:
+        case OP_INDEX_GET: pops = 2; pushes = true; break;
+        case OP_SET_PROPERTY:
+        case OP_INDEX_SET:
+        {
+            // The assigned value stays on the stack
+            pops = instruction->op == OP_SET_PROPERTY ? 2 : 3;
+            if (top < pops) return false;
+            if (building && instruction->op == OP_SET_PROPERTY)
+            {
+                // Only instances have fields
+                instruction->receiver = slots[top - 2];
+                instruction->defines[0] = new_value(optimizer, IR_REFINE, instruction->block, index);
+                optimizer->values[instruction->defines[0]].op = OP_SET_PROPERTY;
+                optimizer->values[instruction->defines[0]].operands[0] = slots[top - 2];
+            }
+            pushes = true;
+            pushed = slots[top - 1];
+            instruction->value = pushed;
+        }
+        break;
+        case OP_ARRAY:        pops = code[1];     pushes = true; break;
+        case OP_MAP:          pops = code[1] * 2; pushes = true; break;
+        case OP_ARRAY_EXTEND:
+        case OP_MAP_EXTEND:
+        {
+            // Leaves the array or map it adds to where it was
+            pops = (instruction->op == OP_MAP_EXTEND ? code[1] * 2 : code[1]) + 1;
+            if (pops > top) return false;
+            pushes = true;
+            pushed = slots[top - pops];
+        }
+        break;
+        case OP_CALL:
+        {
+            // Remember the callee for inline_candidate
+            if (code[1] >= top) return false;
+            if (building) instruction->defines[0] = slots[top - code[1] - 1];
+            pops = code[1] + 1;
+            pushes = true;
+        }
+        break;
+        case OP_GUARD_CALLEE:
+        {
+            if (code[2] >= top) return false;
+        }
+        break;
+        case OP_INLINED_RETURN:
+        {
+            // The result replaces the callee and everything above it
+            if (code[1] >= top) return false;
+            pushed = slots[top - 1];
+            pops = top - code[1];
+            pushes = true;
+            instruction->value = pushed;
+        }
+        break;
+        case OP_INVOKE:       pops = code[2] + 1; pushes = true; break;
+        case OP_SUPER_INVOKE: pops = code[2] + 2; pushes = true; break;
+        case OP_JUMP:
+        case OP_LOOP: break;
+        case OP_FOR_ITER:
+        {
+            // Writes the loop variable and the cursor
+            if (code[1] + 2 >= top) return false;
+            if (building)
+            {
+                instruction->defines[0] = new_value(optimizer, IR_UNKNOWN, instruction->block, index);
+                instruction->defines[1] = new_value(optimizer, IR_UNKNOWN, instruction->block, index);
+            }
+            slots[code[1]]     = instruction->defines[0];
+            slots[code[1] + 2] = instruction->defines[1];
+        }
+        break;
+        default:
+        {
+            if (!is_pure_op(instruction->op)) return false;
+
+            u8 op = instruction->op;
+            i32 operand_count = op == OP_NOT || op == OP_NEGATE || op == OP_BIT_NOT ? 1 : 2;
+            if (top < operand_count) return false;
+            i32 first = top - operand_count;
+
+            if (building)
+            {
+                i32 value = new_value(optimizer, IR_OP, instruction->block, index);
+                optimizer->values[value].op = op;
+                for (i32 i = 0; i < operand_count; i++)
+                {
+                    optimizer->values[value].operands[i] = slots[first + i];
+                }
+                instruction->value = value;
+            }
+
+            // The operands have to be pushed by side effect free code, one right after the other
+            b32 contiguous = true;
+            for (i32 i = first; i < top; i++)
+            {
+                i32 next = i + 1 < top ? starts[i + 1] : index;
+                if (!pure[i] || ends[i] + 1 != next) contiguous = false;
+            }
+            if (building && contiguous) instruction->range_start = starts[first];
+
+            pops = operand_count;
+            pushes = true;
+            pushed = instruction->value;
+            pushed_pure = contiguous;
+            pushed_start = contiguous ? starts[first] : index;
+
+            if (is_number_check(op) && building)
+            {
+                for (i32 i = 0; i < operand_count; i++)
+                {
+                    i32 refined = new_value(optimizer, IR_REFINE, instruction->block, index);
+                    optimizer->values[refined].op = op;
+                    optimizer->values[refined].operands[0] = slots[first + i];
+                    instruction->defines[i] = refined;
+                }
+            }
+        }
+        break;
+    }
+
+    if (pops > top) return false;
+    top -= pops;
+
+    if (pushes)
+    {
+        if (top >= UINT8_COUNT) return false;
+        if (pushed == -1)
+        {
+            if (building) instruction->value = new_value(optimizer, IR_UNKNOWN, instruction->block, index);
+            pushed = instruction->value;
+        }
+
+        slots[top]  = pushed;
+        starts[top] = pushed_start;
+        ends[top]   = index;
+        pure[top]   = pushed_pure;
+        top++;
+    }
+
+    // The operands of a successful check are numbers, or an instance, from here on
+    // wherever they are kept
+    if (is_number_check(instruction->op) || instruction->op == OP_SET_PROPERTY)
+    {
+        for (i32 i = 0; i < 2 && instruction->defines[i] != -1; i++)
+        {
+            i32 refined = instruction->defines[i];
+            i32 operand = optimizer->values[refined].operands[0];
+            for (i32 slot = 0; slot < top - 1; slot++)
+            {
+                if (slots[slot] == operand) slots[slot] = refined;
+            }
+        }
+    }
+
+    if (top > optimizer->max_height) optimizer->max_height = top;
+    *height = top;
+    return true;
+}
+
+static b32 build_ssa(Optimizer* optimizer)
+{
+    Chunk* chunk = optimizer->chunk;
+    for (i32 i = 0; i < optimizer->instruction_count; i++)
+    {
+        IrInstruction* instruction = &optimizer->instructions[i];
+        if (instruction->op != OP_CLOSURE) continue;
+
+        u8* code = chunk->code + instruction->offset;
+        ObjFunction* closed = AS_FUNCTION(chunk->constants.values[code[1]]);
+        for (i32 j = 0; j < closed->upvalue_count; j++)
+        {
+            if (code[2 + j * 2]) optimizer->captured[code[3 + j * 2]] = true;
+        }
+    }
+
+    i32 slots[UINT8_COUNT];
+    i32 starts[UINT8_COUNT];
+    i32 ends[UINT8_COUNT];
+    b32 pure[UINT8_COUNT];
+
+    i32 arity_slots = optimizer->function->arity + 1;
+    if (arity_slots > UINT8_COUNT) return false;
+
+    for (i32 i = 0; i < optimizer->order_count; i++)
+    {
+        i32 b = optimizer->order[i];
+        IrBlock* block = &optimizer->blocks[b];
+
+        // Reverse postorder has a predecessor of every block but the first before it
+        i32 first_predecessor = -1;
+        for (i32 j = 0; j < block->predecessor_count; j++)
+        {
+            i32 predecessor = optimizer->predecessors[block->predecessors + j];
+            if (optimizer->blocks[predecessor].order < i)
+            {
+                first_predecessor = predecessor;
+                break;
+            }
+        }
+
+        if (b == 0)
+        {
+            block->height = arity_slots;
+        }
+        else
+        {
+            if (first_predecessor == -1) return false;
+            block->height = optimizer->blocks[first_predecessor].exit_height;
+        }
+
+        // The function entry counts as one more predecessor of the first block
+        i32 edges = block->predecessor_count + (b == 0 ? 1 : 0);
+        block->entry = (i32*)malloc(sizeof(i32) * (block->height + 1));
+        for (i32 slot = 0; slot < block->height; slot++)
+        {
+            i32 value;
+            if (edges == 1 && b == 0)
+            {
+                value = new_value(optimizer, IR_ENTRY, b, -1);
+                optimizer->values[value].operands[0] = slot;
+            }
+            else if (edges == 1)
+            {
+                value = optimizer->blocks[first_predecessor].exit[slot];
+            }
+            else
+            {
+                value = new_value(optimizer, IR_PHI, b, -1);
+                optimizer->phi_operands = (i32*)realloc(optimizer->phi_operands, sizeof(i32) * (optimizer->phi_operand_count + edges));
+                optimizer->values[value].phi_operands = optimizer->phi_operand_count;
+                optimizer->phi_operand_count += edges;
+                if (b == 0)
+                {
+                    i32 entry = new_value(optimizer, IR_ENTRY, b, -1);
+                    optimizer->values[entry].operands[0] = slot;
+                    optimizer->phi_operands[optimizer->values[value].phi_operands + block->predecessor_count] = entry;
+                }
+            }
+            block->entry[slot] = value;
+            slots[slot] = value;
+            pure[slot]  = false;
+        }
+
+        i32 height = block->height;
+        for (i32 index = block->first; index < block->end; index++)
+        {
+            if (!simulate_instruction(optimizer, index, slots, &height, starts, ends, pure, true)) return false;
+        }
+
+        block->exit_height = height;
+        block->exit = (i32*)malloc(sizeof(i32) * (height + 1));
+        memcpy(block->exit, slots, sizeof(i32) * height);
+    }
+
+    for (i32 i = 0; i < optimizer->order_count; i++)
+    {
+        IrBlock* block = &optimizer->blocks[optimizer->order[i]];
+        for (i32 j = 0; j < block->predecessor_count; j++)
+        {
+            IrBlock* predecessor = &optimizer->blocks[optimizer->predecessors[block->predecessors + j]];
+            if (predecessor->exit_height != block->height) return false;
+        }
+
+        if (block->height == 0 || optimizer->values[block->entry[0]].kind != IR_PHI ||
+            optimizer->values[block->entry[0]].block != optimizer->order[i])
+        {
+            continue;
+        }
+
+        for (i32 slot = 0; slot < block->height; slot++)
+        {
+            IrValue* phi = &optimizer->values[block->entry[slot]];
+            for (i32 j = 0; j < block->predecessor_count; j++)
+            {
+                IrBlock* predecessor = &optimizer->blocks[optimizer->predecessors[block->predecessors + j]];
+                optimizer->phi_operands[phi->phi_operands + j] = predecessor->exit[slot];
+            }
+        }
+    }
+    return true;
+}
+
+// Forwards every phi whose operands are all one value, or refinements of it,
+// until none is left. That propagates copies across blocks and loops.
+static void remove_trivial_phis(Optimizer* optimizer)
+{
+    b32 changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (i32 v = 0; v < optimizer->value_count; v++)
+        {
+            IrValue* phi = &optimizer->values[v];
+            if (phi->kind != IR_PHI || phi->forward != -1) continue;
+
+            i32 edges = optimizer->blocks[phi->block].predecessor_count + (phi->block == 0 ? 1 : 0);
+            i32 same = -1;
+            i32 same_root = -1;
+            b32 identical = true;
+            b32 trivial = true;
+            for (i32 i = 0; i < edges; i++)
+            {
+                i32 operand = find_value(optimizer, optimizer->phi_operands[phi->phi_operands + i]);
+                i32 root = root_value(optimizer, operand);
+                if (root == v) continue;
+
+                if (same == -1)
+                {
+                    same = operand;
+                    same_root = root;
+                }
+                else if (root != same_root)
+                {
+                    trivial = false;
+                    break;
+                }
+                else if (operand != same)
+                {
+                    identical = false;
+                }
+            }
+
+            if (trivial && same != -1)
+            {
+                optimizer->values[v].forward = identical ? same : same_root;
+                changed = true;
+            }
+        }
+    }
+}
+
+static void infer_types(Optimizer* optimizer)
+{
+    for (i32 v = 0; v < optimizer->value_count; v++)
+    {
+        IrValue* value = &optimizer->values[v];
+        switch (value->kind)
+        {
+            case IR_CONSTANT:
+            {
+                if (IS_INT(value->constant))         value->types = IR_TYPE_INT;
+                else if (IS_NUMBER(value->constant)) value->types = IR_TYPE_DOUBLE;
+                else if (IS_STRING(value->constant)) value->types = IR_TYPE_STRING;
+                else                                 value->types = IR_TYPE_OTHER;
+            }
+            break;
+            case IR_ENTRY:
+            {
+                // The receiver of a method
+                b32 receiver = optimizer->method && value->operands[0] == 0;
+                value->types = receiver ? IR_TYPE_INSTANCE : IR_TYPE_ANY;
+            }
+            break;
+            case IR_UNKNOWN: value->types = IR_TYPE_ANY; break;
+            default: value->types = 0; break;
+        }
+    }
+
+    // Values start out as nothing and only ever grow, so loops settle on the
+    // types their phis can really have
+    b32 changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (i32 v = 0; v < optimizer->value_count; v++)
+        {
+            IrValue* value = &optimizer->values[v];
+            if (value->forward != -1) continue;
+
+            u8 types = value->types;
+            switch (value->kind)
+            {
+                case IR_PHI:
+                {
+                    i32 edges = optimizer->blocks[value->block].predecessor_count + (value->block == 0 ? 1 : 0);
+                    for (i32 i = 0; i < edges; i++)
+                    {
+                        types |= value_types(optimizer, optimizer->phi_operands[value->phi_operands + i]);
+                    }
+                }
+                break;
+                case IR_REFINE:
+                {
+                    u8 mask = value->op == OP_SET_PROPERTY ? IR_TYPE_INSTANCE : IR_TYPE_NUMBER;
+                    types |= value_types(optimizer, value->operands[0]) & mask;
+                }
+                break;
+                case IR_OP:
+                {
+                    u8 a = value_types(optimizer, value->operands[0]);
+                    u8 b = value->operands[1] != -1 ? value_types(optimizer, value->operands[1]) : 0;
+                    switch (value->op)
+                    {
+                        case OP_ADD:
+                        {
+                            if (!((a | b) & ~IR_TYPE_NUMBER))      types |= IR_TYPE_NUMBER;
+                            else if (!((a | b) & ~IR_TYPE_STRING)) types |= IR_TYPE_STRING;
+                            else                                   types |= IR_TYPE_ANY;
+                        }
+                        break;
+                        case OP_SUBTRACT:
+                        case OP_MULTIPLY:
+                        case OP_DIVIDE:
+                        case OP_NEGATE:
+                        {
+                            // Vectors give anything but numbers
+                            types |= (a | b) & ~IR_TYPE_NUMBER ? IR_TYPE_ANY : IR_TYPE_NUMBER;
+                        }
+                        break;
+                        case OP_EQUAL:
+                        case OP_GREATER:
+                        case OP_LESS:
+                        case OP_NOT: types |= IR_TYPE_OTHER; break;
+                        default:     types |= IR_TYPE_INT; break;
+                    }
+                }
+                break;
+                default: break;
+            }
+
+            if (types != value->types)
+            {
+                value->types = types;
+                changed = true;
+            }
+        }
+    }
+}
+
+static i32 value_number(Optimizer* optimizer, i32 value)
+{
+    value = root_value(optimizer, value);
+    IrValueKind kind = optimizer->values[value].kind;
+    return kind == IR_OP || kind == IR_CONSTANT ? optimizer->values[value].number : value;
+}
+
+// Constants that behave the same in every operation. Equal numbers also have
+// to agree on being ints and on the sign of zero.
+static b32 same_constant(Value a, Value b)
+{
+    if (!values_equal(a, b)) return false;
+    if (!IS_NUMBER(a)) return true;
+
+    f64 x = AS_NUMBER(a);
+    f64 y = AS_NUMBER(b);
+    return IS_INT(a) == IS_INT(b) && memcmp(&x, &y, sizeof(f64)) == 0;
+}
+
+// Gives every IR_OP the number of the first op with the same operation and
+// operand numbers whose block dominates it. Going through the blocks in reverse
+// postorder that op has already been numbered.
+static void number_values(Optimizer* optimizer)
+{
+    optimizer->hash_capacity = 16;
+    while (optimizer->hash_capacity < optimizer->value_count * 2) optimizer->hash_capacity *= 2;
+    optimizer->hash_buckets = (i32*)malloc(sizeof(i32) * optimizer->hash_capacity);
+    for (i32 i = 0; i < optimizer->hash_capacity; i++)
+    {
+        optimizer->hash_buckets[i] = -1;
+    }
+
+    // The same constant often has several entries in the constant table
+    i32* constants = (i32*)malloc(sizeof(i32) * (optimizer->value_count + 1));
+    i32 constant_count = 0;
+    for (i32 v = 0; v < optimizer->value_count; v++)
+    {
+        IrValue* value = &optimizer->values[v];
+        if (value->kind != IR_CONSTANT) continue;
+
+        i32 i = 0;
+        while (i < constant_count && !same_constant(optimizer->values[constants[i]].constant, value->constant)) i++;
+        if (i == constant_count) constants[constant_count++] = v;
+        value->number = constants[i];
+    }
+    free(constants);
+
+    for (i32 i = 0; i < optimizer->order_count; i++)
+    {
+        IrBlock* block = &optimizer->blocks[optimizer->order[i]];
+        for (i32 index = block->first; index < block->end; index++)
+        {
+            i32 v = optimizer->instructions[index].value;
+            if (v == -1 || optimizer->values[v].kind != IR_OP || optimizer->values[v].instruction != index) continue;
+
+            IrValue* value = &optimizer->values[v];
+            i32 a = value_number(optimizer, value->operands[0]);
+            i32 b = value->operands[1] != -1 ? value_number(optimizer, value->operands[1]) : -1;
+            u32 hash = ((u32)value->op * 0x9e3779b1u) ^ ((u32)a * 0x85ebca6bu) ^ ((u32)(b + 1) * 0xc2b2ae35u);
+            i32* bucket = &optimizer->hash_buckets[hash & (optimizer->hash_capacity - 1)];
+
+            b32 found = false;
+            for (i32 candidate = *bucket; candidate != -1; candidate = optimizer->values[candidate].next_same_hash)
+            {
+                IrValue* other = &optimizer->values[candidate];
+                if (other->op != value->op || value_number(optimizer, other->operands[0]) != a) continue;
+                if ((other->operands[1] != -1 ? value_number(optimizer, other->operands[1]) : -1) != b) continue;
+                if (!dominates(optimizer, other->block, value->block)) continue;
+
+                value->number = candidate;
+                found = true;
+                break;
+            }
+
+            if (!found)
+            {
+                value->next_same_hash = *bucket;
+                *bucket = v;
+            }
+        }
+    }
+}
+
+// The function a call at index can be inlined with, or NULL. The callee has to be
+// loaded from a global that now holds a small closure without upvalues, which
+// does not call itself by that name and whose body the optimizer can relocate.
+static ObjFunction* inline_candidate(Optimizer* optimizer, i32 index)
+{
+    IrInstruction* instruction = &optimizer->instructions[index];
+    Chunk* chunk = optimizer->chunk;
+    VM* vm = optimizer->gc->vm;
+    i32 callee_value = instruction->defines[0];
+    if (vm == NULL || callee_value == -1) return NULL;
+
+    IrValue* value = &optimizer->values[callee_value];
+    if (value->kind != IR_UNKNOWN || value->instruction < 0) return NULL;
+
+    IrInstruction* load = &optimizer->instructions[value->instruction];
+    if (load->op != OP_GET_GLOBAL) return NULL;
+
+    Value name = chunk->constants.values[chunk->code[load->offset + 1]];
+    Value global;
+    if (!table_get(&vm->globals, AS_STRING(name), &global) || !IS_CLOSURE(global)) return NULL;
+
+    ObjClosure* closure = AS_CLOSURE(global);
+    ObjFunction* callee = closure->function;
+    if (callee == optimizer->function || closure->upvalue_count != 0) return NULL;
+    if (callee->arity != chunk->code[instruction->offset + 1]) return NULL;
+    if (callee->image != NULL || callee->lazy_source != NULL) return NULL;
+
+    // An optimized callee still has its baseline code
+    Chunk* body = callee->baseline.code != NULL ? &callee->baseline : &callee->chunk;
+    if (body->count > INLINE_SIZE_MAX) return NULL;
+
+    for (i32 offset = 0; offset < body->count;)
+    {
+        switch (body->code[offset])
+        {
+            case OP_WIDE:
+            case OP_WIDE_LONG:
+            case OP_GET_UPVALUE:
+            case OP_SET_UPVALUE:
+            case OP_CLOSURE:
+            case OP_CLOSE_UPVALUE:
+            case OP_SWITCH_TABLE:
+            case OP_SWITCH_HASH: return NULL;
+            case OP_GET_GLOBAL:
+            {
+                Value called = callee->chunk.constants.values[body->code[offset + 1]];
+                if (values_equal(called, name)) return NULL;
+            }
+            break;
+        }
+        offset += instruction_length(body, offset);
+    }
+    if (body->count == 0 || body->code[body->count - 1] != OP_RETURN) return NULL;
+    return callee;
+}
+
+// The index of value in the constants of the optimized function, adding it when
+// it is new, or -1 when the table is full
+static i32 inline_constant(Optimizer* optimizer, Value value)
+{
+    ValueArray* constants = &optimizer->function->chunk.constants;
+    for (i32 i = 0; i < constants->count; i++)
+    {
+        if (same_constant(constants->values[i], value) &&
+            (!IS_OBJ(value) || IS_STRING(value) || AS_OBJ(constants->values[i]) == AS_OBJ(value)))
+        {
+            return i;
+        }
+    }
+
+    if (constants->count >= UINT8_COUNT) return -1;
+    return add_constant(optimizer->gc, &optimizer->function->chunk, value);
+}
+
+static void add_inline_jump(InlineJump** jumps, i32* count, i32* capacity, i32 position, i32 target, b32 backward)
+{
+    if (*capacity < *count + 1)
+    {
+        *capacity = GROW_CAPACITY(*capacity);
+        *jumps = (InlineJump*)realloc(*jumps, sizeof(InlineJump) * *capacity);
+    }
+
+    InlineJump* jump = &(*jumps)[(*count)++];
+    jump->position = position;
+    jump->target   = target;
+    jump->backward = backward;
+}
+
+// Writes the distance from the end of the operand at position to address into it
+static b32 patch_inline_jump(Optimizer* optimizer, InlineJump* jump, i32 address)
+{
+    i32 base = jump->position + 2;
+    i32 distance = jump->backward ? base - address : address - base;
+    if (distance < 0 || distance > UINT16_MAX) return false;
+
+    optimizer->code[jump->position]     = (u8)((distance >> 8) & 0xff);
+    optimizer->code[jump->position + 1] = (u8)(distance & 0xff);
+    return true;
+}
+
+// Emits the call at index as
+//     OP_GUARD_CALLEE callee, args -> fallback
+//     the body of callee, its slots moved up to where the callee is on the stack
+//     and every OP_RETURN an OP_INLINED_RETURN to that slot and a jump to the end
+//     fallback: OP_CALL args
+// so a global rebound to anything else still gets called. The body keeps the
+// line of the call. Returns false, with nothing emitted, when it does not fit.
+static b32 inline_call(Optimizer* optimizer, i32 index, ObjFunction* callee)
+{
+    IrInstruction* instruction = &optimizer->instructions[index];
+    u8 arg_count = optimizer->chunk->code[instruction->offset + 1];
+    i32 line = optimizer->source_lines[instruction->offset];
+    i32 base = instruction->height - arg_count - 1;
+
+    Chunk* body = callee->baseline.code != NULL ? &callee->baseline : &callee->chunk;
+    Value* constants = callee->chunk.constants.values;
+    i32 start = optimizer->count;
+
+    i32* offsets = (i32*)malloc(sizeof(i32) * (body->count + 1));
+    InlineJump* jumps = NULL;
+    i32 jump_count = 0;
+    i32 jump_capacity = 0;
+    b32 ok = true;
+
+    i32 guard = inline_constant(optimizer, OBJ_VAL(callee));
+    if (guard == -1) ok = false;
+    emit_optimized_byte(optimizer, OP_GUARD_CALLEE, line);
+    emit_optimized_byte(optimizer, (u8)guard, line);
+    emit_optimized_byte(optimizer, arg_count, line);
+    i32 guard_jump = optimizer->count;
+    emit_optimized_byte(optimizer, 0xff, line);
+    emit_optimized_byte(optimizer, 0xff, line);
+
+    for (i32 offset = 0; ok && offset < body->count;)
+    {
+        u8* code = body->code + offset;
+        i32 length = instruction_length(body, offset);
+        offsets[offset] = optimizer->count;
+
+        switch (checked_op(code[0]))
+        {
+            case OP_CONSTANT:
+            case OP_GET_GLOBAL:
+            case OP_DEFINE_GLOBAL:
+            case OP_SET_GLOBAL:
+            case OP_GET_PROPERTY:
+            case OP_SET_PROPERTY:
+            case OP_GET_SUPER:
+            case OP_CLASS:
+            case OP_METHOD:
+            case OP_INVOKE:
+            case OP_SUPER_INVOKE:
+            {
+                i32 constant = inline_constant(optimizer, constants[code[1]]);
+                if (constant == -1)
+                {
+                    ok = false;
+                    break;
+                }
+                emit_optimized_byte(optimizer, code[0], line);
+                emit_optimized_byte(optimizer, (u8)constant, line);
+                if (length == 3) emit_optimized_byte(optimizer, code[2], line);
+            }
+            break;
+            case OP_GET_LOCAL:
+            case OP_SET_LOCAL:
+            {
+                if (base + code[1] >= UINT8_COUNT)
+                {
+                    ok = false;
+                    break;
+                }
+                emit_optimized_byte(optimizer, code[0], line);
+                emit_optimized_byte(optimizer, (u8)(base + code[1]), line);
+            }
+            break;
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+            case OP_LOOP:
+            {
+                u16 jump = (u16)(code[1] << 8 | code[2]);
+                b32 backward = code[0] == OP_LOOP;
+                emit_optimized_byte(optimizer, code[0], line);
+                add_inline_jump(&jumps, &jump_count, &jump_capacity, optimizer->count,
+                                backward ? offset + 3 - jump : offset + 3 + jump, backward);
+                emit_optimized_byte(optimizer, 0xff, line);
+                emit_optimized_byte(optimizer, 0xff, line);
+            }
+            break;
+            case OP_FOR_ITER:
+            {
+                if (base + code[1] + 2 >= UINT8_COUNT)
+                {
+                    ok = false;
+                    break;
+                }
+                emit_optimized_byte(optimizer, code[0], line);
+                emit_optimized_byte(optimizer, (u8)(base + code[1]), line);
+                add_inline_jump(&jumps, &jump_count, &jump_capacity, optimizer->count,
+                                offset + 4 + (u16)(code[2] << 8 | code[3]), false);
+                emit_optimized_byte(optimizer, 0xff, line);
+                emit_optimized_byte(optimizer, 0xff, line);
+                add_inline_jump(&jumps, &jump_count, &jump_capacity, optimizer->count,
+                                offset + 6 + (u16)(code[4] << 8 | code[5]), false);
+                emit_optimized_byte(optimizer, 0xff, line);
+                emit_optimized_byte(optimizer, 0xff, line);
+            }
+            break;
+            case OP_RETURN:
+            {
+                // -1 stands for the end of the inlined call
+                emit_optimized_byte(optimizer, OP_INLINED_RETURN, line);
+                emit_optimized_byte(optimizer, (u8)base, line);
+                emit_optimized_byte(optimizer, OP_JUMP, line);
+                add_inline_jump(&jumps, &jump_count, &jump_capacity, optimizer->count, -1, false);
+                emit_optimized_byte(optimizer, 0xff, line);
+                emit_optimized_byte(optimizer, 0xff, line);
+            }
+            break;
+            default:
+            {
+                for (i32 i = 0; i < length; i++)
+                {
+                    emit_optimized_byte(optimizer, code[i], line);
+                }
+            }
+            break;
+        }
+        offset += length;
+    }
+
+    i32 fallback = optimizer->count;
+    emit_optimized_byte(optimizer, OP_CALL, line);
+    emit_optimized_byte(optimizer, arg_count, line);
+    i32 end = optimizer->count;
+
+    InlineJump guard_operand = {guard_jump, 0, false};
+    if (ok) ok = patch_inline_jump(optimizer, &guard_operand, fallback);
+    for (i32 i = 0; ok && i < jump_count; i++)
+    {
+        i32 target = jumps[i].target;
+        if (target != -1 && (target < 0 || target >= body->count))
+        {
+            ok = false;
+            break;
+        }
+        ok = patch_inline_jump(optimizer, &jumps[i], target == -1 ? end : offsets[target]);
+    }
+
+    free(offsets);
+    free(jumps);
+    if (!ok) optimizer->count = start;
+    return ok;
+}
+
+// Rewrites the code with the calls that inline_candidate accepts inlined, and
+// leaves it in the output buffer. Returns false, with the buffer empty, when
+// nothing was inlined.
+static b32 inline_calls(Optimizer* optimizer)
+{
+    Chunk* chunk = optimizer->chunk;
+    i32* offsets = (i32*)malloc(sizeof(i32) * (chunk->count + 1));
+    InlineJump* jumps = NULL;
+    i32 jump_count = 0;
+    i32 jump_capacity = 0;
+    b32 inlined = false;
+
+    for (i32 index = 0; index < optimizer->instruction_count; index++)
+    {
+        IrInstruction* instruction = &optimizer->instructions[index];
+        u8* code = chunk->code + instruction->offset;
+        i32 line = optimizer->source_lines[instruction->offset];
+        offsets[instruction->offset] = optimizer->count;
+
+        if (instruction->op == OP_CALL && optimizer->blocks[instruction->block].order != -1)
+        {
+            ObjFunction* callee = inline_candidate(optimizer, index);
+            if (callee != NULL && inline_call(optimizer, index, callee))
+            {
+                inlined = true;
+                continue;
+            }
+        }
+
+        switch (instruction->op)
+        {
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+            case OP_LOOP:
+            {
+                emit_optimized_byte(optimizer, code[0], line);
+                add_inline_jump(&jumps, &jump_count, &jump_capacity, optimizer->count,
+                                optimizer->instructions[jump_target(optimizer, instruction, 0)].offset, code[0] == OP_LOOP);
+                emit_optimized_byte(optimizer, 0xff, line);
+                emit_optimized_byte(optimizer, 0xff, line);
+            }
+            break;
+            case OP_FOR_ITER:
+            {
+                emit_optimized_byte(optimizer, code[0], line);
+                emit_optimized_byte(optimizer, code[1], line);
+                for (i32 which = 0; which < 2; which++)
+                {
+                    add_inline_jump(&jumps, &jump_count, &jump_capacity, optimizer->count,
+                                    optimizer->instructions[jump_target(optimizer, instruction, which)].offset, false);
+                    emit_optimized_byte(optimizer, 0xff, line);
+                    emit_optimized_byte(optimizer, 0xff, line);
+                }
+            }
+            break;
+            default:
+            {
+                for (i32 i = 0; i < instruction->length; i++)
+                {
+                    emit_optimized_byte(optimizer, code[i], line);
+                }
+            }
+            break;
+        }
+    }
+
+    for (i32 i = 0; inlined && i < jump_count; i++)
+    {
+        if (!patch_inline_jump(optimizer, &jumps[i], offsets[jumps[i].target])) inlined = false;
+    }
+
+    free(offsets);
+    free(jumps);
+    if (!inlined) optimizer->count = 0;
+    return inlined;
+}
+
+// The unchecked form of the instruction at index when the types of its operands
+// are known, otherwise the instruction itself. Code that was already specialized
+// stays that way.
+static u8 unchecked_op(Optimizer* optimizer, i32 index)
+{
+    IrInstruction* instruction = &optimizer->instructions[index];
+    if (instruction->specialized) return optimizer->chunk->code[instruction->offset];
+
+    switch (instruction->op)
+    {
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        {
+            if (instruction->receiver == -1 || value_types(optimizer, instruction->receiver) & ~IR_TYPE_INSTANCE)
+            {
+                return instruction->op;
+            }
+            return instruction->op == OP_GET_PROPERTY ? OP_GET_PROPERTY_INSTANCE : OP_SET_PROPERTY_INSTANCE;
+        }
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_LESS:
+        case OP_GREATER:
+        case OP_NEGATE: break;
+        default: return instruction->op;
+    }
+
+    IrValue* value = &optimizer->values[instruction->value];
+    u8 types = value_types(optimizer, value->operands[0]);
+    if (value->operands[1] != -1) types |= value_types(optimizer, value->operands[1]);
+
+    if (instruction->op == OP_ADD && !(types & ~IR_TYPE_STRING) && types != 0) return OP_ADD_STRING;
+    if (types & ~IR_TYPE_NUMBER) return instruction->op;
+
+    switch (instruction->op)
+    {
+        case OP_ADD:      return OP_ADD_NUMBER;
+        case OP_SUBTRACT: return OP_SUBTRACT_NUMBER;
+        case OP_MULTIPLY: return OP_MULTIPLY_NUMBER;
+        case OP_DIVIDE:   return OP_DIVIDE_NUMBER;
+        case OP_LESS:     return OP_LESS_NUMBER;
+        case OP_GREATER:  return OP_GREATER_NUMBER;
+        default:          return OP_NEGATE_NUMBER;
+    }
+}
+
+// A slot that holds value when the loop at header is entered and that the loop
+// did not set, or -1
+static i32 invariant_slot(Optimizer* optimizer, i32 header, i32 value)
+{
+    IrBlock* block = &optimizer->blocks[header];
+    i32 root = root_value(optimizer, value);
+    for (i32 slot = 0; slot < block->height; slot++)
+    {
+        if (optimizer->captured[slot]) continue;
+
+        i32 entry = find_value(optimizer, block->entry[slot]);
+        if (optimizer->values[entry].kind == IR_PHI && optimizer->values[entry].block == header) continue;
+        if (root_value(optimizer, entry) == root) return slot;
+    }
+    return -1;
+}
+
+// Whether the code computing the value of the instruction at index can run
+// before the loop at header instead. It has to read only constants and slots
+// the loop does not change, and can't fail, since the loop might not run at all.
+static b32 hoistable(Optimizer* optimizer, i32 index, i32 header)
+{
+    IrInstruction* instruction = &optimizer->instructions[index];
+    if (instruction->range_start == -1) return false;
+
+    for (i32 i = instruction->range_start; i <= index; i++)
+    {
+        IrInstruction* part = &optimizer->instructions[i];
+        switch (part->op)
+        {
+            case OP_CONSTANT:
+            case OP_NIL:
+            case OP_TRUE:
+            case OP_FALSE: break;
+            case OP_GET_LOCAL:
+            {
+                i32 root = root_value(optimizer, part->value);
+                if (optimizer->values[root].kind == IR_CONSTANT) break;
+                if (invariant_slot(optimizer, header, part->value) == -1) return false;
+            }
+            break;
+            case OP_EQUAL:
+            case OP_NOT: break;
+            default:
+            {
+                // Unchecked arithmetic never fails. On operands that are not numbers
+                // after all it makes up a value, but then the check that told the
+                // optimizer they are fails before anything reads it.
+                if (unchecked_op(optimizer, i) == part->op) return false;
+            }
+            break;
+        }
+    }
+    return true;
+}
+
+static i32 new_temp(Optimizer* optimizer)
+{
+    return optimizer->temp_count++;
+}
+
+// Where an original slot ends up, the temps go right after the arguments
+static i32 frame_slot(Optimizer* optimizer, i32 slot)
+{
+    return slot <= optimizer->function->arity ? slot : slot + optimizer->temp_count;
+}
+
+// Loads refer to original slots, or to temps from UINT8_COUNT on
+static i32 load_slot(Optimizer* optimizer, i32 load)
+{
+    if (load >= UINT8_COUNT) return optimizer->function->arity + 1 + load - UINT8_COUNT;
+    return frame_slot(optimizer, load);
+}
+
+// Going backwards, the largest expressions are seen before the ones inside them.
+// Each is hoisted to the outermost loop it does not change in.
+static void hoist_invariants(Optimizer* optimizer)
+{
+    for (i32 index = optimizer->instruction_count - 1; index >= 0; index--)
+    {
+        IrInstruction* instruction = &optimizer->instructions[index];
+        i32 v = instruction->value;
+        if (instruction->skipped || optimizer->blocks[instruction->block].order == -1) continue;
+        if (v == -1 || optimizer->values[v].kind != IR_OP || optimizer->values[v].instruction != index) continue;
+        if (optimizer->temp_count == optimizer->temp_limit) return;
+
+        i32 header = -1;
+        for (i32 loop = optimizer->blocks[instruction->block].loop;
+             loop != -1 && hoistable(optimizer, index, loop);
+             loop = optimizer->blocks[loop].parent_loop)
+        {
+            header = loop;
+        }
+        if (header == -1) continue;
+
+        IrValue* value = &optimizer->values[v];
+        value->hoisted      = true;
+        value->temp         = new_temp(optimizer);
+        value->next_hoisted = optimizer->blocks[header].hoisted;
+        optimizer->blocks[header].hoisted = v;
+
+        instruction->load = UINT8_COUNT + value->temp;
+        for (i32 i = instruction->range_start; i < index; i++)
+        {
+            optimizer->instructions[i].skipped = true;
+        }
+        optimizer->improved = true;
+    }
+}
+
+// For every op that recomputes an earlier value, a slot below its code that
+// already holds that value, or -1
+static void find_available_slots(Optimizer* optimizer, i32* slots_holding)
+{
+    i32 slots[UINT8_COUNT];
+    i32 starts[UINT8_COUNT];
+    i32 ends[UINT8_COUNT];
+    b32 pure[UINT8_COUNT];
+
+    for (i32 i = 0; i < optimizer->instruction_count; i++)
+    {
+        slots_holding[i] = -1;
+    }
+
+    for (i32 i = 0; i < optimizer->order_count; i++)
+    {
+        IrBlock* block = &optimizer->blocks[optimizer->order[i]];
+        i32 height = block->height;
+        for (i32 slot = 0; slot < height; slot++)
+        {
+            slots[slot] = block->entry[slot];
+            pure[slot]  = false;
+        }
+
+        for (i32 index = block->first; index < block->end; index++)
+        {
+            IrInstruction* instruction = &optimizer->instructions[index];
+            i32 v = instruction->value;
+            if (v != -1 && optimizer->values[v].kind == IR_OP && optimizer->values[v].instruction == index &&
+                optimizer->values[v].number != v && instruction->range_start != -1)
+            {
+                i32 limit = optimizer->instructions[instruction->range_start].height;
+                for (i32 slot = 0; slot < limit; slot++)
+                {
+                    if (!optimizer->captured[slot] && value_number(optimizer, slots[slot]) == optimizer->values[v].number)
+                    {
+                        slots_holding[index] = slot;
+                        break;
+                    }
+                }
+            }
+
+            simulate_instruction(optimizer, index, slots, &height, starts, ends, pure, false);
+        }
+    }
+}
+
+// Replaces code that recomputes a value with a load of the slot that holds it.
+// The first computation keeps its value in a temp when nothing else does.
+static b32 eliminate_common_subexpressions(Optimizer* optimizer)
+{
+    i32* slots_holding = (i32*)malloc(sizeof(i32) * optimizer->instruction_count);
+    find_available_slots(optimizer, slots_holding);
+
+    for (i32 index = optimizer->instruction_count - 1; index >= 0; index--)
+    {
+        IrInstruction* instruction = &optimizer->instructions[index];
+        i32 v = instruction->value;
+        if (instruction->skipped || instruction->load != -1 || optimizer->blocks[instruction->block].order == -1) continue;
+        if (v == -1 || optimizer->values[v].kind != IR_OP || optimizer->values[v].instruction != index) continue;
+        if (optimizer->values[v].number == v || instruction->range_start == -1) continue;
+
+        IrValue* first = &optimizer->values[optimizer->values[v].number];
+        i32 load;
+        if (slots_holding[index] != -1)
+        {
+            load = slots_holding[index];
+        }
+        else if (first->hoisted)
+        {
+            load = UINT8_COUNT + first->temp;
+        }
+        else if (optimizer->instructions[first->instruction].skipped)
+        {
+            continue;
+        }
+        else if (first->temp != -1)
+        {
+            load = UINT8_COUNT + first->temp;
+        }
+        else if (optimizer->temp_count < optimizer->temp_limit)
+        {
+            first->temp = new_temp(optimizer);
+            load = UINT8_COUNT + first->temp;
+        }
+        else
+        {
+            continue;
+        }
+
+        instruction->load = load;
+        for (i32 i = instruction->range_start; i < index; i++)
+        {
+            optimizer->instructions[i].skipped = true;
+        }
+        optimizer->improved = true;
+    }
+    free(slots_holding);
+
+    // A value kept in a temp has to be computed where it was
+    for (i32 v = 0; v < optimizer->value_count; v++)
+    {
+        IrValue* value = &optimizer->values[v];
+        if (value->temp != -1 && !value->hoisted && optimizer->instructions[value->instruction].skipped) return false;
+    }
+    return true;
+}
+
+static void emit_optimized_byte(Optimizer* optimizer, u8 byte, i32 line)
+{
+    if (optimizer->capacity < optimizer->count + 1)
+    {
+        optimizer->capacity = GROW_CAPACITY(optimizer->capacity);
+        optimizer->code  = (u8*)realloc(optimizer->code, sizeof(u8) * optimizer->capacity);
+        optimizer->lines = (i32*)realloc(optimizer->lines, sizeof(i32) * optimizer->capacity);
+    }
+    optimizer->code[optimizer->count]  = byte;
+    optimizer->lines[optimizer->count] = line;
+    optimizer->count++;
+}
+
+// The VM adds or subtracts every jump operand right after reading it
+static void emit_jump_operand(Optimizer* optimizer, i32 target, i32 source, b32 backward, i32 line)
+{
+    if (optimizer->jump_capacity < optimizer->jump_count + 1)
+    {
+        optimizer->jump_capacity = GROW_CAPACITY(optimizer->jump_capacity);
+        optimizer->jumps = (IrJump*)realloc(optimizer->jumps, sizeof(IrJump) * optimizer->jump_capacity);
+    }
+
+    IrJump* jump = &optimizer->jumps[optimizer->jump_count++];
+    jump->position = optimizer->count;
+    jump->base     = optimizer->count + 2;
+    jump->target   = target;
+    jump->source   = source;
+    jump->backward = backward;
+
+    emit_optimized_byte(optimizer, 0xff, line);
+    emit_optimized_byte(optimizer, 0xff, line);
+}
+
+static void emit_instruction(Optimizer* optimizer, i32 index)
+{
+    IrInstruction* instruction = &optimizer->instructions[index];
+    u8* code = optimizer->chunk->code + instruction->offset;
+    i32 line = optimizer->source_lines[instruction->offset];
+
+    switch (instruction->op)
+    {
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_INLINED_RETURN:
+        {
+            emit_optimized_byte(optimizer, instruction->op, line);
+            emit_optimized_byte(optimizer, (u8)frame_slot(optimizer, code[1]), line);
+        }
+        break;
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        {
+            i32 target = optimizer->instructions[jump_target(optimizer, instruction, 0)].block;
+            emit_optimized_byte(optimizer, instruction->op, line);
+            emit_jump_operand(optimizer, target, instruction->block, instruction->op == OP_LOOP, line);
+        }
+        break;
+        case OP_GUARD_CALLEE:
+        {
+            i32 target = optimizer->instructions[jump_target(optimizer, instruction, 0)].block;
+            emit_optimized_byte(optimizer, code[0], line);
+            emit_optimized_byte(optimizer, code[1], line);
+            emit_optimized_byte(optimizer, code[2], line);
+            emit_jump_operand(optimizer, target, instruction->block, false, line);
+        }
+        break;
+        case OP_FOR_ITER:
+        {
+            i32 exit = optimizer->instructions[jump_target(optimizer, instruction, 0)].block;
+            i32 body = optimizer->instructions[jump_target(optimizer, instruction, 1)].block;
+            emit_optimized_byte(optimizer, instruction->op, line);
+            emit_optimized_byte(optimizer, (u8)frame_slot(optimizer, code[1]), line);
+            emit_jump_operand(optimizer, exit, instruction->block, false, line);
+            emit_jump_operand(optimizer, body, instruction->block, false, line);
+        }
+        break;
+        case OP_SWITCH_TABLE:
+        case OP_SWITCH_HASH:
+        {
+            // The same table with new distances, which count back from its end
+            i32 first_jump = optimizer->jump_count;
+            i32 header = instruction->op == OP_SWITCH_TABLE ? SWITCH_TABLE_HEADER : SWITCH_HASH_HEADER;
+            i32 entry_length = instruction->op == OP_SWITCH_TABLE ? 2 : SWITCH_HASH_ENTRY;
+            for (i32 i = 0; i < header - 2; i++)
+            {
+                emit_optimized_byte(optimizer, code[i], line);
+            }
+
+            i32 targets = jump_target_count(optimizer, instruction);
+            for (i32 which = 0; which < targets; which++)
+            {
+                // Hash entries keep their label constant in front of the distance
+                for (i32 i = 2; which > 0 && i < entry_length; i++)
+                {
+                    emit_optimized_byte(optimizer, code[header + entry_length * (which - 1) + i - 2], line);
+                }
+                i32 target = optimizer->instructions[jump_target(optimizer, instruction, which)].block;
+                emit_jump_operand(optimizer, target, instruction->block, true, line);
+            }
+
+            for (i32 i = first_jump; i < optimizer->jump_count; i++)
+            {
+                optimizer->jumps[i].base = optimizer->count;
+            }
+        }
+        break;
+        case OP_CLOSURE:
+        {
+            emit_optimized_byte(optimizer, code[0], line);
+            emit_optimized_byte(optimizer, code[1], line);
+            for (i32 i = 2; i < instruction->length; i += 2)
+            {
+                u8 is_local = code[i];
+                emit_optimized_byte(optimizer, is_local, line);
+                emit_optimized_byte(optimizer, is_local ? (u8)frame_slot(optimizer, code[i + 1]) : code[i + 1], line);
+            }
+        }
+        break;
+        default:
+        {
+            u8 op = unchecked_op(optimizer, index);
+            if (op != optimizer->chunk->code[instruction->offset]) optimizer->improved = true;
+
+            emit_optimized_byte(optimizer, op, line);
+            for (i32 i = 1; i < instruction->length; i++)
+            {
+                emit_optimized_byte(optimizer, code[i], line);
+            }
+        }
+        break;
+    }
+}
+
+// Computes a hoisted value before the loop at header and keeps it in its temp
+static void emit_hoisted(Optimizer* optimizer, i32 header, i32 v)
+{
+    IrValue* value = &optimizer->values[v];
+    IrInstruction* instruction = &optimizer->instructions[value->instruction];
+    for (i32 i = instruction->range_start; i <= value->instruction; i++)
+    {
+        IrInstruction* part = &optimizer->instructions[i];
+        i32 line = optimizer->source_lines[part->offset];
+        if (part->op != OP_GET_LOCAL)
+        {
+            emit_instruction(optimizer, i);
+            continue;
+        }
+
+        i32 root = root_value(optimizer, part->value);
+        if (optimizer->values[root].kind == IR_CONSTANT)
+        {
+            emit_instruction(optimizer, optimizer->values[root].instruction);
+            continue;
+        }
+
+        emit_optimized_byte(optimizer, OP_GET_LOCAL, line);
+        emit_optimized_byte(optimizer, (u8)frame_slot(optimizer, invariant_slot(optimizer, header, part->value)), line);
+    }
+
+    i32 line = optimizer->source_lines[instruction->offset];
+    emit_optimized_byte(optimizer, OP_SET_LOCAL, line);
+    emit_optimized_byte(optimizer, (u8)load_slot(optimizer, UINT8_COUNT + value->temp), line);
+    emit_optimized_byte(optimizer, OP_POP, line);
+}
+
+// Lays the reachable blocks out in their old order. A loop header with hoisted
+// values has them right in front of it: code entering the loop runs them, its
+// back edges jump past them.
+static b32 emit_optimized(Optimizer* optimizer)
+{
+    for (i32 i = 0; i < optimizer->temp_count; i++)
+    {
+        emit_optimized_byte(optimizer, OP_NIL, optimizer->source_lines[0]);
+    }
+
+    for (i32 b = 0; b < optimizer->block_count; b++)
+    {
+        IrBlock* block = &optimizer->blocks[b];
+        if (block->order == -1) continue;
+
+        block->pre_label = optimizer->count;
+        for (i32 v = block->hoisted; v != -1; v = optimizer->values[v].next_hoisted)
+        {
+            emit_hoisted(optimizer, b, v);
+        }
+        block->post_label = optimizer->count;
+
+        for (i32 index = block->first; index < block->end; index++)
+        {
+            IrInstruction* instruction = &optimizer->instructions[index];
+            if (instruction->skipped) continue;
+
+            i32 line = optimizer->source_lines[instruction->offset];
+            if (instruction->load != -1)
+            {
+                emit_optimized_byte(optimizer, OP_GET_LOCAL, line);
+                emit_optimized_byte(optimizer, (u8)load_slot(optimizer, instruction->load), line);
+                continue;
+            }
+
+            emit_instruction(optimizer, index);
+
+            i32 v = instruction->value;
+            if (v != -1 && optimizer->values[v].kind == IR_OP && optimizer->values[v].instruction == index &&
+                optimizer->values[v].temp != -1)
+            {
+                emit_optimized_byte(optimizer, OP_SET_LOCAL, line);
+                emit_optimized_byte(optimizer, (u8)load_slot(optimizer, UINT8_COUNT + optimizer->values[v].temp), line);
+            }
+        }
+    }
+
+    for (i32 i = 0; i < optimizer->jump_count; i++)
+    {
+        IrJump* jump = &optimizer->jumps[i];
+        IrBlock* target = &optimizer->blocks[jump->target];
+        b32 back_edge = target->hoisted != -1 && in_loop(optimizer, jump->source, jump->target);
+        i32 address = back_edge ? target->post_label : target->pre_label;
+
+        i32 distance = jump->backward ? jump->base - address : address - jump->base;
+        if (distance < 0 || distance > UINT16_MAX) return false;
+
+        optimizer->code[jump->position]     = (u8)((distance >> 8) & 0xff);
+        optimizer->code[jump->position + 1] = (u8)(distance & 0xff);
+    }
+    return true;
+}
+
+// Frees what build_ir made and resets it for another run
+static void free_ir(Optimizer* optimizer)
+{
+    for (i32 b = 0; b < optimizer->block_count; b++)
+    {
+        free(optimizer->blocks[b].entry);
+        free(optimizer->blocks[b].exit);
+    }
+    free(optimizer->instructions);
+    free(optimizer->instruction_at);
+    free(optimizer->blocks);
+    free(optimizer->order);
+    free(optimizer->successors);
+    free(optimizer->predecessors);
+    free(optimizer->values);
+    free(optimizer->phi_operands);
+
+    optimizer->instructions      = NULL;
+    optimizer->instruction_at    = NULL;
+    optimizer->instruction_count = 0;
+    optimizer->blocks            = NULL;
+    optimizer->block_count       = 0;
+    optimizer->order             = NULL;
+    optimizer->order_count       = 0;
+    optimizer->successors        = NULL;
+    optimizer->predecessors      = NULL;
+    optimizer->values            = NULL;
+    optimizer->value_count       = 0;
+    optimizer->value_capacity    = 0;
+    optimizer->phi_operands      = NULL;
+    optimizer->phi_operand_count = 0;
+    optimizer->max_height        = 0;
+    memset(optimizer->captured, 0, sizeof(optimizer->captured));
+}
+
+static void free_optimizer(Optimizer* optimizer)
+{
+    free_ir(optimizer);
+    free(optimizer->hash_buckets);
+    free(optimizer->inlined.code);
+    free(optimizer->source_lines);
+    free(optimizer->code);
+    free(optimizer->lines);
+    free(optimizer->jumps);
+}
@@ -0,0 +1,233 @@
+#ifndef CLOX_OPTIMIZER_H
+#define CLOX_OPTIMIZER_H
+
+// =================================================================
+// API
+// =================================================================
+
+// Calls after which a function is recompiled by optimize_function
+#define OPTIMIZE_THRESHOLD 1000
+
+// Most slots the optimized code adds to a frame to keep values in
+#define OPTIMIZER_TEMPS_MAX 16
+
+// Most bytes of code a function can have to be inlined into its callers
+#define INLINE_SIZE_MAX 64
+
+// =================================================================
+// Types
+// =================================================================
+
+// What a value can be at runtime, as a mask. No bits set means the code
+// computing it can never run.
+enum IrType
+{
+    IR_TYPE_INT      = 1,
+    IR_TYPE_DOUBLE   = 2,
+    IR_TYPE_STRING   = 4,
+    IR_TYPE_INSTANCE = 8,
+    IR_TYPE_OTHER    = 16,
+
+    IR_TYPE_NUMBER = IR_TYPE_INT | IR_TYPE_DOUBLE,
+    IR_TYPE_ANY    = IR_TYPE_NUMBER | IR_TYPE_STRING | IR_TYPE_INSTANCE | IR_TYPE_OTHER
+};
+
+enum IrValueKind
+{
+    IR_ENTRY,    // The callee or an argument, in its slot when the function starts
+    IR_CONSTANT, // Pushed by OP_CONSTANT, OP_NIL, OP_TRUE or OP_FALSE
+    IR_OP,       // The result of an instruction without side effects, see is_pure_op
+    IR_PHI,      // A slot at the start of a block its predecessors leave different values in
+    IR_REFINE,   // An operand after an instruction that only succeeds on numbers, or instances
+    IR_UNKNOWN   // Anything else: calls, globals, upvalues, properties and captured locals
+};
+
+// A value in SSA form. Every slot of the frame, locals and expression stack
+// alike, holds one at each instruction.
+struct IrValue
+{
+    IrValueKind kind;
+    u8 op;            // Of an IR_OP, or the check an IR_REFINE comes from
+    u8 types;
+    i32 operands[2];  // Of an IR_OP, the value an IR_REFINE refines, or the slot of an IR_ENTRY
+    i32 phi_operands; // Index of the first of one per predecessor in Optimizer.phi_operands
+    i32 block;
+    i32 instruction;  // That computed it, for IR_CONSTANT and IR_OP
+    Value constant;
+
+    i32 forward;      // The value a phi turned out to always be, or -1
+    i32 number;       // The first value computing the same that is known wherever this one is
+    i32 next_same_hash;
+
+    i32 temp;         // Slot of the optimized frame it is kept in, or -1
+    b32 hoisted;      // Computed before its loop instead, chained through next_hoisted
+    i32 next_hoisted;
+};
+
+struct IrInstruction
+{
+    i32 offset;
+    i32 length;
+    u8 op;           // Unchecked forms count as the instruction they were specialized from
+    b32 specialized; // And keep this set
+    i32 block;
+    i32 height;      // Of the stack before it runs
+    i32 value;       // That it pushes, or -1
+    i32 defines[2];  // The values an instruction writes into other slots, see simulate_instruction
+    i32 range_start; // First instruction of the side effect free code computing value, or -1
+    i32 receiver;    // Of a property access
+
+    i32 load;        // Slot to read instead of running [range_start, this instruction], or -1
+    b32 skipped;     // Part of the range of a later instruction with a load
+};
+
+struct IrBlock
+{
+    i32 first; // Instructions [first, end)
+    i32 end;
+    i32 successors;   // Index of the first in Optimizer.successors
+    i32 successor_count;
+    i32 predecessors; // Index of the first in Optimizer.predecessors
+    i32 predecessor_count;
+
+    i32 height;       // Of the stack on entry
+    i32 exit_height;
+    i32* entry;       // The value in each slot on entry
+    i32* exit;        // And on exit
+
+    i32 order;        // Position in reverse postorder, -1 when unreachable
+    i32 idom;
+    i32 loop;         // Header of the innermost loop it is in, or -1
+    i32 parent_loop;  // Of a header, the loop around its own
+    i32 hoisted;      // Of a header, the first value computed before it, or -1
+
+    i32 pre_label;    // Where it starts in the optimized code, before its hoisted values
+    i32 post_label;   // And after them, where its own back edges go
+};
+
+// A jump operand of the optimized code waiting for its target's address
+struct IrJump
+{
+    i32 position;
+    i32 base;     // The address the VM adds the operand to
+    i32 target;   // Block
+    i32 source;   // Block
+    b32 backward;
+};
+
+// A jump operand of code being inlined, target is an offset of the code it was copied from
+struct InlineJump
+{
+    i32 position;
+    i32 target;
+    b32 backward;
+};
+
+struct Optimizer
+{
+    GarbageCollector* gc;
+    ObjFunction* function;
+    Chunk* chunk;
+    Chunk inlined; // The code after inline_calls, it shares the constants of the function
+    i32* source_lines; // The line of every byte of chunk
+
+    IrInstruction* instructions;
+    i32 instruction_count;
+    i32* instruction_at; // By offset, -1 inside operands
+
+    IrBlock* blocks;
+    i32 block_count;
+    i32* order;          // Reachable blocks in reverse postorder
+    i32 order_count;
+    i32* successors;
+    i32* predecessors;
+
+    IrValue* values;
+    i32 value_count;
+    i32 value_capacity;
+    i32* phi_operands;
+    i32 phi_operand_count;
+    i32* hash_buckets;
+    i32 hash_capacity;
+
+    b32 method; // Slot 0 holds an instance
+    b32 captured[UINT8_COUNT]; // Slots closures capture, their values are never known
+    i32 max_height;
+    i32 temp_count;
+    i32 temp_limit;
+    b32 improved;
+
+    u8* code;
+    i32* lines;
+    i32 count;
+    i32 capacity;
+    IrJump* jumps;
+    i32 jump_count;
+    i32 jump_capacity;
+};
+// =================================================================
+
+// =================================================================
+// API Functions
+// =================================================================
+b32  optimize_function(GarbageCollector* gc, ObjFunction* function);
+void specialize_types(GarbageCollector* gc, ObjFunction* function, b32 method);
+// =================================================================
+
+// =================================================================
+// Internal Functions
+// =================================================================
+static i32* decode_lines(Chunk* chunk);
+static b32  build_ir(Optimizer* optimizer);
+static b32  decode_instructions(Optimizer* optimizer);
+static i32  jump_target_count(Optimizer* optimizer, IrInstruction* instruction);
+static i32  jump_target(Optimizer* optimizer, IrInstruction* instruction, i32 which);
+static b32  build_blocks(Optimizer* optimizer);
+static void order_blocks(Optimizer* optimizer);
+static void find_dominators(Optimizer* optimizer);
+static b32  dominates(Optimizer* optimizer, i32 block, i32 other);
+static void find_loops(Optimizer* optimizer);
+static b32  in_loop(Optimizer* optimizer, i32 block, i32 header);
+
+static i32  new_value(Optimizer* optimizer, IrValueKind kind, i32 block, i32 instruction);
+static i32  find_value(Optimizer* optimizer, i32 value);
+static i32  root_value(Optimizer* optimizer, i32 value);
+static u8   value_types(Optimizer* optimizer, i32 value);
+static b32  is_pure_op(u8 op);
+static b32  is_number_check(u8 op);
+static u8   checked_op(u8 op);
+static b32  simulate_instruction(Optimizer* optimizer, i32 index, i32* slots, i32* height, i32* starts, i32* ends, b32* pure, b32 building);
+static b32  build_ssa(Optimizer* optimizer);
+static void remove_trivial_phis(Optimizer* optimizer);
+static void infer_types(Optimizer* optimizer);
+static i32  value_number(Optimizer* optimizer, i32 value);
+static b32  same_constant(Value a, Value b);
+static void number_values(Optimizer* optimizer);
+
+static ObjFunction* inline_candidate(Optimizer* optimizer, i32 index);
+static i32  inline_constant(Optimizer* optimizer, Value value);
+static void add_inline_jump(InlineJump** jumps, i32* count, i32* capacity, i32 position, i32 target, b32 backward);
+static b32  patch_inline_jump(Optimizer* optimizer, InlineJump* jump, i32 address);
+static b32  inline_call(Optimizer* optimizer, i32 index, ObjFunction* callee);
+static b32  inline_calls(Optimizer* optimizer);
+
+static u8   unchecked_op(Optimizer* optimizer, i32 index);
+static i32  invariant_slot(Optimizer* optimizer, i32 header, i32 value);
+static b32  hoistable(Optimizer* optimizer, i32 index, i32 header);
+static i32  new_temp(Optimizer* optimizer);
+static i32  frame_slot(Optimizer* optimizer, i32 slot);
+static i32  load_slot(Optimizer* optimizer, i32 load);
+static void hoist_invariants(Optimizer* optimizer);
+static void find_available_slots(Optimizer* optimizer, i32* slots_holding);
+static b32  eliminate_common_subexpressions(Optimizer* optimizer);
+
+static void emit_optimized_byte(Optimizer* optimizer, u8 byte, i32 line);
+static void emit_jump_operand(Optimizer* optimizer, i32 target, i32 source, b32 backward, i32 line);
+static void emit_instruction(Optimizer* optimizer, i32 index);
+static void emit_hoisted(Optimizer* optimizer, i32 header, i32 v);
+static b32  emit_optimized(Optimizer* optimizer);
+static void free_ir(Optimizer* optimizer);
+static void free_optimizer(Optimizer* optimizer);
+// =================================================================
+
+#endif
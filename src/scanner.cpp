@@ -1,8 +1,14 @@
-void init_scanner(const char* source)
+void init_scanner(Scanner* scanner, const char* source)
 {
-    scanner.start = source;
-    scanner.current = source;
-    scanner.line = 1;
+    init_scanner_at(scanner, source, 1);
+}
+
+// Resumes scanning in the middle of a source, at a position seen before
+void init_scanner_at(Scanner* scanner, const char* start, i32 line)
+{
+    scanner->start = start;
+    scanner->current = start;
+    scanner->line = line;
 }
 
 static bool is_alpha(char c)
@@ -17,82 +23,82 @@ static bool is_digit(char c)
     return c >= '0' && c <= '9';
 }
 
-static bool is_at_end()
+static bool is_at_end(Scanner* scanner)
 {
-    return *scanner.current == '\0';
+    return *scanner->current == '\0';
 }
 
-static char advance()
+static char advance(Scanner* scanner)
 {
-    scanner.current++;
-    return scanner.current[-1];
+    scanner->current++;
+    return scanner->current[-1];
 }
 
-static char peek()
+static char peek(Scanner* scanner)
 {
-    return *scanner.current;
+    return *scanner->current;
 }
 
-static char peek_next()
+static char peek_next(Scanner* scanner)
 {
-    if (is_at_end()) return '\0';
-    return scanner.current[1];
+    if (is_at_end(scanner)) return '\0';
+    return scanner->current[1];
 }
 
-static bool match(char expected)
+static bool match(Scanner* scanner, char expected)
 {
-    if (is_at_end()) return false;
-    if (*scanner.current != expected) return false;
+    if (is_at_end(scanner)) return false;
+    if (*scanner->current != expected) return false;
 
-    scanner.current++;
+    scanner->current++;
     return true;
 }
 
-static Token make_token(TokenType type)
+static Token make_token(Scanner* scanner, TokenType type)
 {
     Token token = {};
     token.type = type;
-    token.start = scanner.start;
-    token.length = (i32)(scanner.current - scanner.start);
-    token.line = scanner.line;
+    token.start = scanner->start;
+    token.length = (i32)(scanner->current - scanner->start);
+    token.line = scanner->line;
     return token;
 }
 
-static Token error_token(const char* message)
+static Token error_token(Scanner* scanner, const char* message)
 {
     Token token = {};
     token.type = TOKEN_ERROR;
     token.start = message;
     token.length = (i32)(strlen(message));
-    token.line = scanner.line;
+    token.line = scanner->line;
     return token;
 }
 
-static void skip_whitespace()
+static void skip_whitespace(Scanner* scanner)
 {
     for (;;)
     {
-        char c = peek();
+        char c = peek(scanner);
         switch(c)
         {
         case ' ':
         case '\r':
         case '\t':
         {
-            advance();
+            advance(scanner);
         }
         break;
         case '\n':
         {
-            scanner.line++;
-            advance();
+            scanner->line++;
+            advance(scanner);
         }
         break;
         case '/':
         {
-            if (peek_next() == '/')
+            if (peek_next(scanner) == '/')
             {
-                while (peek() != '\n' && !is_at_end()) advance();
+                while (peek(scanner) != '\n' && !is_at_end(scanner)) advance(scanner);
             }
             else
             {
@@ -108,85 +114,97 @@ static void skip_whitespace()
     }
 }
 
-static TokenType check_keyword(i32 start, i32 length, const char* rest, TokenType type)
+static TokenType check_keyword(Scanner* scanner, i32 start, i32 length, const char* rest, TokenType type)
 {
-    if (scanner.current - scanner.start == start + length &&
-        memcmp(scanner.start + start, rest, length) == 0)
+    if (scanner->current - scanner->start == start + length &&
+        memcmp(scanner->start + start, rest, length) == 0)
     {
         return type;
     }
     return TOKEN_IDENTIFIER;
 }
 
-static TokenType identifier_type()
+static TokenType identifier_type(Scanner* scanner)
 {
-    switch (scanner.start[0]) {
-    case 'a': return check_keyword(1, 2, "nd", TOKEN_AND);
-    case 'd': return check_keyword(1, 6, "efault", TOKEN_DEFAULT);
-    case 'e': return check_keyword(1, 3, "lse", TOKEN_ELSE);
-    case 'i': return check_keyword(1, 1, "f", TOKEN_IF);
-    case 'n': return check_keyword(1, 2, "il", TOKEN_NIL);
-    case 'o': return check_keyword(1, 1, "r", TOKEN_OR);
-    case 'p': return check_keyword(1, 4, "rint", TOKEN_PRINT);
-    case 'r': return check_keyword(1, 5, "eturn", TOKEN_RETURN);
-    case 'l': return check_keyword(1, 2, "et", TOKEN_LET);
-    case 'w': return check_keyword(1, 4, "hile", TOKEN_WHILE);
+    switch (scanner->start[0]) {
+    case 'a': return check_keyword(scanner, 1, 2, "nd", TOKEN_AND);
+    case 'd': return check_keyword(scanner, 1, 6, "efault", TOKEN_DEFAULT);
+    case 'e': return check_keyword(scanner, 1, 3, "lse", TOKEN_ELSE);
+    case 'i':
+    {
+        if (scanner->current - scanner->start > 1)
+        {
+            switch (scanner->start[1])
+            {
+            case 'f': return check_keyword(scanner, 2, 0, "", TOKEN_IF);
+            case 'm': return check_keyword(scanner, 2, 4, "port", TOKEN_IMPORT);
+            case 'n': return check_keyword(scanner, 2, 0, "", TOKEN_IN);
+            }
+        }
+    }
+    break;
+    case 'n': return check_keyword(scanner, 1, 2, "il", TOKEN_NIL);
+    case 'o': return check_keyword(scanner, 1, 1, "r", TOKEN_OR);
+    case 'p': return check_keyword(scanner, 1, 4, "rint", TOKEN_PRINT);
+    case 'r': return check_keyword(scanner, 1, 5, "eturn", TOKEN_RETURN);
+    case 'l': return check_keyword(scanner, 1, 2, "et", TOKEN_LET);
+    case 'w': return check_keyword(scanner, 1, 4, "hile", TOKEN_WHILE);
     case 's':
     {
-        if (scanner.current - scanner.start > 1)
+        if (scanner->current - scanner->start > 1)
         {
-            switch (scanner.start[1])
+            switch (scanner->start[1])
             {
-            case 'w': return check_keyword(2, 4, "itch", TOKEN_SWITCH);
-            case 'u': return check_keyword(2, 3, "per", TOKEN_SUPER);
+            case 'w': return check_keyword(scanner, 2, 4, "itch", TOKEN_SWITCH);
+            case 'u': return check_keyword(scanner, 2, 3, "per", TOKEN_SUPER);
             }
         }
     }
     break;
     case 'c':
     {
-        if (scanner.current - scanner.start > 1)
+        if (scanner->current - scanner->start > 1)
         {
-            switch (scanner.start[1])
+            switch (scanner->start[1])
             {
-            case 'l': return check_keyword(2, 3, "ass", TOKEN_CLASS);
+            case 'l': return check_keyword(scanner, 2, 3, "ass", TOKEN_CLASS);
             case 'o':
             {
-                if (scanner.current - scanner.start > 3)
+                if (scanner->current - scanner->start > 3)
                 {
-                    switch (scanner.start[3])
+                    switch (scanner->start[3])
                     {
-                    case 's': return check_keyword(4, 1, "t", TOKEN_CONST);
-                    case 't': return check_keyword(4, 4, "inue", TOKEN_CONTINUE);
+                    case 's': return check_keyword(scanner, 4, 1, "t", TOKEN_CONST);
+                    case 't': return check_keyword(scanner, 4, 4, "inue", TOKEN_CONTINUE);
                     }
                 }
             }
-            case 'a': return check_keyword(2, 2, "se", TOKEN_CASE);
+            case 'a': return check_keyword(scanner, 2, 2, "se", TOKEN_CASE);
             }
         }
     }
     break;
     case 'f':
     {
-        if (scanner.current - scanner.start > 1)
+        if (scanner->current - scanner->start > 1)
         {
-            switch(scanner.start[1])
+            switch(scanner->start[1])
             {
-            case 'a': return check_keyword(2, 3, "lse", TOKEN_FALSE);
-            case 'o': return check_keyword(2, 1, "r", TOKEN_FOR);
-            case 'u': return check_keyword(2, 1, "n", TOKEN_FUN);
+            case 'a': return check_keyword(scanner, 2, 3, "lse", TOKEN_FALSE);
+            case 'o': return check_keyword(scanner, 2, 1, "r", TOKEN_FOR);
+            case 'u': return check_keyword(scanner, 2, 1, "n", TOKEN_FUN);
             }
         }
     }
     break;
     case 't':
     {
-        if (scanner.current - scanner.start > 1)
+        if (scanner->current - scanner->start > 1)
         {
-            switch(scanner.start[1])
+            switch(scanner->start[1])
             {
-            case 'h': return check_keyword(2, 2, "is", TOKEN_THIS);
-            case 'r': return check_keyword(2, 2, "ue", TOKEN_TRUE);
+            case 'h': return check_keyword(scanner, 2, 2, "is", TOKEN_THIS);
+            case 'r': return check_keyword(scanner, 2, 2, "ue", TOKEN_TRUE);
             }
         }
     }
@@ -195,86 +213,94 @@ static TokenType identifier_type()
     return TOKEN_IDENTIFIER;
 }
 
-static Token identifier()
+static Token identifier(Scanner* scanner)
 {
-    while (is_alpha(peek()) || is_digit(peek())) advance();
-    return make_token(identifier_type());
+    while (is_alpha(peek(scanner)) || is_digit(peek(scanner))) advance(scanner);
+    return make_token(scanner, identifier_type(scanner));
 }
 
-static Token number()
+static Token number(Scanner* scanner)
 {
-    while (is_digit(peek())) advance();
+    while (is_digit(peek(scanner))) advance(scanner);
 
-    if (peek() == '.' && is_digit(peek_next()))
+    if (peek(scanner) == '.' && is_digit(peek_next(scanner)))
     {
-        advance();
-        while (is_digit(peek())) advance();
+        advance(scanner);
+        while (is_digit(peek(scanner))) advance(scanner);
     }
 
-    return make_token(TOKEN_NUMBER);
+    return make_token(scanner, TOKEN_NUMBER);
 }
 
-static Token string()
+static Token string(Scanner* scanner)
 {
-    while (peek() != '"' && !is_at_end())
+    while (peek(scanner) != '"' && !is_at_end(scanner))
     {
-        if (peek() == '\n') scanner.line++;
-        advance();
+        if (peek(scanner) == '\n') scanner->line++;
+        advance(scanner);
     }
 
-    if(is_at_end()) return error_token("Unterminated string");
+    if(is_at_end(scanner)) return error_token(scanner, "Unterminated string");
 
-    advance();
-    return make_token(TOKEN_STRING);
+    advance(scanner);
+    return make_token(scanner, TOKEN_STRING);
 }
 
-Token scan_token()
+Token scan_token(Scanner* scanner)
 {
-    skip_whitespace();
-    scanner.start = scanner.current;
+    skip_whitespace(scanner);
+    scanner->start = scanner->current;
 
-    if(is_at_end()) return make_token(TOKEN_EOF);
+    if(is_at_end(scanner)) return make_token(scanner, TOKEN_EOF);
 
-    char c = advance();
+    char c = advance(scanner);
 
-    if (is_alpha(c)) return identifier();
-    if (is_digit(c)) return number();
+    if (is_alpha(c)) return identifier(scanner);
+    if (is_digit(c)) return number(scanner);
 
     switch(c)
     {
-    case '(': return make_token(TOKEN_LEFT_PAREN);
-    case ')': return make_token(TOKEN_RIGHT_PAREN);
-    case '{': return make_token(TOKEN_LEFT_BRACE);
-    case '}': return make_token(TOKEN_RIGHT_BRACE);
-    case ';': return make_token(TOKEN_SEMICOLON);
-    case ':': return make_token(TOKEN_COLON);
-    case ',': return make_token(TOKEN_COMMA);
-    case '.': return make_token(TOKEN_DOT);
-    case '-': return make_token(TOKEN_MINUS);
-    case '+': return make_token(TOKEN_PLUS);
-    case '/': return make_token(TOKEN_SLASH);
-    case '*': return make_token(TOKEN_STAR);
+    case '(': return make_token(scanner, TOKEN_LEFT_PAREN);
+    case ')': return make_token(scanner, TOKEN_RIGHT_PAREN);
+    case '{': return make_token(scanner, TOKEN_LEFT_BRACE);
+    case '}': return make_token(scanner, TOKEN_RIGHT_BRACE);
+    case '[': return make_token(scanner, TOKEN_LEFT_BRACKET);
+    case ']': return make_token(scanner, TOKEN_RIGHT_BRACKET);
+    case ';': return make_token(scanner, TOKEN_SEMICOLON);
+    case ':': return make_token(scanner, TOKEN_COLON);
+    case ',': return make_token(scanner, TOKEN_COMMA);
+    case '.': return make_token(scanner, TOKEN_DOT);
+    case '-': return make_token(scanner, TOKEN_MINUS);
+    case '+': return make_token(scanner, TOKEN_PLUS);
+    case '/': return make_token(scanner, TOKEN_SLASH);
+    case '*': return make_token(scanner, TOKEN_STAR);
+    case '&': return make_token(scanner, TOKEN_AMPERSAND);
+    case '|': return make_token(scanner, TOKEN_PIPE);
+    case '^': return make_token(scanner, TOKEN_CARET);
+    case '~': return make_token(scanner, TOKEN_TILDE);
     case '!':
     {
-        return make_token(match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
+        return make_token(scanner, match(scanner, '=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
     }
     case '=':
     {
-        return make_token(match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
+        return make_token(scanner, match(scanner, '=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
     }
     case '<':
     {
-        return make_token(match('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
+        if (match(scanner, '<')) return make_token(scanner, TOKEN_LESS_LESS);
+        return make_token(scanner, match(scanner, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
     }
     case '>':
     {
-        return make_token(match('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
+        if (match(scanner, '>')) return make_token(scanner, TOKEN_GREATER_GREATER);
+        return make_token(scanner, match(scanner, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
     }
     case '"':
     {
-        return string();
+        return string(scanner);
     }
     }
 
-    return error_token("Unexpected character.");
+    return error_token(scanner, "Unexpected character.");
 }
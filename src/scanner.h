@@ -14,33 +14,35 @@ struct Scanner
     const char* current;
     i32 line;
 };
-Scanner scanner;
 
 enum TokenType
 {
     // Single-character tokens.
     TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN,
     TOKEN_LEFT_BRACE, TOKEN_RIGHT_BRACE,
+    TOKEN_LEFT_BRACKET, TOKEN_RIGHT_BRACKET,
     TOKEN_COMMA, TOKEN_DOT, TOKEN_MINUS, TOKEN_PLUS,
     TOKEN_SEMICOLON, TOKEN_SLASH, TOKEN_STAR,
     TOKEN_COLON,
+    TOKEN_AMPERSAND, TOKEN_PIPE, TOKEN_CARET, TOKEN_TILDE,
 
     // One or two character tokens.
     TOKEN_BANG, TOKEN_BANG_EQUAL,
     TOKEN_EQUAL, TOKEN_EQUAL_EQUAL,
     TOKEN_GREATER, TOKEN_GREATER_EQUAL,
     TOKEN_LESS, TOKEN_LESS_EQUAL,
+    TOKEN_LESS_LESS, TOKEN_GREATER_GREATER,
 
     // Literals.
     TOKEN_IDENTIFIER, TOKEN_STRING, TOKEN_NUMBER,
 
     // Keywords.
     TOKEN_AND, TOKEN_CLASS, TOKEN_ELSE, TOKEN_FALSE,
-    TOKEN_FOR, TOKEN_FUN, TOKEN_IF, TOKEN_NIL, TOKEN_OR,
+    TOKEN_FOR, TOKEN_FUN, TOKEN_IF, TOKEN_IN, TOKEN_NIL, TOKEN_OR,
     TOKEN_PRINT, TOKEN_RETURN, TOKEN_SUPER, TOKEN_THIS,
     TOKEN_TRUE, TOKEN_LET, TOKEN_CONST, TOKEN_WHILE,
     TOKEN_SWITCH, TOKEN_CASE, TOKEN_DEFAULT,
-    TOKEN_CONTINUE,
+    TOKEN_CONTINUE, TOKEN_IMPORT,
 
     TOKEN_ERROR,
     TOKEN_EOF
@@ -58,8 +60,9 @@ struct Token
 // =================================================================
 // API Functions
 // =================================================================
-void init_scanner(const char* source);
-Token scan_token();
+void init_scanner(Scanner* scanner, const char* source);
+void init_scanner_at(Scanner* scanner, const char* start, i32 line);
+Token scan_token(Scanner* scanner);
 // =================================================================
 
 
@@ -68,19 +71,19 @@ Token scan_token();
 // =================================================================
 static bool is_alpha(char c);
 static bool is_digit(char c);
-static bool is_at_end();
-static char advance();
-static char peek();
-static char peek_next();
-static bool match(char expected);
-static Token make_token(TokenType type);
-static Token error_token(const char* message);
-static void skip_whitespace();
-static TokenType check_keyword(i32 start, i32 length, const char* rest, TokenType type);
-static TokenType identifier_type();
-static Token identifier();
-static Token number();
-static Token string();
+static bool is_at_end(Scanner* scanner);
+static char advance(Scanner* scanner);
+static char peek(Scanner* scanner);
+static char peek_next(Scanner* scanner);
+static bool match(Scanner* scanner, char expected);
+static Token make_token(Scanner* scanner, TokenType type);
+static Token error_token(Scanner* scanner, const char* message);
+static void skip_whitespace(Scanner* scanner);
+static TokenType check_keyword(Scanner* scanner, i32 start, i32 length, const char* rest, TokenType type);
+static TokenType identifier_type(Scanner* scanner);
+static Token identifier(Scanner* scanner);
+static Token number(Scanner* scanner);
+static Token string(Scanner* scanner);
 // =================================================================
 
 
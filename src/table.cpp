@@ -1,118 +1,490 @@
-#define TABLE_MAX_LOAD 0.75
+#ifdef TABLE_SWISS
+
+#define CONTROL_EMPTY   ((i8)-128)
+#define CONTROL_DELETED ((i8)-2)
+#define GROUP_WIDTH 16
+#define SWISS_MIN_CAPACITY 16
+
+// Free slots have the high bit set, so a byte mask of sign bits finds them
+static inline u32 group_match(const i8* control, i8 tag)
+{
+#ifdef SIMD_SSE2
+    __m128i group = _mm_loadu_si128((const __m128i*)control);
+    return (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag)));
+#else
+    u32 mask = 0;
+    for (i32 i = 0; i < GROUP_WIDTH; i++)
+    {
+        if (control[i] == tag) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+static inline u32 group_match_free(const i8* control)
+{
+#ifdef SIMD_SSE2
+    return (u32)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)control));
+#else
+    u32 mask = 0;
+    for (i32 i = 0; i < GROUP_WIDTH; i++)
+    {
+        if (control[i] < 0) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+static inline i32 lowest_bit(u32 mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (i32)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+static inline i8 hash_tag(u32 hash)
+{
+    return (i8)(hash & 0x7f);
+}
+
+static inline u32 hash_position(u32 hash, i32 capacity)
+{
+    return (hash >> 7) & (capacity - 1);
+}
+
+static inline void set_control(Table* table, i32 index, i8 value)
+{
+    table->control[index] = value;
+    if (index < GROUP_WIDTH)
+    {
+        table->control[table->capacity + index] = value;
+    }
+}
 
 void init_table(Table* table)
 {
     table->count = 0;
     table->capacity = 0;
     table->entries = NULL;
+    table->control = NULL;
+    table->tombstones = 0;
 }
 
 void free_table(GarbageCollector* gc, Table* table)
 {
     FREE_ARRAY(gc, Entry, table->entries, table->capacity);
+    if (table->control) FREE_ARRAY(gc, i8, table->control, table->capacity + GROUP_WIDTH);
     init_table(table);
 }
 
-static Entry* find_entry(Entry* entries, i32 capacity, ObjString* key)
+// Groups are probed with a growing stride, which visits every group once for power of two capacities
+static i32 find_index(Table* table, ObjString* key)
 {
-    u32 index = key->hash & (capacity - 1);
-    Entry* tombstone = NULL;
-    for (;;)
+    if (table->count == 0) return -1;
+
+    u32 mask = table->capacity - 1;
+    u32 position = hash_position(key->hash, table->capacity);
+    i8 tag = hash_tag(key->hash);
+
+    for (u32 stride = GROUP_WIDTH;; stride += GROUP_WIDTH)
+    {
+        const i8* group = table->control + position;
+        for (u32 matches = group_match(group, tag); matches; matches &= matches - 1)
+        {
+            u32 index = (position + lowest_bit(matches)) & mask;
+            if (table->entries[index].key == key) return (i32)index;
+        }
+
+        if (group_match(group, CONTROL_EMPTY)) return -1;
+        position = (position + stride) & mask;
+    }
+}
+
+static i32 find_free_index(i8* control, i32 capacity, u32 hash)
+{
+    u32 mask = capacity - 1;
+    u32 position = hash_position(hash, capacity);
+
+    for (u32 stride = GROUP_WIDTH;; stride += GROUP_WIDTH)
+    {
+        u32 free_slots = group_match_free(control + position);
+        if (free_slots) return (i32)((position + lowest_bit(free_slots)) & mask);
+        position = (position + stride) & mask;
+    }
+}
+
+bool table_get(Table* table, ObjString* key, Value* value)
+{
+    i32 index = find_index(table, key);
+    if (index < 0) return false;
+
+    *value = table->entries[index].value;
+    return true;
+}
+
+static void adjust_capacity(GarbageCollector* gc, Table* table, i32 capacity)
+{
+    Entry* entries = ALLOCATE(gc, Entry, capacity);
+    i8* control = ALLOCATE(gc, i8, capacity + GROUP_WIDTH);
+    memset(control, CONTROL_EMPTY, capacity + GROUP_WIDTH);
+
+    Table resized = {};
+    resized.capacity = capacity;
+    resized.entries  = entries;
+    resized.control  = control;
+
+    for (i32 i = 0; i < table->capacity; i++)
+    {
+        if (table->control[i] < 0) continue;
+
+        Entry* entry = &table->entries[i];
+        i32 index = find_free_index(control, capacity, entry->key->hash);
+        set_control(&resized, index, table->control[i]);
+        entries[index] = *entry;
+        resized.count++;
+    }
+
+    free_table(gc, table);
+    *table = resized;
+}
+
+bool table_set(GarbageCollector* gc, Table* table, ObjString* key, Value value)
+{
+    i32 index = find_index(table, key);
+    if (index >= 0)
+    {
+        table->entries[index].value = value;
+        return false;
+    }
+
+    if (table->count + table->tombstones + 1 > table->capacity * 7 / 8)
     {
-        Entry* entry = &entries[index];
+        // Tombstones alone are cleaned up in place, otherwise grow
+        i32 capacity = table->capacity;
+        if (capacity < SWISS_MIN_CAPACITY) capacity = SWISS_MIN_CAPACITY;
+        else if (table->count + 1 > capacity * 7 / 16) capacity *= 2;
+        adjust_capacity(gc, table, capacity);
+    }
+
+    index = find_free_index(table->control, table->capacity, key->hash);
+    if (table->control[index] == CONTROL_DELETED) table->tombstones--;
+
+    set_control(table, index, hash_tag(key->hash));
+    table->entries[index].key = key;
+    table->entries[index].value = value;
+    table->count++;
+    return true;
+}
+
+static void delete_index(Table* table, i32 index)
+{
+    set_control(table, index, CONTROL_DELETED);
+    table->entries[index].key = NULL;
+    table->count--;
+    table->tombstones++;
+}
 
-        if (entry->key == NULL)
+bool table_delete(Table* table, ObjString* key)
+{
+    i32 index = find_index(table, key);
+    if (index < 0) return false;
+
+    delete_index(table, index);
+    return true;
+}
+
+void table_add_all(GarbageCollector* gc, Table* from, Table* to)
+{
+    for (i32 i = 0; i < from->capacity; i++)
+    {
+        if (from->control[i] >= 0)
         {
-            if (IS_NIL(entry->value))
-            {
-                return tombstone != NULL ? tombstone : entry;
-            }
-            else
+            table_set(gc, to, from->entries[i].key, from->entries[i].value);
+        }
+    }
+}
+
+ObjString* table_find_string(Table* table, const char* chars, i32 length, u32 hash)
+{
+    if (table->count == 0) return NULL;
+
+    u32 mask = table->capacity - 1;
+    u32 position = hash_position(hash, table->capacity);
+    i8 tag = hash_tag(hash);
+
+    for (u32 stride = GROUP_WIDTH;; stride += GROUP_WIDTH)
+    {
+        const i8* group = table->control + position;
+        for (u32 matches = group_match(group, tag); matches; matches &= matches - 1)
+        {
+            ObjString* key = table->entries[(position + lowest_bit(matches)) & mask].key;
+            if (key->length == length && key->hash == hash &&
+                memcmp(key->chars, chars, length) == 0)
             {
-                if (tombstone == NULL) tombstone = entry;
+                return key;
             }
         }
-        else if (entry->key == key)
+
+        if (group_match(group, CONTROL_EMPTY)) return NULL;
+        position = (position + stride) & mask;
+    }
+}
+
+void table_remove_white(Table* table)
+{
+    for (i32 i = 0; i < table->capacity; i++)
+    {
+        if (table->control[i] >= 0 && !table->entries[i].key->obj.is_marked)
         {
-            return entry;
+            delete_index(table, i);
         }
+    }
+}
+
+void mark_table(GarbageCollector* gc, Table* table)
+{
+    for (i32 i = 0; i < table->capacity; i++)
+    {
+        if (table->control[i] < 0) continue;
 
-        index = (index + 1) & (capacity - 1);
+        Entry* entry = &table->entries[i];
+        mark_object(gc, (Obj*)entry->key);
+        mark_value(gc, entry->value);
     }
 }
 
-bool table_get(Table* table, ObjString* key, Value* value)    
+void table_probe_histogram(Table* table, i32* histogram, i32 bucket_count)
+{
+    for (i32 i = 0; i < bucket_count; i++) histogram[i] = 0;
+
+    for (i32 i = 0; i < table->capacity; i++)
+    {
+        if (table->control[i] < 0) continue;
+
+        u32 home = hash_position(table->entries[i].key->hash, table->capacity);
+        u32 distance = ((u32)i - home) & (table->capacity - 1);
+        histogram[distance < (u32)bucket_count ? distance : bucket_count - 1]++;
+    }
+}
+
+#else
+
+// Small tables are a dense array that is scanned linearly. Bigger ones add an
+// index of slots using Robin Hood hashing: an insert takes the slot of any
+// entry that is closer to its home slot than the insert is to its own, and a
+// delete shifts the following run back instead of leaving a tombstone.
+#define TABLE_GROW_CAPACITY(capacity) ((capacity) < 2 ? 2 : (capacity) * 2)
+
+void init_table(Table* table)
+{
+    table->count = 0;
+    table->capacity = 0;
+    table->used = 0;
+    table->entries = NULL;
+    table->slot_capacity = 0;
+    table->slots = NULL;
+}
+
+void free_table(GarbageCollector* gc, Table* table)
+{
+    FREE_ARRAY(gc, Entry, table->entries, table->capacity);
+    if (table->slots) FREE_ARRAY(gc, TableSlot, table->slots, table->slot_capacity);
+    init_table(table);
+}
+
+static inline u32 probe_distance(u32 hash, u32 index, i32 capacity)
+{
+    return (index - hash) & (capacity - 1);
+}
+
+static i32 find_slot(Table* table, ObjString* key)
+{
+    u32 mask = table->slot_capacity - 1;
+    u32 index = key->hash & mask;
+    for (u32 distance = 0;; distance++)
+    {
+        TableSlot* slot = &table->slots[index];
+        if (slot->entry < 0) return -1;
+        if (slot->hash == key->hash && table->entries[slot->entry].key == key) return (i32)index;
+
+        // Every slot in this run is closer to home than the key would be, so it isn't here
+        if (probe_distance(slot->hash, index, table->slot_capacity) < distance) return -1;
+
+        index = (index + 1) & mask;
+    }
+}
+
+static i32 find_entry(Table* table, ObjString* key)
 {
-    if (table->count == 0) return false;
+    if (table->count == 0) return -1;
+
+    if (!table->slots)
+    {
+        for (i32 i = 0; i < table->used; i++)
+        {
+            if (table->entries[i].key == key) return i;
+        }
+        return -1;
+    }
 
-    Entry* entry = find_entry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
+    i32 slot = find_slot(table, key);
+    return slot < 0 ? -1 : table->slots[slot].entry;
+}
+
+static void insert_slot(TableSlot* slots, i32 capacity, i32 entry, u32 hash)
+{
+    TableSlot slot = {};
+    slot.entry = entry;
+    slot.hash = hash;
+
+    u32 mask = capacity - 1;
+    u32 index = hash & mask;
+    for (u32 distance = 0;; distance++)
+    {
+        TableSlot* existing = &slots[index];
+        if (existing->entry < 0)
+        {
+            *existing = slot;
+            return;
+        }
 
-    *value = entry->value;
+        u32 existing_distance = probe_distance(existing->hash, index, capacity);
+        if (existing_distance < distance)
+        {
+            TableSlot displaced = *existing;
+            *existing = slot;
+            slot = displaced;
+            distance = existing_distance;
+        }
+
+        index = (index + 1) & mask;
+    }
+}
+
+bool table_get(Table* table, ObjString* key, Value* value)    
+{
+    i32 entry = find_entry(table, key);
+    if (entry < 0) return false;
+
+    *value = table->entries[entry].value;
     return true;
 }
 
+// Compacts the live entries into a new array and rebuilds the index if the table is big enough for one
 static void adjust_capacity(GarbageCollector* gc, Table* table, i32 capacity)
 {
     Entry* entries = ALLOCATE(gc, Entry, capacity);
-    for (i32 i = 0; i < capacity; i++)
+
+    TableSlot* slots = NULL;
+    i32 slot_capacity = 0;
+    if (capacity > TABLE_SMALL_MAX)
     {
-        entries[i].key = NULL;
-        entries[i].value = nil_val();
+        slot_capacity = capacity * 2;
+        slots = ALLOCATE(gc, TableSlot, slot_capacity);
+        for (i32 i = 0; i < slot_capacity; i++)
+        {
+            slots[i].entry = -1;
+        }
     }
-    
-    table->count = 0;
-    for (i32 i = 0; i < table->capacity; i++)
+
+    i32 used = 0;
+    for (i32 i = 0; i < table->used; i++)
     {
         Entry* entry = &table->entries[i];
         if (entry->key == NULL) continue;
 
-        Entry* dest = find_entry(entries, capacity, entry->key);
-        dest->key = entry->key;
-        dest->value = entry->value;
-        table->count++;
+        entries[used] = *entry;
+        if (slots) insert_slot(slots, slot_capacity, used, entry->key->hash);
+        used++;
     }
 
-    FREE_ARRAY(gc, Entry, table->entries, table->capacity);
+    free_table(gc, table);
 
-    table->entries = entries;
+    table->count = used;
+    table->used = used;
     table->capacity = capacity;
+    table->entries = entries;
+    table->slot_capacity = slot_capacity;
+    table->slots = slots;
 }
 
 bool table_set(GarbageCollector* gc, Table* table, ObjString* key, Value value)
 {
-    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD)
+    i32 entry = find_entry(table, key);
+    if (entry >= 0)
     {
-        i32 capacity = GROW_CAPACITY(table->capacity);
-        adjust_capacity(gc, table, capacity);
+        table->entries[entry].value = value;
+        return false;
     }
-    
-    Entry* entry = find_entry(table->entries, table->capacity, key);
 
-    bool is_new_key = entry->key == NULL;
-    if (is_new_key && IS_NIL(entry->value)) table->count++;
+    if (table->used == table->capacity)
+    {
+        // Reuse the space of deleted entries when they make up at least half the table
+        i32 capacity = table->count + 1 > table->capacity / 2 ? TABLE_GROW_CAPACITY(table->capacity) : table->capacity;
+        adjust_capacity(gc, table, capacity);
+    }
 
-    entry->key = key;
-    entry->value = value;
-    return is_new_key;
+    entry = table->used++;
+    table->entries[entry].key = key;
+    table->entries[entry].value = value;
+    if (table->slots) insert_slot(table->slots, table->slot_capacity, entry, key->hash);
+    table->count++;
+    return true;
 }
 
-bool table_delete(Table* table, ObjString* key)
+// Pulls the rest of the run back one slot, until an empty slot or an entry already at home
+static void delete_slot(Table* table, u32 index)
 {
-    if (table->count == 0) return false;;
+    u32 mask = table->slot_capacity - 1;
+    for (;;)
+    {
+        u32 next = (index + 1) & mask;
+        TableSlot* slot = &table->slots[next];
+        if (slot->entry < 0 || probe_distance(slot->hash, next, table->slot_capacity) == 0)
+        {
+            break;
+        }
 
-    Entry* entry = find_entry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
+        table->slots[index] = *slot;
+        index = next;
+    }
 
-    entry->key = NULL;
-    entry->value = bool_val(true);
+    table->slots[index].entry = -1;
+}
+
+static void delete_entry(Table* table, i32 entry)
+{
+    if (table->slots)
+    {
+        delete_slot(table, (u32)find_slot(table, table->entries[entry].key));
+        table->entries[entry].key = NULL;
+        table->entries[entry].value = nil_val();
+    }
+    else
+    {
+        // Small tables stay dense so the scan never sees holes
+        table->used--;
+        memmove(&table->entries[entry], &table->entries[entry + 1], sizeof(Entry) * (table->used - entry));
+    }
+    table->count--;
+}
+
+bool table_delete(Table* table, ObjString* key)
+{
+    i32 entry = find_entry(table, key);
+    if (entry < 0) return false;
 
+    delete_entry(table, entry);
     return true;
 }
 
 void table_add_all(GarbageCollector* gc, Table* from, Table* to)
 {
-    for (i32 i = 0; i < from->capacity; i++)
+    for (i32 i = 0; i < from->used; i++)
     {
         Entry* entry = &from->entries[i];
         if (entry->key != NULL)
@@ -126,44 +498,100 @@ ObjString* table_find_string(Table* table, const char* chars, i32 length, u32 ha
 {
     if (table->count == 0) return NULL;
 
-    u32 index = hash & (table->capacity - 1);
-
-    for (;;)
+    if (!table->slots)
     {
-        Entry* entry = &table->entries[index];
-
-        if (entry->key == NULL)
+        for (i32 i = 0; i < table->used; i++)
         {
-            if (IS_NIL(entry->value)) return NULL;
+            ObjString* key = table->entries[i].key;
+            if (key->hash == hash && key->length == length &&
+                memcmp(key->chars, chars, length) == 0)
+            {
+                return key;
+            }
         }
-        else if (entry->key->length == length && entry->key->hash == hash &&
-                 memcmp(entry->key->chars, chars, length) == 0)
+        return NULL;
+    }
+
+    u32 mask = table->slot_capacity - 1;
+    u32 index = hash & mask;
+    for (u32 distance = 0;; distance++)
+    {
+        TableSlot* slot = &table->slots[index];
+        if (slot->entry < 0) return NULL;
+
+        if (slot->hash == hash)
         {
-            return entry->key;
+            ObjString* key = table->entries[slot->entry].key;
+            if (key->length == length && memcmp(key->chars, chars, length) == 0)
+            {
+                return key;
+            }
         }
 
-        index = (index + 1) & (table->capacity - 1);
+        if (probe_distance(slot->hash, index, table->slot_capacity) < distance) return NULL;
+
+        index = (index + 1) & mask;
     }
 }
 
 void table_remove_white(Table* table)
 {
-    for (i32 i = 0; i < table->capacity; i++)
+    for (i32 i = 0; i < table->used;)
     {
         Entry* entry = &table->entries[i];
         if (entry->key != NULL && !entry->key->obj.is_marked)
         {
-            table_delete(table, entry->key);
+            delete_entry(table, i);
+
+            // Small tables move the next entry into this one, so look at it again
+            if (!table->slots) continue;
         }
+        i++;
     }
 }
 
 void mark_table(GarbageCollector* gc, Table* table)
 {
-    for(i32 i = 0; i < table->capacity; i++)
+    for(i32 i = 0; i < table->used; i++)
     {
         Entry* entry = &table->entries[i];
         mark_object(gc, (Obj*)entry->key);
         mark_value(gc, entry->value);
     }
 }
+
+void table_probe_histogram(Table* table, i32* histogram, i32 bucket_count)
+{
+    for (i32 i = 0; i < bucket_count; i++) histogram[i] = 0;
+
+    // Small tables have no home slots, every scan starts at the front
+    if (!table->slots)
+    {
+        histogram[0] = table->count;
+        return;
+    }
+
+    for (i32 i = 0; i < table->slot_capacity; i++)
+    {
+        TableSlot* slot = &table->slots[i];
+        if (slot->entry < 0) continue;
+
+        u32 distance = probe_distance(slot->hash, (u32)i, table->slot_capacity);
+        histogram[distance < (u32)bucket_count ? distance : bucket_count - 1]++;
+    }
+}
+
+#endif
+
+void print_table_stats(Table* table, const char* name)
+{
+    i32 histogram[TABLE_HISTOGRAM_BUCKETS];
+    table_probe_histogram(table, histogram, TABLE_HISTOGRAM_BUCKETS);
+
+    printf("   table %s: %d entries, capacity %d, probe lengths", name, table->count, table->capacity);
+    for (i32 i = 0; i < TABLE_HISTOGRAM_BUCKETS; i++)
+    {
+        printf(i == TABLE_HISTOGRAM_BUCKETS - 1 ? " %d+:%d" : " %d:%d", i, histogram[i]);
+    }
+    printf("\n");
+}
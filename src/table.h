@@ -5,6 +5,11 @@
 // API
 // =================================================================
 
+#define TABLE_HISTOGRAM_BUCKETS 8
+
+// Tables with at most this many entries are scanned linearly and have no index
+#define TABLE_SMALL_MAX 8
+
 // =================================================================
 // Types
 // =================================================================
@@ -15,13 +20,43 @@ struct Entry
     Value value;
 };
 
+#ifdef TABLE_SWISS
+
 struct Table
 {
     i32 count;
     i32 capacity;
     Entry* entries;
+    // One byte per entry: a 7-bit hash tag when full, otherwise CONTROL_EMPTY or CONTROL_DELETED.
+    // The first group is mirrored past the end so every 16 byte load is in bounds.
+    i8* control;
+    i32 tombstones;
 };
 
+#else
+
+struct TableSlot
+{
+    i32 entry; // -1 when empty
+    u32 hash;
+};
+
+// Entries are dense and in insertion order. Deleted entries in an indexed table
+// leave a NULL key behind until the next resize compacts them away.
+struct Table
+{
+    i32 count;
+    i32 capacity;
+    i32 used;
+    Entry* entries;
+
+    // Robin Hood hash index into entries, NULL while capacity <= TABLE_SMALL_MAX
+    i32 slot_capacity;
+    TableSlot* slots;
+};
+
+#endif
+
 // =================================================================
 
 // =================================================================
@@ -36,6 +71,8 @@ ObjString* table_find_string(Table* table, const char* chars, i32 length, u32 ha
 void table_remove_white(Table* table);
 void mark_table(GarbageCollector* gc, Table* table);
 bool table_get(Table* table, ObjString* key, Value* value);
+void table_probe_histogram(Table* table, i32* histogram, i32 bucket_count);
+void print_table_stats(Table* table, const char* name);
 // =================================================================
 
 #endif
@@ -24,6 +24,11 @@ void write_value_array(GarbageCollector* gc, ValueArray* array, Value value)
     array->count++;
 }
 
+void print_number(f64 number)
+{
+    printf("%g", number);
+}
+
 void print_value(Value value)
 {
 #ifdef NAN_BOXING
@@ -35,9 +40,20 @@ void print_value(Value value)
     {
         printf("nil");
     }
+    else if (IS_INT(value))
+    {
+        // Ints print exactly like the double they stand for
+        print_number((f64)AS_INT(value));
+    }
     else if (IS_NUMBER(value))
     {
-        printf("%g", AS_NUMBER(value));
+        print_number(AS_NUMBER(value));
+    }
+    else if (IS_SMALL_STRING(value))
+    {
+        char buffer[SMALL_STRING_MAX + 1];
+        small_string_chars(value, buffer);
+        printf("%s", buffer);
     }
     else if (IS_OBJ(value))
     {
@@ -51,7 +67,7 @@ void print_value(Value value)
         case VAL_NIL:
         printf("nil"); break;
         case VAL_NUMBER:
-        printf("%g", AS_NUMBER(value)); break;
+        print_number(AS_NUMBER(value)); break;
         case VAL_OBJ:
         print_object(value); break;
     }    
@@ -61,11 +77,15 @@ void print_value(Value value)
 b32 values_equal(Value a, Value b)
 {
 #ifdef NAN_BOXING
+    if (IS_INT(a) && IS_INT(b)) return a == b;
     if (IS_NUMBER(a) && IS_NUMBER(b)) {
         return AS_NUMBER(a) == AS_NUMBER(b);
     }
-    
-    return a == b;
+
+    // @Note: Small strings compare by bits and longer strings are interned,
+    // so identity is string equality as well. Slices and vectors compare by content.
+    if (a == b) return true;
+    return IS_OBJ(a) && IS_OBJ(b) && (strings_equal(a, b) || vectors_equal(a, b));
 #else
     if (a.type != b.type) return false;
 
@@ -74,7 +94,7 @@ b32 values_equal(Value a, Value b)
         case VAL_BOOL:   return AS_BOOL(a) == AS_BOOL(b);
         case VAL_NIL:    return true;
         case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
-        case VAL_OBJ: return AS_OBJ(a) == AS_OBJ(b);
+        case VAL_OBJ: return AS_OBJ(a) == AS_OBJ(b) || strings_equal(a, b) || vectors_equal(a, b);
         default:
         return false;
     }
@@ -16,9 +16,13 @@ enum ValueType
     VAL_BOOL,
     VAL_NIL,
     VAL_NUMBER,
-    VAL_OBJ
+    VAL_OBJ,
+    VAL_ANY // Only used to describe native arguments
 };
 
+// Strings up to this length are stored inline in the Value when NaN boxing is enabled
+#define SMALL_STRING_MAX 6
+
 #ifdef NAN_BOXING
 
 typedef u64 Value;
@@ -31,7 +35,8 @@ typedef u64 Value;
 
 #define AS_OBJ(value)    ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
 #define AS_BOOL(value)   ((value == TRUE_VAL))
-#define AS_NUMBER(value) (value_to_num(value))
+#define AS_NUMBER(value) (as_number(value))
+#define AS_INT(value)    ((i32)(u32)((value) & 0xffffffff))
 
 static inline Value num_to_value(f64 num)
 {
@@ -45,6 +50,11 @@ Value number_val(f64 number)
     return num_to_value(number);
 }
 
+Value int_val(i32 integer)
+{
+    return (Value)(QNAN | TAG_INT | (u64)(u32)integer);
+}
+
 Value nil_val()
 {
     return NIL_VAL;
@@ -71,7 +81,40 @@ static inline f64 value_to_num(Value value)
 #define IS_OBJ(value)    (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
 #define IS_BOOL(value)   ((value | 1) == TRUE_VAL)
 #define IS_NIL(value)    ((value) == NIL_VAL)
-#define IS_NUMBER(value) (((value) & QNAN) != QNAN)
+#define IS_INT(value)    (((value) & (SIGN_BIT | QNAN | TAG_SMALL_STRING | TAG_INT)) == (QNAN | TAG_INT))
+#define IS_DOUBLE(value) (((value) & QNAN) != QNAN)
+#define IS_NUMBER(value) (IS_DOUBLE(value) || IS_INT(value))
+#define IS_SMALL_STRING(value) (((value) & (SIGN_BIT | QNAN | TAG_SMALL_STRING)) == (QNAN | TAG_SMALL_STRING))
+
+// Ints and doubles are both numbers, the int tag is only a cheaper encoding
+static inline f64 as_number(Value value)
+{
+    return IS_INT(value) ? (f64)AS_INT(value) : value_to_num(value);
+}
+
+static inline Value small_string_val(const char* chars, i32 length)
+{
+    u64 bits = 0;
+    for (i32 i = 0; i < length; i++)
+    {
+        bits |= (u64)(u8)chars[i] << (i * 8);
+    }
+    return (Value)(QNAN | TAG_SMALL_STRING | bits);
+}
+
+// Writes the characters and a terminating NUL to buffer, which must hold SMALL_STRING_MAX + 1 bytes
+static inline i32 small_string_chars(Value value, char* buffer)
+{
+    i32 length = 0;
+    while (length < SMALL_STRING_MAX)
+    {
+        char c = (char)((value >> (length * 8)) & 0xff);
+        if (c == '\0') break;
+        buffer[length++] = c;
+    }
+    buffer[length] = '\0';
+    return length;
+}
 
 #else
 
@@ -79,8 +122,12 @@ static inline f64 value_to_num(Value value)
 #define IS_BOOL(value) (value.type == VAL_BOOL)
 #define IS_NIL(value) (value.type == VAL_NIL)
 #define IS_OBJ(value) (value.type == VAL_OBJ)
+#define IS_SMALL_STRING(value) (false)
+#define IS_INT(value) (false)
+#define IS_DOUBLE(value) (IS_NUMBER(value))
 
 #define AS_NUMBER(value) (value.as.number)
+#define AS_INT(value) ((i32)value.as.number)
 #define AS_BOOL(value) (value.as.boolean)
 #define AS_OBJ(value) (value.as.obj)
 
@@ -103,6 +150,12 @@ Value number_val(f64 number)
     return value;
 }
 
+// Without NaN boxing there is no int tag, integers are plain doubles
+Value int_val(i32 integer)
+{
+    return number_val(integer);
+}
+
 Value bool_val(b32 boolean)
 {
     Value value = {};
@@ -130,6 +183,20 @@ Value obj_val(Obj* object)
 
 #endif
 
+// Whole numbers that fit are stored with the int tag. -0 stays a double.
+static inline Value narrow_number(f64 number)
+{
+    if (number >= INT32_MIN && number <= INT32_MAX)
+    {
+        i32 integer = (i32)number;
+        if ((f64)integer == number && !(integer == 0 && std::signbit(number)))
+        {
+            return int_val(integer);
+        }
+    }
+    return number_val(number);
+}
+
 struct ValueArray
 {
     i32 capacity;
@@ -145,6 +212,7 @@ void init_value_array(ValueArray* array);
 void free_value_array(struct GarbageCollector* gc, ValueArray* array);
 void write_value_array(struct GarbageCollector* gc, ValueArray* array, Value value);
 void print_value(Value value);
+void print_number(f64 number);
 b32 values_equal(Value a, Value b);
 // =================================================================
 
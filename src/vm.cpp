@@ -5,6 +5,15 @@ void reset_stack(VM* vm)
     vm->open_upvalues = NULL;
 }
 
+// The code the frame runs. Frames that were running a function when it got
+// optimized carry on in its baseline code.
+static Chunk* frame_chunk(CallFrame* frame)
+{
+    Chunk* chunk = &frame->closure->function->chunk;
+    if (frame->ip > chunk->code && frame->ip <= chunk->code + chunk->count) return chunk;
+    return &frame->closure->function->baseline;
+}
+
 static void runtime_error(VM* vm, const char* format, ...)
 {
     va_list args;
@@ -18,8 +27,9 @@ static void runtime_error(VM* vm, const char* format, ...)
         CallFrame* frame = &vm->frames[i];
         ObjFunction* function = frame->closure->function;
 
-        size_t instruction = frame->ip - function->chunk.code - 1;
-        fprintf(stderr, "[line %d] in ", function->chunk.lines[instruction]);
+        Chunk* chunk = frame_chunk(frame);
+        size_t instruction = frame->ip - chunk->code - 1;
+        fprintf(stderr, "[line %d] in ", get_line(chunk, (i32)instruction));
 
         if (function->name == NULL)
         {
@@ -43,34 +53,274 @@ static void define_native(VM* vm, const char* name, NativeFn function, NativeArg
     pop(vm);
 }
 
-static Value clock_native(i32 arg_count, Value* args)
+static Value clock_native(VM* vm, i32 arg_count, Value* args)
 {
     return number_val((f64)clock() / CLOCKS_PER_SEC);
 }
 
-static Value sqrt_native(i32 arg_count, Value* args)
+static Value sqrt_native(VM* vm, i32 arg_count, Value* args)
 {
     Value value = args[0];
     return number_val(sqrt(AS_NUMBER(value)));
 }
 
-static Value pow_native(i32 arg_count, Value* args)
+static Value pow_native(VM* vm, i32 arg_count, Value* args)
 {
     Value value    = args[0];
     Value exponent = args[1];
     return number_val(pow(AS_NUMBER(value), AS_NUMBER(exponent)));
 }
 
-static Value atof_native(i32 arg_count, Value* args)
+static Value atof_native(VM* vm, i32 arg_count, Value* args)
 {
     Value value = args[0];
-    return number_val(atof(AS_CSTRING(value)));
+    if (!IS_STRING(value)) return number_val(0);
+
+    char buffer[SMALL_STRING_MAX + 1];
+    i32 length;
+    const char* chars = string_chars(value, buffer, &length);
+
+    // Slices are not NUL-terminated
+    char number[64];
+    if (length > (i32)sizeof(number) - 1) length = (i32)sizeof(number) - 1;
+    memcpy(number, chars, length);
+    number[length] = '\0';
+    return number_val(atof(number));
+}
+
+static Value length_native(VM* vm, i32 arg_count, Value* args)
+{
+    Value value = args[0];
+    if (IS_ARRAY(value)) return int_val(AS_ARRAY(value)->values.count);
+    if (IS_FLOAT64_ARRAY(value)) return int_val(AS_FLOAT64_ARRAY(value)->count);
+    if (IS_MAP(value)) return int_val(AS_MAP(value)->map.count);
+    if (!IS_STRING(value)) return nil_val();
+
+    char buffer[SMALL_STRING_MAX + 1];
+    i32 length;
+    string_chars(value, buffer, &length);
+    return int_val(length);
+}
+
+// Returns the characters in [start, end) without copying them. The indices are clamped to the string,
+// a NaN index returns nil since it has no place to clamp to.
+static Value substring_native(VM* vm, i32 arg_count, Value* args)
+{
+    Value value = args[0];
+    if (!IS_STRING(value)) return nil_val();
+
+    f64 start_number = AS_NUMBER(args[1]);
+    f64 end_number   = AS_NUMBER(args[2]);
+    if (std::isnan(start_number) || std::isnan(end_number)) return nil_val();
+
+    char buffer[SMALL_STRING_MAX + 1];
+    i32 length;
+    const char* chars = string_chars(value, buffer, &length);
+
+    i32 start = start_number < 0 ? 0 : start_number > length ? length : (i32)start_number;
+    i32 end   = end_number < start ? start : end_number > length ? length : (i32)end_number;
+
+    if (end - start <= SMALL_STRING_MAX)
+    {
+        return string_val(&vm->gc, &vm->store, &vm->strings, chars + start, end - start);
+    }
+    return OBJ_VAL(new_slice(&vm->gc, &vm->store, value, start, end - start));
+}
+
+// Appends to the array and returns its new length
+static Value push_native(VM* vm, i32 arg_count, Value* args)
+{
+    if (!IS_ARRAY(args[0])) return nil_val();
+
+    ObjArray* array = AS_ARRAY(args[0]);
+    write_value_array(&vm->gc, &array->values, args[1]);
+    return int_val(array->values.count);
+}
+
+// Removes and returns the last element, or nil if the array is empty
+static Value pop_native(VM* vm, i32 arg_count, Value* args)
+{
+    if (!IS_ARRAY(args[0])) return nil_val();
+
+    ObjArray* array = AS_ARRAY(args[0]);
+    if (array->values.count == 0) return nil_val();
+    return array->values.values[--array->values.count];
+}
+
+// float64_array(length) makes a zeroed buffer, float64_array(array) converts an array of numbers
+static Value float64_array_native(VM* vm, i32 arg_count, Value* args)
+{
+    Value source = args[0];
+    if (IS_NUMBER(source))
+    {
+        f64 length = AS_NUMBER(source);
+        if (length < 0 || length > INT32_MAX || length != (i32)length) return nil_val();
+        return OBJ_VAL(new_float64_array(&vm->gc, &vm->store, (i32)length));
+    }
+
+    if (!IS_ARRAY(source)) return nil_val();
+
+    ValueArray* elements = &AS_ARRAY(source)->values;
+    for (i32 i = 0; i < elements->count; i++)
+    {
+        if (!IS_NUMBER(elements->values[i])) return nil_val();
+    }
+
+    ObjFloat64Array* array = new_float64_array(&vm->gc, &vm->store, elements->count);
+    for (i32 i = 0; i < elements->count; i++)
+    {
+        array->values[i] = AS_NUMBER(elements->values[i]);
+    }
+    return OBJ_VAL(array);
+}
+
+// The bulk natives return nil unless given Float64Arrays of matching length
+static Value f64_sum_native(VM* vm, i32 arg_count, Value* args)
+{
+    if (!IS_FLOAT64_ARRAY(args[0])) return nil_val();
+    ObjFloat64Array* a = AS_FLOAT64_ARRAY(args[0]);
+    return number_val(numeric.sum(a->values, a->count));
+}
+
+static Value f64_min_native(VM* vm, i32 arg_count, Value* args)
+{
+    if (!IS_FLOAT64_ARRAY(args[0])) return nil_val();
+    ObjFloat64Array* a = AS_FLOAT64_ARRAY(args[0]);
+    return number_val(numeric.min(a->values, a->count));
+}
+
+static Value f64_max_native(VM* vm, i32 arg_count, Value* args)
+{
+    if (!IS_FLOAT64_ARRAY(args[0])) return nil_val();
+    ObjFloat64Array* a = AS_FLOAT64_ARRAY(args[0]);
+    return number_val(numeric.max(a->values, a->count));
+}
+
+static Value f64_dot_native(VM* vm, i32 arg_count, Value* args)
+{
+    if (!IS_FLOAT64_ARRAY(args[0]) || !IS_FLOAT64_ARRAY(args[1])) return nil_val();
+    ObjFloat64Array* a = AS_FLOAT64_ARRAY(args[0]);
+    ObjFloat64Array* b = AS_FLOAT64_ARRAY(args[1]);
+    if (a->count != b->count) return nil_val();
+    return number_val(numeric.dot(a->values, b->values, a->count));
+}
+
+// Scales a in place and returns it
+static Value f64_scale_native(VM* vm, i32 arg_count, Value* args)
+{
+    if (!IS_FLOAT64_ARRAY(args[0])) return nil_val();
+    ObjFloat64Array* a = AS_FLOAT64_ARRAY(args[0]);
+    numeric.scale(a->values, AS_NUMBER(args[1]), a->count);
+    return args[0];
+}
+
+// y = alpha * x + y, in place. Returns y.
+static Value f64_axpy_native(VM* vm, i32 arg_count, Value* args)
+{
+    if (!IS_FLOAT64_ARRAY(args[1]) || !IS_FLOAT64_ARRAY(args[2])) return nil_val();
+    ObjFloat64Array* x = AS_FLOAT64_ARRAY(args[1]);
+    ObjFloat64Array* y = AS_FLOAT64_ARRAY(args[2]);
+    if (x->count != y->count) return nil_val();
+    numeric.axpy(AS_NUMBER(args[0]), x->values, y->values, x->count);
+    return args[2];
+}
+
+static Value f64_add_native(VM* vm, i32 arg_count, Value* args)
+{
+    if (!IS_FLOAT64_ARRAY(args[0]) || !IS_FLOAT64_ARRAY(args[1])) return nil_val();
+    if (AS_FLOAT64_ARRAY(args[0])->count != AS_FLOAT64_ARRAY(args[1])->count) return nil_val();
+
+    ObjFloat64Array* out = new_float64_array(&vm->gc, &vm->store, AS_FLOAT64_ARRAY(args[0])->count);
+    numeric.add(AS_FLOAT64_ARRAY(args[0])->values, AS_FLOAT64_ARRAY(args[1])->values, out->values, out->count);
+    return OBJ_VAL(out);
+}
+
+static Value f64_mul_native(VM* vm, i32 arg_count, Value* args)
+{
+    if (!IS_FLOAT64_ARRAY(args[0]) || !IS_FLOAT64_ARRAY(args[1])) return nil_val();
+    if (AS_FLOAT64_ARRAY(args[0])->count != AS_FLOAT64_ARRAY(args[1])->count) return nil_val();
+
+    ObjFloat64Array* out = new_float64_array(&vm->gc, &vm->store, AS_FLOAT64_ARRAY(args[0])->count);
+    numeric.mul(AS_FLOAT64_ARRAY(args[0])->values, AS_FLOAT64_ARRAY(args[1])->values, out->values, out->count);
+    return OBJ_VAL(out);
+}
+
+// The keys of a map as an array, in insertion order
+static Value keys_native(VM* vm, i32 arg_count, Value* args)
+{
+    if (!IS_MAP(args[0])) return nil_val();
+
+    ObjArray* array = new_array(&vm->gc, &vm->store);
+    push(vm, OBJ_VAL(array));
+    Map* map = &AS_MAP(args[0])->map;
+    for (i32 i = 0; i < map->used; i++)
+    {
+        if (map->entries[i].live) write_value_array(&vm->gc, &array->values, map->entries[i].key);
+    }
+    pop(vm);
+    return OBJ_VAL(array);
+}
+
+// The values of a map as an array, in the same order as keys()
+static Value values_native(VM* vm, i32 arg_count, Value* args)
+{
+    if (!IS_MAP(args[0])) return nil_val();
+
+    ObjArray* array = new_array(&vm->gc, &vm->store);
+    push(vm, OBJ_VAL(array));
+    Map* map = &AS_MAP(args[0])->map;
+    for (i32 i = 0; i < map->used; i++)
+    {
+        if (map->entries[i].live) write_value_array(&vm->gc, &array->values, map->entries[i].value);
+    }
+    pop(vm);
+    return OBJ_VAL(array);
+}
+
+static Value has_native(VM* vm, i32 arg_count, Value* args)
+{
+    if (!IS_MAP(args[0])) return nil_val();
+
+    Value value;
+    return bool_val(map_get(&AS_MAP(args[0])->map, args[1], &value));
+}
+
+// Returns whether the key was in the map
+static Value remove_native(VM* vm, i32 arg_count, Value* args)
+{
+    if (!IS_MAP(args[0])) return nil_val();
+    return bool_val(map_delete(&AS_MAP(args[0])->map, args[1]));
+}
+
+// range(start, end) counts up from start to just below end
+static Value range_native(VM* vm, i32 arg_count, Value* args)
+{
+    return OBJ_VAL(new_range(&vm->gc, &vm->store, AS_NUMBER(args[0]), AS_NUMBER(args[1])));
+}
+
+static Value vec2_native(VM* vm, i32 arg_count, Value* args)
+{
+    f64 components[] = {AS_NUMBER(args[0]), AS_NUMBER(args[1])};
+    return OBJ_VAL(new_vector(&vm->gc, &vm->store, 2, components));
+}
+
+static Value vec3_native(VM* vm, i32 arg_count, Value* args)
+{
+    f64 components[] = {AS_NUMBER(args[0]), AS_NUMBER(args[1]), AS_NUMBER(args[2])};
+    return OBJ_VAL(new_vector(&vm->gc, &vm->store, 3, components));
+}
+
+static Value vec4_native(VM* vm, i32 arg_count, Value* args)
+{
+    f64 components[] = {AS_NUMBER(args[0]), AS_NUMBER(args[1]), AS_NUMBER(args[2]), AS_NUMBER(args[3])};
+    return OBJ_VAL(new_vector(&vm->gc, &vm->store, 4, components));
 }
 
 void init_vm(VM* vm)
 {
     reset_stack(vm);
     vm->store.objects = NULL;
+    vm->images = NULL;
     vm->gc = {};
     vm->gc.vm = vm;
     vm->gc.bytes_allocated = 0;
@@ -82,20 +332,50 @@ void init_vm(VM* vm)
     vm->init_string = copy_string(&vm->gc, &vm->store, &vm->strings, "init", 4);
     
     init_table(&vm->globals);
+    init_global_scope(&vm->global_scope);
+    init_table(&vm->modules);
 
     define_native(vm, "clock", clock_native, make_native_arguments(0));
     define_native(vm, "sqrt", sqrt_native, make_native_arguments(1, ValueType::VAL_NUMBER));
     define_native(vm, "pow", pow_native, make_native_arguments(2, ValueType::VAL_NUMBER, ValueType::VAL_NUMBER));
     define_native(vm, "atof", atof_native, make_native_arguments(1, ValueType::VAL_OBJ));
+    define_native(vm, "length", length_native, make_native_arguments(1, ValueType::VAL_OBJ));
+    define_native(vm, "substring", substring_native, make_native_arguments(3, ValueType::VAL_OBJ, ValueType::VAL_NUMBER, ValueType::VAL_NUMBER));
+    define_native(vm, "push", push_native, make_native_arguments(2, ValueType::VAL_OBJ, ValueType::VAL_ANY));
+    define_native(vm, "pop", pop_native, make_native_arguments(1, ValueType::VAL_OBJ));
+
+    init_numeric();
+    define_native(vm, "float64_array", float64_array_native, make_native_arguments(1, ValueType::VAL_ANY));
+    define_native(vm, "f64_sum", f64_sum_native, make_native_arguments(1, ValueType::VAL_OBJ));
+    define_native(vm, "f64_min", f64_min_native, make_native_arguments(1, ValueType::VAL_OBJ));
+    define_native(vm, "f64_max", f64_max_native, make_native_arguments(1, ValueType::VAL_OBJ));
+    define_native(vm, "f64_dot", f64_dot_native, make_native_arguments(2, ValueType::VAL_OBJ, ValueType::VAL_OBJ));
+    define_native(vm, "f64_scale", f64_scale_native, make_native_arguments(2, ValueType::VAL_OBJ, ValueType::VAL_NUMBER));
+    define_native(vm, "f64_axpy", f64_axpy_native, make_native_arguments(3, ValueType::VAL_NUMBER, ValueType::VAL_OBJ, ValueType::VAL_OBJ));
+    define_native(vm, "f64_add", f64_add_native, make_native_arguments(2, ValueType::VAL_OBJ, ValueType::VAL_OBJ));
+    define_native(vm, "f64_mul", f64_mul_native, make_native_arguments(2, ValueType::VAL_OBJ, ValueType::VAL_OBJ));
+
+    define_native(vm, "range", range_native, make_native_arguments(2, ValueType::VAL_NUMBER, ValueType::VAL_NUMBER));
+    define_native(vm, "keys", keys_native, make_native_arguments(1, ValueType::VAL_OBJ));
+    define_native(vm, "values", values_native, make_native_arguments(1, ValueType::VAL_OBJ));
+    define_native(vm, "has", has_native, make_native_arguments(2, ValueType::VAL_OBJ, ValueType::VAL_ANY));
+    define_native(vm, "remove", remove_native, make_native_arguments(2, ValueType::VAL_OBJ, ValueType::VAL_ANY));
+
+    define_native(vm, "vec2", vec2_native, make_native_arguments(2, ValueType::VAL_NUMBER, ValueType::VAL_NUMBER));
+    define_native(vm, "vec3", vec3_native, make_native_arguments(3, ValueType::VAL_NUMBER, ValueType::VAL_NUMBER, ValueType::VAL_NUMBER));
+    define_native(vm, "vec4", vec4_native, make_native_arguments(4, ValueType::VAL_NUMBER, ValueType::VAL_NUMBER, ValueType::VAL_NUMBER, ValueType::VAL_NUMBER));
 }
 
 void free_vm(VM* vm)
 {
     free_table(&vm->gc, &vm->strings);
     free_table(&vm->gc, &vm->globals);
+    free_global_scope(&vm->global_scope);
+    free_table(&vm->gc, &vm->modules);
 
     vm->init_string = NULL;
     free_objects(&vm->store, &vm->gc);
+    free_bytecode_images(&vm->images);
 }
 
 static void push(VM* vm, Value value)
@@ -115,6 +395,33 @@ static Value peek(VM* vm, i32 distance)
     return vm->stack_top[-1 - distance];
 }
 
+// The labels of an OP_SWITCH_HASH, mapped to their entry numbers. Each switch in
+// the function has its own table, built from the label constants the first time it runs.
+static Map* switch_labels(VM* vm, ObjFunction* function, u8 table, u8* entries, u16 count)
+{
+    if (table >= function->switch_map_count)
+    {
+        i32 old_count = function->switch_map_count;
+        function->switch_maps = GROW_ARRAY(&vm->gc, Map, function->switch_maps, old_count, table + 1);
+        for (i32 i = old_count; i <= table; i++) init_map(&function->switch_maps[i]);
+        function->switch_map_count = table + 1;
+    }
+
+    Map* labels = &function->switch_maps[table];
+    if (labels->count == 0)
+    {
+        // The first of equal labels wins, like the comparisons would have it
+        for (i32 i = 0; i < count; i++)
+        {
+            u8* entry = entries + i * SWITCH_HASH_ENTRY;
+            Value label = function->chunk.constants.values[(u32)entry[0] << 16 | (u32)entry[1] << 8 | entry[2]];
+            Value existing;
+            if (!map_get(labels, label, &existing)) map_set(&vm->gc, labels, label, int_val(i));
+        }
+    }
+    return labels;
+}
+
 static b32 call(VM* vm, ObjClosure* closure, i32 arg_count)
 {
     if (arg_count != closure->function->arity)
@@ -129,6 +436,33 @@ static b32 call(VM* vm, ObjClosure* closure, i32 arg_count)
         return false;
     }
     
+    if (closure->function->image)
+    {
+        load_image_constants(&vm->gc, closure->function, &vm->store, &vm->strings);
+    }
+
+    if (closure->function->lazy_source &&
+        !compile_lazy_function(&vm->gc, closure->function, &vm->store, &vm->strings, &vm->global_scope))
+    {
+        runtime_error(vm, "Could not compile function '%s'.", closure->function->name->chars);
+        return false;
+    }
+
+    // Room for the locals of the callee and the temporaries of its expressions
+    if (vm->stack_top + closure->function->slot_count + UINT8_COUNT > vm->stack + STACK_MAX)
+    {
+        runtime_error(vm, "Stack overflow.");
+        return false;
+    }
+
+#ifdef OPTIMIZE_HOT_FUNCTIONS
+    ObjFunction* function = closure->function;
+    if (function->call_count < OPTIMIZE_THRESHOLD && ++function->call_count == OPTIMIZE_THRESHOLD)
+    {
+        optimize_function(&vm->gc, function);
+    }
+#endif
+
     CallFrame* frame = &vm->frames[vm->frame_count++];
     frame->closure = closure;
     frame->ip = closure->function->chunk.code;
@@ -137,6 +471,19 @@ static b32 call(VM* vm, ObjClosure* closure, i32 arg_count)
     return true;
 }
 
+static b32 native_argument_matches(Value arg, ValueType type)
+{
+    switch (type)
+    {
+        case VAL_BOOL:   return IS_BOOL(arg);
+        case VAL_NIL:    return IS_NIL(arg);
+        case VAL_NUMBER: return IS_NUMBER(arg);
+        case VAL_OBJ:    return IS_OBJ(arg) || IS_SMALL_STRING(arg); // Small strings are still strings to natives
+        case VAL_ANY:    return true;
+    }
+    return false;
+}
+
 static b32 call_value(VM* vm, Value callee, i32 arg_count)
 {
     if (IS_OBJ(callee))
@@ -187,12 +534,7 @@ static b32 call_value(VM* vm, Value callee, i32 arg_count)
 
                 for(i32 i = 0; i < arg_count; i++)
                 {
-                    Value arg = arguments[i];
-                    ValueType type = obj->arguments.types[i];
-                    if ((IS_NUMBER(arg) && type != VAL_NUMBER)
-                        || (IS_BOOL(arg) && type != VAL_BOOL)
-                        || (IS_NIL(arg) && type != VAL_NIL)
-                        || (IS_OBJ(arg) && type != VAL_OBJ))
+                    if (!native_argument_matches(arguments[i], obj->arguments.types[i]))
                     {
                         // @Incomplete: Add formatting that reports native function name and argument types
                         runtime_error(vm, "Type mismatch in native function call arguments.");
@@ -201,7 +543,7 @@ static b32 call_value(VM* vm, Value callee, i32 arg_count)
                 }
             
                 NativeFn native = AS_NATIVE(callee)->function;
-                Value result = native(arg_count, vm->stack_top - arg_count);
+                Value result = native(vm, arg_count, vm->stack_top - arg_count);
                 vm->stack_top -= arg_count + 1;
                 push(vm, result);
                 return true;
@@ -317,28 +659,200 @@ static b32 is_falsey(Value value)
     return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
+// NaN is never equal to itself, so a NaN key could be stored but never found again
+static b32 check_map_key(VM* vm, Value key)
+{
+    if (IS_NUMBER(key) && AS_NUMBER(key) != AS_NUMBER(key))
+    {
+        runtime_error(vm, "Map key can't be NaN.");
+        return false;
+    }
+    return true;
+}
+
+static b32 array_index(VM* vm, i32 count, Value index, i32* result)
+{
+    if (IS_INT(index))
+    {
+        i32 i = AS_INT(index);
+        if (i < 0 || i >= count)
+        {
+            runtime_error(vm, "Array index %d out of bounds for length %d.", i, count);
+            return false;
+        }
+        *result = i;
+        return true;
+    }
+
+    if (!IS_NUMBER(index))
+    {
+        runtime_error(vm, "Array index must be a number.");
+        return false;
+    }
+
+    f64 number = AS_NUMBER(index);
+    if (std::isnan(number))
+    {
+        runtime_error(vm, "Array index must be an integer.");
+        return false;
+    }
+    if (number < 0 || number >= count)
+    {
+        runtime_error(vm, "Array index %g out of bounds for length %d.", number, count);
+        return false;
+    }
+
+    i32 i = (i32)number;
+    if ((f64)i != number)
+    {
+        runtime_error(vm, "Array index must be an integer.");
+        return false;
+    }
+
+    *result = i;
+    return true;
+}
+
+// Bitwise operators work on 32-bit integers. Whole doubles wrap modulo 2^32 the
+// way they would in a C cast through u32, fractions are an error.
+static b32 integer_operand(VM* vm, Value value, i32* result)
+{
+    if (IS_INT(value))
+    {
+        *result = AS_INT(value);
+        return true;
+    }
+
+    if (IS_NUMBER(value))
+    {
+        f64 number = AS_NUMBER(value);
+        if (number == floor(number) && number - number == 0)
+        {
+            *result = (i32)(u32)(i64)fmod(number, 4294967296.0);
+            return true;
+        }
+    }
+
+    runtime_error(vm, "Operands must be integers.");
+    return false;
+}
+
+// Componentwise arithmetic on vectors of the same size. Vectors can also be
+// scaled by a number with * and /. Reports the error when the operands don't fit.
+static b32 vector_arithmetic(VM* vm, OpCode op)
+{
+    Value b = peek(vm, 0);
+    Value a = peek(vm, 1);
+
+    f64 lhs[VECTOR_MAX];
+    f64 rhs[VECTOR_MAX];
+    i32 count;
+    if (IS_VECTOR(a) && IS_VECTOR(b))
+    {
+        if (AS_VECTOR(a)->count != AS_VECTOR(b)->count)
+        {
+            runtime_error(vm, "Vector sizes must match.");
+            return false;
+        }
+        count = AS_VECTOR(a)->count;
+        memcpy(lhs, AS_VECTOR(a)->components, sizeof(lhs));
+        memcpy(rhs, AS_VECTOR(b)->components, sizeof(rhs));
+    }
+    else if (IS_VECTOR(a) && IS_NUMBER(b) && (op == OP_MULTIPLY || op == OP_DIVIDE))
+    {
+        count = AS_VECTOR(a)->count;
+        memcpy(lhs, AS_VECTOR(a)->components, sizeof(lhs));
+        for (i32 i = 0; i < VECTOR_MAX; i++) rhs[i] = AS_NUMBER(b);
+    }
+    else if (IS_NUMBER(a) && IS_VECTOR(b) && op == OP_MULTIPLY)
+    {
+        count = AS_VECTOR(b)->count;
+        for (i32 i = 0; i < VECTOR_MAX; i++) lhs[i] = AS_NUMBER(a);
+        memcpy(rhs, AS_VECTOR(b)->components, sizeof(rhs));
+    }
+    else
+    {
+        if (op == OP_ADD)
+        {
+            runtime_error(vm, "Operands must be two numbers, two strings or two vectors.");
+        }
+        else
+        {
+            runtime_error(vm, "Operands must be numbers or vectors.");
+        }
+        return false;
+    }
+
+    f64 result[VECTOR_MAX];
+    for (i32 i = 0; i < VECTOR_MAX; i++)
+    {
+        switch (op)
+        {
+            case OP_ADD:      result[i] = lhs[i] + rhs[i]; break;
+            case OP_SUBTRACT: result[i] = lhs[i] - rhs[i]; break;
+            case OP_MULTIPLY: result[i] = lhs[i] * rhs[i]; break;
+            default:          result[i] = lhs[i] / rhs[i]; break;
+        }
+    }
+
+    // The operands stay on the stack until the result exists
+    ObjVector* vector = new_vector(&vm->gc, &vm->store, count, result);
+    vm->stack_top -= 2;
+    push(vm, OBJ_VAL(vector));
+    return true;
+}
+
+// Maps .x .y .z .w to a component index, or -1
+static i32 vector_component(ObjString* name)
+{
+    if (name->length != 1) return -1;
+    switch (name->chars[0])
+    {
+        case 'x': return 0;
+        case 'y': return 1;
+        case 'z': return 2;
+        case 'w': return 3;
+    }
+    return -1;
+}
+
 static void concatenate(VM* vm)
 {
-    ObjString* b = AS_STRING(peek(vm, 0));
-    ObjString* a = AS_STRING(peek(vm, 1));
+    char b_buffer[SMALL_STRING_MAX + 1];
+    char a_buffer[SMALL_STRING_MAX + 1];
+    i32 b_length, a_length;
+    const char* b_chars = string_chars(peek(vm, 0), b_buffer, &b_length);
+    const char* a_chars = string_chars(peek(vm, 1), a_buffer, &a_length);
 
-    i32 length = a->length + b->length;
-    char* chars = ALLOCATE(&vm->gc, char, length + 1);
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
+    i32 length = a_length + b_length;
+    Value result;
+
+#ifdef NAN_BOXING
+    if (length <= SMALL_STRING_MAX)
+    {
+        char chars[SMALL_STRING_MAX];
+        memcpy(chars, a_chars, a_length);
+        memcpy(chars + a_length, b_chars, b_length);
+        result = small_string_val(chars, length);
+    }
+    else
+#endif
+    {
+        char* chars = ALLOCATE(&vm->gc, char, length + 1);
+        memcpy(chars, a_chars, a_length);
+        memcpy(chars + a_length, b_chars, b_length);
+        chars[length] = '\0';
+
+        result = OBJ_VAL(take_string(&vm->gc, &vm->store, &vm->strings, chars, length));
+    }
 
-    ObjString* result = take_string(&vm->gc, &vm->store, &vm->strings, chars, length);
     pop(vm);
     pop(vm);
-    push(vm, OBJ_VAL(result));
+    push(vm, result);
 }
 
-InterpretResult interpret(VM* vm, const char* source)
+static InterpretResult run_script(VM* vm, ObjFunction* function)
 {
-    ObjFunction* function = compile(&vm->gc, source, &vm->store, &vm->strings);
-    if (function == NULL) return INTERPRET_COMPILE_ERROR;
-
     push(vm, OBJ_VAL(function));
     ObjClosure* closure = new_closure(&vm->gc, function, &vm->store);
     pop(vm);
@@ -348,16 +862,87 @@ InterpretResult interpret(VM* vm, const char* source)
     return run(vm);
 }
 
+// Loads and runs the modules the script imports first. Frees the import list.
+static InterpretResult run_importing_script(VM* vm, ObjFunction* function, const char* path, ImportList* imports)
+{
+    InterpretResult result = INTERPRET_OK;
+    if (imports->count > 0)
+    {
+        push(vm, OBJ_VAL(function));
+        result = import_modules(vm, path, imports);
+
+        // A runtime error has already reset the stack
+        if (result != INTERPRET_RUNTIME_ERROR) pop(vm);
+    }
+    FREE_ARRAY(&vm->gc, Token, imports->paths, imports->capacity);
+
+    if (result != INTERPRET_OK) return result;
+    return run_script(vm, function);
+}
+
+// With lazy set, source has to outlive every call of the functions it defines.
+// Imports are resolved relative to path, or the working directory when it is NULL.
+InterpretResult interpret(VM* vm, const char* source, const char* path, b32 lazy)
+{
+    ImportList imports = {};
+    ObjFunction* function = compile(&vm->gc, source, &vm->store, &vm->strings, &vm->global_scope, &imports, lazy);
+    if (function == NULL)
+    {
+        FREE_ARRAY(&vm->gc, Token, imports.paths, imports.capacity);
+        return INTERPRET_COMPILE_ERROR;
+    }
+
+    return run_importing_script(vm, function, path, &imports);
+}
+
+// Runs the cached bytecode at cache_path when it was compiled from this exact
+// source, otherwise compiles and refreshes the cache for the next run. Scripts
+// with imports are not cached, the image has no record of them.
+InterpretResult interpret_cached(VM* vm, const char* source, const char* path, const char* cache_path)
+{
+    ObjFunction* function = load_bytecode_cache(&vm->gc, cache_path, source, &vm->store, &vm->strings);
+    if (function != NULL) return run_script(vm, function);
+
+    ImportList imports = {};
+    function = compile(&vm->gc, source, &vm->store, &vm->strings, &vm->global_scope, &imports, false);
+    if (function == NULL)
+    {
+        FREE_ARRAY(&vm->gc, Token, imports.paths, imports.capacity);
+        return INTERPRET_COMPILE_ERROR;
+    }
+
+    if (imports.count == 0)
+    {
+        push(vm, OBJ_VAL(function));
+        save_bytecode_cache(&vm->gc, function, cache_path, source);
+        pop(vm);
+    }
+
+    return run_importing_script(vm, function, path, &imports);
+}
+
 static InterpretResult run(VM* vm)
 {
     CallFrame* frame = &vm->frames[vm->frame_count - 1];
+
+    // The high bits an OP_WIDE or OP_WIDE_LONG prefix adds to the next index operand
+    u32 wide = 0;
+    u32 wide_index = 0;
 #define READ_BYTE() (*frame->ip++)
-#define READ_CONSTANT() (frame->closure->function->chunk.constants.values[READ_BYTE()])
+#define READ_INDEX() (wide_index = wide | READ_BYTE(), wide = 0, wide_index)
+#define READ_CONSTANT() (frame->closure->function->chunk.constants.values[READ_INDEX()])
 #define READ_SHORT() (frame->ip += 2, (u16)(frame->ip[-2] << 8) | frame->ip[-1])
 #define READ_STRING() (AS_STRING(READ_CONSTANT()))
 
 #define BINARY_OP(value_type, op)                               \
     do {                                                        \
+        if (IS_INT(peek(vm, 0)) && IS_INT(peek(vm, 1)))         \
+        {                                                       \
+            i32 b = AS_INT(pop(vm));                            \
+            i32 a = AS_INT(pop(vm));                            \
+            push(vm, value_type(a op b));                       \
+            break;                                              \
+        }                                                       \
         if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) \
         {                                                       \
             runtime_error(vm, "Operands must be numbers.");     \
@@ -368,6 +953,61 @@ static InterpretResult run(VM* vm)
         push(vm, value_type(a op b));                           \
     } while(false)
 
+// Ints stay ints until the result leaves the i32 range, then they become doubles.
+// A zero result goes through the doubles too, since 0 * -1 is -0.
+#define ARITHMETIC_OP(op, opcode)                                 \
+    do {                                                          \
+        if (IS_INT(peek(vm, 0)) && IS_INT(peek(vm, 1)))           \
+        {                                                         \
+            i64 b = AS_INT(pop(vm));                              \
+            i64 a = AS_INT(pop(vm));                              \
+            i64 result = a op b;                                  \
+            push(vm, result == (i32)result && result != 0         \
+                     ? int_val((i32)result)                       \
+                     : narrow_number((f64)a op (f64)b));          \
+        }                                                         \
+        else if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 1)))\
+        {                                                         \
+            f64 b = AS_NUMBER(pop(vm));                           \
+            f64 a = AS_NUMBER(pop(vm));                           \
+            push(vm, number_val(a op b));                         \
+        }                                                         \
+        else if (!vector_arithmetic(vm, opcode))                  \
+        {                                                         \
+            return INTERPRET_RUNTIME_ERROR;                       \
+        }                                                         \
+    } while(false)
+
+#define BITWISE_OP(op)                                            \
+    do {                                                          \
+        i32 a, b;                                                 \
+        if (!integer_operand(vm, peek(vm, 1), &a) ||              \
+            !integer_operand(vm, peek(vm, 0), &b))                \
+        {                                                         \
+            return INTERPRET_RUNTIME_ERROR;                       \
+        }                                                         \
+        vm->stack_top -= 2;                                       \
+        push(vm, int_val(op));                                    \
+    } while(false)
+
+// The optimizer only emits these on operands it knows are numbers
+#define NUMBER_OP(op)                                             \
+    do {                                                          \
+        Value b = pop(vm);                                        \
+        Value a = pop(vm);                                        \
+        if (IS_INT(a) && IS_INT(b))                               \
+        {                                                         \
+            i64 result = (i64)AS_INT(a) op AS_INT(b);             \
+            push(vm, result == (i32)result && result != 0         \
+                     ? int_val((i32)result)                       \
+                     : narrow_number((f64)AS_INT(a) op (f64)AS_INT(b))); \
+        }                                                         \
+        else                                                      \
+        {                                                         \
+            push(vm, number_val(AS_NUMBER(a) op AS_NUMBER(b)));   \
+        }                                                         \
+    } while(false)
+
     for(;;)
     {
 #ifdef DEBUG_TRACE_EXECUTION
@@ -379,8 +1019,7 @@ static InterpretResult run(VM* vm)
             printf(" ]");
         }
         printf("\n");
-        disassemble_instruction(&frame->closure->function->chunk,
-                                (i32)(frame->ip - frame->closure->function->chunk.code));
+        disassemble_instruction(frame_chunk(frame), (i32)(frame->ip - frame_chunk(frame)->code));
 #endif
         u8 instruction;
         switch(instruction = READ_BYTE())
@@ -403,6 +1042,39 @@ static InterpretResult run(VM* vm)
                 if (is_falsey(peek(vm, 0))) frame->ip += offset;
             }
             break;
+            case OP_SWITCH_TABLE:
+            {
+                u8* operands = frame->ip;
+                i32 min = (i32)((u32)operands[0] << 24 | (u32)operands[1] << 16 | (u32)operands[2] << 8 | operands[3]);
+                u16 count = (u16)(operands[4] << 8 | operands[5]);
+                u8* target = operands + 6;
+                frame->ip = operands + 8 + 2 * count;
+
+                i32 key;
+                if (switch_key(pop(vm), &key) && (i64)key - min >= 0 && (i64)key - min < count)
+                {
+                    target = operands + 8 + 2 * ((i64)key - min);
+                }
+                frame->ip -= (u16)(target[0] << 8 | target[1]);
+            }
+            break;
+            case OP_SWITCH_HASH:
+            {
+                u8* operands = frame->ip;
+                u16 count = (u16)(operands[1] << 8 | operands[2]);
+                u8* target = operands + 3;
+                frame->ip = operands + 5 + SWITCH_HASH_ENTRY * count;
+
+                Map* labels = switch_labels(vm, frame->closure->function, operands[0], operands + 5, count);
+                Value entry;
+                if (map_get(labels, peek(vm, 0), &entry))
+                {
+                    target = operands + 5 + SWITCH_HASH_ENTRY * AS_INT(entry) + 3;
+                }
+                pop(vm);
+                frame->ip -= (u16)(target[0] << 8 | target[1]);
+            }
+            break;
             case OP_COMPARE:
             {
                 Value b = peek(vm, 0);
@@ -416,6 +1088,89 @@ static InterpretResult run(VM* vm)
                 frame->ip -= offset;
             }
             break;
+            case OP_FOR_ITER:
+            {
+                Value* slots = frame->slots + READ_INDEX();
+                u16 exit_offset = READ_SHORT();
+                u8* exit = frame->ip + exit_offset;
+                u16 body_offset = READ_SHORT();
+
+                // slots[0] is the loop variable, slots[1] the iterable and slots[2] the cursor.
+                // The cursor starts as nil and is a plain number for every built-in iterable.
+                Value iterable = slots[1];
+                if (IS_INSTANCE(iterable))
+                {
+                    // Fall through to the iterate/iterator_value calls
+                    break;
+                }
+
+                i32 position = IS_NIL(slots[2]) ? 0 : AS_INT(slots[2]);
+                if (IS_ARRAY(iterable))
+                {
+                    ValueArray* values = &AS_ARRAY(iterable)->values;
+                    if (position >= values->count)
+                    {
+                        frame->ip = exit;
+                        break;
+                    }
+                    slots[0] = values->values[position];
+                }
+                else if (IS_FLOAT64_ARRAY(iterable))
+                {
+                    ObjFloat64Array* array = AS_FLOAT64_ARRAY(iterable);
+                    if (position >= array->count)
+                    {
+                        frame->ip = exit;
+                        break;
+                    }
+                    slots[0] = number_val(array->values[position]);
+                }
+                else if (IS_MAP(iterable))
+                {
+                    // Maps yield their keys in insertion order
+                    Map* map = &AS_MAP(iterable)->map;
+                    while (position < map->used && !map->entries[position].live) position++;
+                    if (position >= map->used)
+                    {
+                        frame->ip = exit;
+                        break;
+                    }
+                    slots[0] = map->entries[position].key;
+                }
+                else if (IS_RANGE(iterable))
+                {
+                    ObjRange* range = AS_RANGE(iterable);
+                    f64 next = range->start + position;
+                    if (next >= range->end)
+                    {
+                        frame->ip = exit;
+                        break;
+                    }
+                    slots[0] = narrow_number(next);
+                }
+                else if (IS_STRING(iterable))
+                {
+                    // One character strings, which are small strings and never allocate when NaN boxing
+                    char buffer[SMALL_STRING_MAX + 1];
+                    i32 length;
+                    const char* chars = string_chars(iterable, buffer, &length);
+                    if (position >= length)
+                    {
+                        frame->ip = exit;
+                        break;
+                    }
+                    slots[0] = string_val(&vm->gc, &vm->store, &vm->strings, chars + position, 1);
+                }
+                else
+                {
+                    runtime_error(vm, "Can only iterate over arrays, maps, strings, ranges and instances.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                slots[2] = int_val(position + 1);
+                frame->ip += body_offset;
+            }
+            break;
             case OP_CALL:
             {
                 i32 arg_count = READ_BYTE();
@@ -456,15 +1211,16 @@ static InterpretResult run(VM* vm)
                 push(vm, OBJ_VAL(closure));
                 for(i32 i = 0; i < closure->upvalue_count; i++)
                 {
-                    u8 is_local = READ_BYTE();
-                    u8 index = READ_BYTE();
-                    if(is_local)
+                    u8 flags = READ_BYTE();
+                    u32 slot = READ_BYTE();
+                    for (i32 byte = 0; byte < flags >> 1; byte++) slot = slot << 8 | READ_BYTE();
+                    if(flags & 1)
                     {
-                        closure->upvalues[i] = capture_upvalue(vm, frame->slots + index);
+                        closure->upvalues[i] = capture_upvalue(vm, frame->slots + slot);
                     }
                     else
                     {
-                        closure->upvalues[i] = frame->closure->upvalues[index];
+                        closure->upvalues[i] = frame->closure->upvalues[slot];
                     }
                 }
             }
@@ -528,7 +1284,7 @@ static InterpretResult run(VM* vm)
             case OP_POP: pop(vm); break;
             case OP_GET_LOCAL:
             {
-                u8 slot = READ_BYTE();
+                u32 slot = READ_INDEX();
                 push(vm, frame->slots[slot]);
             }
             break;
@@ -553,7 +1309,7 @@ static InterpretResult run(VM* vm)
             break;
             case OP_SET_LOCAL:
             {
-                u8 slot = READ_BYTE();
+                u32 slot = READ_INDEX();
                 frame->slots[slot] = peek(vm, 0);
             }
             break;
@@ -570,18 +1326,33 @@ static InterpretResult run(VM* vm)
             break;
             case OP_GET_UPVALUE:
             {
-                u8 slot = READ_BYTE();
+                u32 slot = READ_INDEX();
                 push(vm, *frame->closure->upvalues[slot]->location);
             }
             break;
             case OP_SET_UPVALUE:
             {
-                u8 slot = READ_BYTE();
+                u32 slot = READ_INDEX();
                 *frame->closure->upvalues[slot]->location = peek(vm, 0);
             }
             break;
             case OP_GET_PROPERTY:
             {
+                if (IS_VECTOR(peek(vm, 0)))
+                {
+                    ObjVector* vector = AS_VECTOR(peek(vm, 0));
+                    ObjString* name = READ_STRING();
+                    i32 component = vector_component(name);
+                    if (component < 0 || component >= vector->count)
+                    {
+                        runtime_error(vm, "Undefined property '%s'.", name->chars);
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    pop(vm);
+                    push(vm, number_val(vector->components[component]));
+                    break;
+                }
+
                 if (!IS_INSTANCE(peek(vm, 0)))
                 {
                     runtime_error(vm, "Only instances have properties.");
@@ -630,6 +1401,162 @@ static InterpretResult run(VM* vm)
                 }
             }
             break;
+            case OP_ARRAY:
+            {
+                u8 element_count = READ_BYTE();
+                ObjArray* array = new_array(&vm->gc, &vm->store);
+                push(vm, OBJ_VAL(array));
+
+                if (element_count > 0)
+                {
+                    ValueArray* values = &array->values;
+                    values->values   = GROW_ARRAY(&vm->gc, Value, NULL, 0, element_count);
+                    values->capacity = element_count;
+                    values->count    = element_count;
+                    memcpy(values->values, vm->stack_top - 1 - element_count, sizeof(Value) * element_count);
+                }
+
+                vm->stack_top -= element_count + 1;
+                push(vm, OBJ_VAL(array));
+            }
+            break;
+            case OP_MAP:
+            {
+                u8 entry_count = READ_BYTE();
+                ObjMap* map = new_map(&vm->gc, &vm->store);
+                push(vm, OBJ_VAL(map));
+
+                Value* entries = vm->stack_top - 1 - entry_count * 2;
+                for (i32 i = 0; i < entry_count; i++)
+                {
+                    if (!check_map_key(vm, entries[i * 2]))
+                    {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    map_set(&vm->gc, &map->map, entries[i * 2], entries[i * 2 + 1]);
+                }
+
+                vm->stack_top -= entry_count * 2 + 1;
+                push(vm, OBJ_VAL(map));
+            }
+            break;
+            case OP_ARRAY_EXTEND:
+            {
+                // The array and the elements stay on the stack until they are all in
+                u8 element_count = READ_BYTE();
+                Value* elements = vm->stack_top - element_count;
+                ObjArray* array = AS_ARRAY(elements[-1]);
+                for (i32 i = 0; i < element_count; i++)
+                {
+                    write_value_array(&vm->gc, &array->values, elements[i]);
+                }
+                vm->stack_top -= element_count;
+            }
+            break;
+            case OP_MAP_EXTEND:
+            {
+                u8 entry_count = READ_BYTE();
+                Value* entries = vm->stack_top - entry_count * 2;
+                ObjMap* map = AS_MAP(entries[-1]);
+                for (i32 i = 0; i < entry_count; i++)
+                {
+                    if (!check_map_key(vm, entries[i * 2]))
+                    {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    map_set(&vm->gc, &map->map, entries[i * 2], entries[i * 2 + 1]);
+                }
+                vm->stack_top -= entry_count * 2;
+            }
+            break;
+            case OP_INDEX_GET:
+            {
+                Value target = peek(vm, 1);
+                i32 index;
+                if (IS_ARRAY(target))
+                {
+                    ObjArray* array = AS_ARRAY(target);
+                    if (!array_index(vm, array->values.count, peek(vm, 0), &index))
+                    {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    vm->stack_top -= 2;
+                    push(vm, array->values.values[index]);
+                }
+                else if (IS_FLOAT64_ARRAY(target))
+                {
+                    ObjFloat64Array* array = AS_FLOAT64_ARRAY(target);
+                    if (!array_index(vm, array->count, peek(vm, 0), &index))
+                    {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    vm->stack_top -= 2;
+                    push(vm, number_val(array->values[index]));
+                }
+                else if (IS_MAP(target))
+                {
+                    // Missing keys read as nil
+                    Value value;
+                    if (!map_get(&AS_MAP(target)->map, peek(vm, 0), &value))
+                    {
+                        value = nil_val();
+                    }
+                    vm->stack_top -= 2;
+                    push(vm, value);
+                }
+                else
+                {
+                    runtime_error(vm, "Only arrays and maps can be indexed.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+            }
+            break;
+            case OP_INDEX_SET:
+            {
+                Value target = peek(vm, 2);
+                Value value  = peek(vm, 0);
+                i32 index;
+                if (IS_ARRAY(target))
+                {
+                    ObjArray* array = AS_ARRAY(target);
+                    if (!array_index(vm, array->values.count, peek(vm, 1), &index))
+                    {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    array->values.values[index] = value;
+                }
+                else if (IS_FLOAT64_ARRAY(target))
+                {
+                    ObjFloat64Array* array = AS_FLOAT64_ARRAY(target);
+                    if (!IS_NUMBER(value))
+                    {
+                        runtime_error(vm, "Float64Array elements must be numbers.");
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    if (!array_index(vm, array->count, peek(vm, 1), &index))
+                    {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    array->values[index] = AS_NUMBER(value);
+                }
+                else if (IS_MAP(target))
+                {
+                    if (!check_map_key(vm, peek(vm, 1)))
+                    {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    map_set(&vm->gc, &AS_MAP(target)->map, peek(vm, 1), value);
+                }
+                else
+                {
+                    runtime_error(vm, "Only arrays and maps can be indexed.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                vm->stack_top -= 3;
+                push(vm, value);
+            }
+            break;
             case OP_EQUAL:
             {
                 Value b = pop(vm);
@@ -645,22 +1572,150 @@ static InterpretResult run(VM* vm)
                 {
                     concatenate(vm);
                 }
-                else if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 1)))
+                else
+                {
+                    ARITHMETIC_OP(+, OP_ADD);
+                }
+            }
+            break;
+            case OP_SUBTRACT: ARITHMETIC_OP(-, OP_SUBTRACT); break;
+            case OP_MULTIPLY: ARITHMETIC_OP(*, OP_MULTIPLY); break;
+            case OP_DIVIDE:
+            {
+                // Exact int quotients stay ints, everything else divides as doubles
+                if (IS_INT(peek(vm, 0)) && IS_INT(peek(vm, 1)))
+                {
+                    i64 b = AS_INT(peek(vm, 0));
+                    i64 a = AS_INT(peek(vm, 1));
+                    if (b != 0 && a % b == 0 && a / b == (i32)(a / b) && !(a == 0 && b < 0))
+                    {
+                        vm->stack_top -= 2;
+                        push(vm, int_val((i32)(a / b)));
+                        break;
+                    }
+                }
+
+                if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 1)))
                 {
                     f64 b = AS_NUMBER(pop(vm));
                     f64 a = AS_NUMBER(pop(vm));
-                    push(vm, number_val(a + b));
+                    push(vm, number_val(a / b));
                 }
-                else
+                else if (!vector_arithmetic(vm, OP_DIVIDE))
+                {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+            }
+            break;
+            case OP_GUARD_CALLEE:
+            {
+                // Skips the inlined body unless the callee is still the function it was inlined from
+                Obj* function = AS_OBJ(READ_CONSTANT());
+                Value callee = peek(vm, READ_BYTE());
+                u16 offset = READ_SHORT();
+                if (!IS_CLOSURE(callee) || (Obj*)AS_CLOSURE(callee)->function != function) frame->ip += offset;
+            }
+            break;
+            case OP_INLINED_RETURN:
+            {
+                Value result = pop(vm);
+                vm->stack_top = frame->slots + READ_BYTE();
+                push(vm, result);
+            }
+            break;
+            case OP_WIDE: wide = (u32)READ_BYTE() << 8; break;
+            case OP_WIDE_LONG: wide = (u32)READ_SHORT() << 8; break;
+            case OP_ADD_NUMBER:      NUMBER_OP(+); break;
+            case OP_SUBTRACT_NUMBER: NUMBER_OP(-); break;
+            case OP_MULTIPLY_NUMBER: NUMBER_OP(*); break;
+            case OP_DIVIDE_NUMBER:
+            {
+                Value b = pop(vm);
+                Value a = pop(vm);
+                if (IS_INT(a) && IS_INT(b))
+                {
+                    i64 divisor  = AS_INT(b);
+                    i64 dividend = AS_INT(a);
+                    if (divisor != 0 && dividend % divisor == 0 && dividend / divisor == (i32)(dividend / divisor) &&
+                        !(dividend == 0 && divisor < 0))
+                    {
+                        push(vm, int_val((i32)(dividend / divisor)));
+                        break;
+                    }
+                }
+                push(vm, number_val(AS_NUMBER(a) / AS_NUMBER(b)));
+            }
+            break;
+            case OP_LESS_NUMBER:
+            {
+                Value b = pop(vm);
+                Value a = pop(vm);
+                push(vm, bool_val(AS_NUMBER(a) < AS_NUMBER(b)));
+            }
+            break;
+            case OP_GREATER_NUMBER:
+            {
+                Value b = pop(vm);
+                Value a = pop(vm);
+                push(vm, bool_val(AS_NUMBER(a) > AS_NUMBER(b)));
+            }
+            break;
+            case OP_NEGATE_NUMBER:
+            {
+                Value a = pop(vm);
+                if (IS_INT(a) && AS_INT(a) != 0 && AS_INT(a) != INT32_MIN)
+                {
+                    push(vm, int_val(-AS_INT(a)));
+                    break;
+                }
+                push(vm, number_val(-AS_NUMBER(a)));
+            }
+            break;
+            case OP_ADD_STRING: concatenate(vm); break;
+            case OP_GET_PROPERTY_INSTANCE:
+            {
+                ObjInstance* instance = AS_INSTANCE(peek(vm, 0));
+                ObjString* name = READ_STRING();
+
+                Value value;
+                if (table_get(&instance->fields, name, &value))
+                {
+                    pop(vm);
+                    push(vm, value);
+                    break;
+                }
+
+                if (!bind_method(vm, instance->klass, name))
                 {
-                    runtime_error(vm, "Operands must be two numbers or two strings.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
             }
             break;
-            case OP_SUBTRACT: BINARY_OP(number_val, -); break;
-            case OP_MULTIPLY: BINARY_OP(number_val, *); break;
-            case OP_DIVIDE:   BINARY_OP(number_val, /); break;
+            case OP_SET_PROPERTY_INSTANCE:
+            {
+                ObjInstance* instance = AS_INSTANCE(peek(vm, 1));
+                table_set(&vm->gc, &instance->fields, READ_STRING(), peek(vm, 0));
+                Value value = pop(vm);
+                pop(vm);
+                push(vm, value);
+            }
+            break;
+            case OP_BIT_AND:     BITWISE_OP(a & b); break;
+            case OP_BIT_OR:      BITWISE_OP(a | b); break;
+            case OP_BIT_XOR:     BITWISE_OP(a ^ b); break;
+            case OP_SHIFT_LEFT:  BITWISE_OP((i32)((u32)a << (b & 31))); break;
+            case OP_SHIFT_RIGHT: BITWISE_OP(a >> (b & 31)); break;
+            case OP_BIT_NOT:
+            {
+                i32 a;
+                if (!integer_operand(vm, peek(vm, 0), &a))
+                {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                pop(vm);
+                push(vm, int_val(~a));
+            }
+            break;
             case OP_NOT:
             {
                 push(vm, bool_val(is_falsey(pop(vm))));
@@ -668,6 +1723,23 @@ static InterpretResult run(VM* vm)
             break;
             case OP_NEGATE:
             {
+                if (IS_VECTOR(peek(vm, 0)))
+                {
+                    ObjVector* operand = AS_VECTOR(peek(vm, 0));
+                    f64 components[VECTOR_MAX];
+                    for (i32 i = 0; i < VECTOR_MAX; i++) components[i] = -operand->components[i];
+                    ObjVector* vector = new_vector(&vm->gc, &vm->store, operand->count, components);
+                    pop(vm);
+                    push(vm, OBJ_VAL(vector));
+                    break;
+                }
+
+                if (IS_INT(peek(vm, 0)) && AS_INT(peek(vm, 0)) != 0 && AS_INT(peek(vm, 0)) != INT32_MIN)
+                {
+                    push(vm, int_val(-AS_INT(pop(vm))));
+                    break;
+                }
+
                 if (!IS_NUMBER(peek(vm, 0)))
                 {
                     runtime_error(vm, "Operand must be a number.");
@@ -681,10 +1753,14 @@ static InterpretResult run(VM* vm)
     }
 
 #undef READ_BYTE
+#undef READ_INDEX
 #undef READ_CONSTANT
 #undef READ_SHORT
 #undef READ_STRING
 #undef BINARY_OP
+#undef ARITHMETIC_OP
+#undef BITWISE_OP
+#undef NUMBER_OP
 }
 
 void free_objects(ObjectStore* store, GarbageCollector* gc)
@@ -697,6 +1773,7 @@ void free_objects(ObjectStore* store, GarbageCollector* gc)
         object = next;
     }
     store->objects = NULL;
+    free_vector_pool(gc);
 
     free(gc->gray_stack);
 }
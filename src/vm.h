@@ -29,12 +29,21 @@ struct VM
     Table strings;
     Table globals;
 
+    // What the compiler knows about the globals, shared by every compile on this VM
+    GlobalScope global_scope;
+
+    // The script function of every imported module by absolute path, so each one runs once
+    Table modules;
+
     ObjString* init_string;
 
     ObjUpvalue* open_upvalues;
 
     ObjectStore store;
 
+    // Bytecode images the loaded functions run from
+    BytecodeImage* images;
+
     GarbageCollector gc;
 };
 
@@ -52,18 +61,23 @@ enum InterpretResult
 void reset_stack(VM* vm);
 void init_vm(VM* vm);
 void free_vm(VM* vm);
-InterpretResult interpret(VM* vm, const char* source);
+InterpretResult interpret(VM* vm, const char* source, const char* path, b32 lazy);
+InterpretResult interpret_cached(VM* vm, const char* source, const char* path, const char* cache_path);
 // =================================================================
 
 // =================================================================
 // Internal Functions
 // =================================================================
 static InterpretResult run(VM* vm);
+static InterpretResult run_script(VM* vm, ObjFunction* function);
+static InterpretResult run_importing_script(VM* vm, ObjFunction* function, const char* path, ImportList* imports);
 static void push(VM* vm, Value value);
 static Value pop(VM* vm);
 static Value peek(VM* vm, i32 distance);
 static b32 is_falsey(Value value);
 static void concatenate(VM* vm);
+static Map* switch_labels(VM* vm, ObjFunction* function, u8 table, u8* entries, u16 count);
+static Chunk* frame_chunk(CallFrame* frame);
 static void runtime_error(VM* vm, const char* format, ...);
 void free_objects(ObjectStore* store, GarbageCollector* gc);
 // =================================================================